@@ -0,0 +1,130 @@
+#ifndef _BENCH_BENCH_HPP
+#define _BENCH_BENCH_HPP
+
+/* Minimal timing harness shared by the benchmark programs.
+ *
+ * Each benchmark is a callable run repeatedly in batches; the batch
+ * size grows until a batch takes long enough to time reliably, then
+ * batches are repeated until the time budget is used up.  The
+ * reported figures are per operation, taken over the batches.
+ *
+ * Command line: [--filter SUBSTRING] [--min-time MILLISECONDS]
+ * followed by any program-specific options, which are left in
+ * Runner::args(). */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+  /* Prevents the compiler from discarding a computed value. */
+  template <class T>
+  inline void do_not_optimize(const T &value)
+  {
+    asm volatile("" : : "r,m"(value) : "memory");
+  }
+
+  class Runner
+  {
+    typedef std::chrono::steady_clock clock;
+
+    std::string filter;
+    double min_time_ms = 500;
+    std::vector<std::string> args_;
+
+  public:
+    Runner(int argc, char **argv)
+    {
+      for (int i = 1; i < argc; ++i)
+      {
+        if (!std::strcmp(argv[i], "--filter") && i + 1 < argc)
+          filter = argv[++i];
+        else if (!std::strcmp(argv[i], "--min-time") && i + 1 < argc)
+          min_time_ms = std::atof(argv[++i]);
+        else
+          args_.push_back(argv[i]);
+      }
+      std::printf("%-40s %12s %12s %12s %12s\n",
+                  "benchmark", "iterations", "min", "median", "mean");
+    }
+
+    const std::vector<std::string> &args() const { return args_; }
+
+    bool enabled(const std::string &name) const
+    {
+      return filter.empty() || name.find(filter) != std::string::npos;
+    }
+
+    template <class Op>
+    void run(const std::string &name, Op &&op)
+    {
+      if (!enabled(name))
+        return;
+
+      // Warm up, and find a batch size that takes at least ~1ms.
+      size_t batch = 1;
+      for (;;)
+      {
+        double t = time_batch(op, batch);
+        if (t >= 1e6 || batch >= (size_t(1) << 30))
+          break;
+        batch *= 2;
+      }
+
+      std::vector<double> per_op;
+      size_t iterations = 0;
+      double total = 0;
+      do
+      {
+        double t = time_batch(op, batch);
+        per_op.push_back(t / batch);
+        iterations += batch;
+        total += t;
+      } while (total < min_time_ms * 1e6 || per_op.size() < 5);
+
+      std::sort(per_op.begin(), per_op.end());
+      report(name, iterations, per_op.front(), per_op[per_op.size() / 2],
+             total / iterations);
+    }
+
+    /* Reports an operation timed externally, e.g. one that cannot be
+       repeated without expensive setup. */
+    void report(const std::string &name, size_t iterations,
+                double min_ns, double median_ns, double mean_ns)
+    {
+      std::printf("%-40s %12zu %12s %12s %12s\n", name.c_str(), iterations,
+                  format_ns(min_ns).c_str(), format_ns(median_ns).c_str(),
+                  format_ns(mean_ns).c_str());
+      std::fflush(stdout);
+    }
+
+  private:
+    template <class Op>
+    static double time_batch(Op &op, size_t n)
+    {
+      clock::time_point start = clock::now();
+      for (size_t i = 0; i < n; ++i)
+        op();
+      return std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    }
+
+    static std::string format_ns(double ns)
+    {
+      char buf[32];
+      if (ns < 1e3)
+        std::snprintf(buf, sizeof(buf), "%.1f ns", ns);
+      else if (ns < 1e6)
+        std::snprintf(buf, sizeof(buf), "%.2f us", ns / 1e3);
+      else
+        std::snprintf(buf, sizeof(buf), "%.2f ms", ns / 1e6);
+      return buf;
+    }
+  };
+}
+
+#endif /* _BENCH_BENCH_HPP */
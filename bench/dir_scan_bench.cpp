@@ -0,0 +1,124 @@
+/* Benchmarks for util/dir_scan.hpp: listing directories of 1k, 10k
+ * and 100k entries as file completion does, with getdents64 and
+ * d_type, against readdir and against the directory_iterator and
+ * per-entry lstat it replaces.
+ *
+ * Options: [--dir PATH] [--keep]
+ * The directories are created under --dir, by default /tmp, and
+ * removed afterwards unless --keep is given.  Results on a warm dentry
+ * cache; drop caches between runs to time a cold one. */
+
+#include "bench.hpp"
+
+#include <util/dir_scan.hpp>
+
+#include <boost/filesystem/operations.hpp>
+#include <cstdio>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+  // Mostly regular files, some executable, with subdirectories and
+  // symbolic links mixed in.
+  void populate(const std::string &dir, size_t count)
+  {
+    boost::filesystem::create_directories(dir);
+    for (size_t i = 0; i < count; ++i)
+    {
+      std::string path = dir + "/entry" + std::to_string(i);
+      switch (i % 20)
+      {
+      case 0: case 1: case 2:
+        mkdir(path.c_str(), 0755);
+        break;
+      case 3:
+        symlink("entry0", (path + ".lnk").c_str());
+        break;
+      default:
+        {
+          int fd = open((path + (i % 20 == 4 ? "" : ".txt")).c_str(),
+                        O_WRONLY | O_CREAT | O_EXCL, i % 20 == 4 ? 0755 : 0644);
+          if (fd >= 0)
+            close(fd);
+        }
+      }
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  bench::Runner runner(argc, argv);
+
+  std::string base = "/tmp";
+  bool keep = false;
+  for (size_t i = 0; i < runner.args().size(); ++i)
+  {
+    if (runner.args()[i] == "--dir" && i + 1 < runner.args().size())
+      base = runner.args()[++i];
+    else if (runner.args()[i] == "--keep")
+      keep = true;
+  }
+  const std::string root = base + "/jmswm-dir-scan-bench";
+
+  static const size_t sizes[] = { 1000, 10000, 100000 };
+  for (size_t size : sizes)
+  {
+    const std::string dir = root + "/" + std::to_string(size);
+    const std::string suffix = "/" + std::to_string(size);
+    if (!boost::filesystem::exists(dir))
+      populate(dir, size);
+
+    // The previous file completion listing.
+    runner.run("directory_iterator_lstat" + suffix, [&] {
+        size_t n = 0;
+        for (boost::filesystem::directory_iterator it(dir), end; it != end; ++it)
+        {
+          struct stat st;
+          n += lstat(it->path().string().c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        bench::do_not_optimize(n);
+      });
+
+    runner.run("readdir" + suffix, [&] {
+        size_t n = 0;
+        DIR *d = opendir(dir.c_str());
+        while (struct dirent *e = readdir(d))
+          n += e->d_type == DT_DIR;
+        closedir(d);
+        bench::do_not_optimize(n);
+      });
+
+    runner.run("getdents64" + suffix, [&] {
+        size_t n = 0;
+        DirScanner scan(dir.c_str());
+        while (scan.next())
+          n += S_ISDIR(scan.type());
+        bench::do_not_optimize(n);
+      });
+
+    // The worst case of the completer: an empty prefix, so every
+    // regular file is stat'ed for the exec style.
+    runner.run("getdents64_stat_regular" + suffix, [&] {
+        size_t n = 0;
+        DirScanner scan(dir.c_str());
+        while (scan.next())
+        {
+          mode_t mode = scan.type();
+          if (mode == 0 || S_ISREG(mode))
+            mode = scan.stat_mode(scan.name());
+          n += (mode & S_IXUSR) != 0;
+        }
+        bench::do_not_optimize(n);
+      });
+  }
+
+  if (!keep)
+    boost::filesystem::remove_all(root);
+
+  return 0;
+}
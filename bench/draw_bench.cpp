@@ -0,0 +1,483 @@
+/* Rendering benchmarks for the draw layer, built against the headless
+ * Pango-Cairo backend.  The workloads replay the drawing calls made
+ * by WFrame::draw, WBar's draw and Menu::draw with the shipped style
+ * file, so that the figures track what the window manager actually
+ * spends per redraw.
+ *
+ * Options: [--style FILE] [--dump DIRECTORY]
+ * --dump writes the final image of each workload as a PNG, which is
+ * useful for checking rendering changes by eye or by diffing. */
+
+#include "bench.hpp"
+
+#include <draw/draw.hpp>
+#include <style/db.hpp>
+
+#include <cairo.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+  struct FrameColors
+  {
+    WColor highlight_color, shadow_color, padding_color, background_color,
+      label_foreground_color, label_background_color, label_extra_color;
+
+    FrameColors(WDrawContext &dc, const style::Spec &s)
+      : highlight_color(dc, s.get<ascii_string>("highlight_color")),
+        shadow_color(dc, s.get<ascii_string>("shadow_color")),
+        padding_color(dc, s.get<ascii_string>("padding_color")),
+        background_color(dc, s.get<ascii_string>("background_color")),
+        label_foreground_color(dc, s.get<ascii_string>("label_foreground_color")),
+        label_background_color(dc, s.get<ascii_string>("label_background_color")),
+        label_extra_color(dc, s.get<ascii_string>("label_extra_color"))
+    {}
+  };
+
+  struct FrameStyle
+  {
+    WFont label_font;
+    WColor client_background_color;
+    FrameColors active_selected, inactive;
+    int highlight_pixels, shadow_pixels, padding_pixels, spacing,
+      label_horizontal_padding, label_vertical_padding, label_component_spacing;
+
+    FrameStyle(WDrawContext &dc, const style::Spec &s)
+      : label_font(dc, s.get<ascii_string>("label_font")),
+        client_background_color(dc, s.get<ascii_string>("client_background_color")),
+        active_selected(dc, s.get<style::Spec>("normal").get<style::Spec>("active_selected")),
+        inactive(dc, s.get<style::Spec>("normal").get<style::Spec>("inactive")),
+        highlight_pixels(s.get<int>("highlight_pixels")),
+        shadow_pixels(s.get<int>("shadow_pixels")),
+        padding_pixels(s.get<int>("padding_pixels")),
+        spacing(s.get<int>("spacing")),
+        label_horizontal_padding(s.get<int>("label_horizontal_padding")),
+        label_vertical_padding(s.get<int>("label_vertical_padding")),
+        label_component_spacing(s.get<int>("label_component_spacing"))
+    {}
+
+    int bar_height() const
+    {
+      return label_font.height() + label_vertical_padding * 2;
+    }
+  };
+
+  struct BarStyle
+  {
+    WFont label_font;
+    WColor highlight_color, shadow_color, padding_color, background_color;
+    WColor cell_foreground, cell_background;
+    int highlight_pixels, shadow_pixels, padding_pixels, spacing,
+      label_horizontal_padding, label_vertical_padding, cell_spacing;
+
+    BarStyle(WDrawContext &dc, const style::Spec &s, const style::Spec &cell)
+      : label_font(dc, s.get<ascii_string>("label_font")),
+        highlight_color(dc, s.get<ascii_string>("highlight_color")),
+        shadow_color(dc, s.get<ascii_string>("shadow_color")),
+        padding_color(dc, s.get<ascii_string>("padding_color")),
+        background_color(dc, s.get<ascii_string>("background_color")),
+        cell_foreground(dc, cell.get<ascii_string>("foreground_color")),
+        cell_background(dc, cell.get<ascii_string>("background_color")),
+        highlight_pixels(s.get<int>("highlight_pixels")),
+        shadow_pixels(s.get<int>("shadow_pixels")),
+        padding_pixels(s.get<int>("padding_pixels")),
+        spacing(s.get<int>("spacing")),
+        label_horizontal_padding(s.get<int>("label_horizontal_padding")),
+        label_vertical_padding(s.get<int>("label_vertical_padding")),
+        cell_spacing(s.get<int>("cell_spacing"))
+    {}
+
+    int height() const
+    {
+      return label_font.height() + 2 * label_vertical_padding
+        + highlight_pixels + shadow_pixels + 2 * (padding_pixels + spacing);
+    }
+  };
+
+  struct TextColor
+  {
+    WColor foreground, background;
+    TextColor(WDrawContext &dc, const style::Spec &s)
+      : foreground(dc, s.get<ascii_string>("foreground")),
+        background(dc, s.get<ascii_string>("background"))
+    {}
+  };
+
+  struct MenuStyle
+  {
+    WFont font;
+    int horizontal_padding, vertical_padding;
+    int border_pixels;
+    WColor border_color;
+    TextColor prompt, input, selected, cursor;
+    WColor completions_background;
+    int completions_spacing;
+    TextColor entry_normal, entry_selected;
+
+    MenuStyle(WDrawContext &dc, const style::Spec &s, const style::Spec &entry)
+      : font(dc, s.get<style::Spec>("label").get<ascii_string>("font")),
+        horizontal_padding(s.get<style::Spec>("label").get<int>("horizontal_padding")),
+        vertical_padding(s.get<style::Spec>("label").get<int>("vertical_padding")),
+        border_pixels(s.get<int>("border_pixels")),
+        border_color(dc, s.get<ascii_string>("border_color")),
+        prompt(dc, s.get<style::Spec>("prompt")),
+        input(dc, s.get<style::Spec>("input")),
+        selected(dc, s.get<style::Spec>("selected")),
+        cursor(dc, s.get<style::Spec>("cursor")),
+        completions_background(dc, s.get<ascii_string>("completions_background")),
+        completions_spacing(s.get<int>("completions_spacing")),
+        entry_normal(dc, entry.get<style::Spec>("normal")),
+        entry_selected(dc, entry.get<style::Spec>("selected"))
+    {}
+  };
+
+  /* Same sequence of calls as WFrame::draw for a decorated frame. */
+  void draw_frame(WDrawable &d, const FrameStyle &style, const FrameColors &substyle,
+                  const WRect &bounds, const utf8_string &tags,
+                  const utf8_string &context_info, const utf8_string &name)
+  {
+    WRect rect(0, 0, bounds.width, bounds.height);
+
+    fill_rect(d, substyle.background_color, rect);
+
+    draw_border(d, substyle.highlight_color, style.highlight_pixels,
+                substyle.shadow_color, style.shadow_pixels,
+                rect);
+
+    WRect rect2 = rect.inside_tl_br_border(style.highlight_pixels,
+                                           style.shadow_pixels);
+
+    draw_border(d, substyle.padding_color, style.padding_pixels, rect2);
+
+    WRect rect3 = rect2.inside_border(style.padding_pixels + style.spacing);
+    rect3.height = style.bar_height();
+
+    int width = draw_label_with_background(d, tags,
+                                           style.label_font,
+                                           substyle.label_foreground_color,
+                                           substyle.label_extra_color,
+                                           rect3,
+                                           style.label_horizontal_padding,
+                                           style.label_vertical_padding,
+                                           false);
+
+    rect3.width -= (width + style.label_component_spacing);
+    rect3.x += (width + style.label_component_spacing);
+
+    if (!context_info.empty())
+    {
+      int width_limit = rect3.width / 2;
+      int width2 = draw_label_with_background
+        (d, context_info,
+         style.label_font,
+         substyle.label_foreground_color,
+         substyle.label_extra_color,
+         WRect(rect3.x + rect3.width - width_limit, rect3.y,
+               width_limit, rect3.height),
+         style.label_horizontal_padding,
+         style.label_vertical_padding,
+         true);
+      rect3.width -= (width2 + style.label_component_spacing);
+    }
+
+    fill_rect(d, substyle.label_background_color, rect3);
+
+    draw_label(d, name, style.label_font, substyle.label_foreground_color,
+               rect3.inside_lr_tb_border(style.label_horizontal_padding,
+                                         style.label_vertical_padding));
+
+    int tl_off = style.highlight_pixels + style.padding_pixels + style.spacing;
+    int br_off = style.shadow_pixels + style.padding_pixels + style.spacing;
+    WRect client_rect;
+    client_rect.x = tl_off;
+    client_rect.width = bounds.width - client_rect.x - br_off;
+    client_rect.y = tl_off + style.bar_height() + style.spacing;
+    client_rect.height = bounds.height - client_rect.y - br_off;
+    fill_rect(d, style.client_background_color, client_rect);
+  }
+
+  /* Same sequence of calls as WBar's draw, without tray icons. */
+  void draw_bar(WDrawable &d, const BarStyle &style, const WRect &bounds,
+                const std::vector<utf8_string> &left,
+                const std::vector<utf8_string> &right)
+  {
+    WRect rect(0, 0, bounds.width, bounds.height);
+
+    fill_rect(d, style.background_color, rect);
+
+    draw_border(d, style.highlight_color, style.highlight_pixels,
+                style.shadow_color, style.shadow_pixels, rect);
+
+    WRect rect2 = rect.inside_tl_br_border(style.highlight_pixels, style.shadow_pixels);
+
+    draw_border(d, style.padding_color, style.padding_pixels, rect2);
+
+    WRect rect3 = rect2.inside_border(style.padding_pixels + style.spacing);
+    rect3.height = style.label_font.height() + 2 * style.label_vertical_padding;
+
+    for (const utf8_string &text : left)
+    {
+      int width = draw_label_with_background(d, text, style.label_font,
+                                             style.cell_foreground,
+                                             style.cell_background,
+                                             rect3,
+                                             style.label_horizontal_padding,
+                                             style.label_vertical_padding,
+                                             false);
+      rect3.width -= (width + style.cell_spacing);
+      rect3.x += width + style.cell_spacing;
+    }
+
+    for (auto it = right.rbegin(); it != right.rend(); ++it)
+    {
+      int width = draw_label_with_background(d, *it, style.label_font,
+                                             style.cell_foreground,
+                                             style.cell_background,
+                                             rect3,
+                                             style.label_horizontal_padding,
+                                             style.label_vertical_padding,
+                                             true);
+      rect3.width -= (width + style.cell_spacing);
+    }
+  }
+
+  /* Same sequence of calls as Menu::draw for the input line. */
+  void draw_menu_input(WDrawable &d, const MenuStyle &style, const WRect &bounds,
+                       const utf8_string &prompt, const utf8_string &input,
+                       int cursor_position, int mark_position)
+  {
+    WRect inner_rect = bounds.inside_border(style.border_pixels);
+    int available_text_width = inner_rect.width - 2 * style.horizontal_padding;
+    int prompt_width = compute_label_width(d, prompt, style.font,
+                                           available_text_width);
+    WRect prompt_rect = inner_rect;
+    prompt_rect.width = prompt_width + 2 * style.horizontal_padding;
+    WRect prompt_text_rect
+      = prompt_rect.inside_lr_tb_border(style.horizontal_padding,
+                                        style.vertical_padding);
+    WRect input_rect = inner_rect;
+    input_rect.x += prompt_rect.width;
+    input_rect.width -= prompt_rect.width;
+    WRect input_text_rect
+      = input_rect.inside_lr_tb_border(style.horizontal_padding,
+                                       style.vertical_padding);
+
+    draw_border(d, style.border_color, style.border_pixels, bounds);
+
+    fill_rect(d, style.prompt.background, prompt_rect);
+    draw_label(d, prompt, style.font, style.prompt.foreground, prompt_text_rect);
+
+    fill_rect(d, style.input.background, input_rect);
+
+    draw_label_with_cursor_and_selection
+      (d, input + ' ', style.font,
+       style.input.foreground,
+       style.cursor.foreground, style.cursor.background,
+       style.selected.foreground, style.selected.background,
+       input_text_rect, cursor_position, mark_position);
+  }
+
+  /* Same layout and calls as ListCompletions::draw. */
+  void draw_completion_list(WDrawable &d, const MenuStyle &style, const WRect &rect,
+                            const std::vector<utf8_string> &entries, int selected)
+  {
+    size_t maximum_width = 0;
+    for (const utf8_string &e : entries)
+      maximum_width = std::max(maximum_width, e.size());
+
+    int available_width = rect.width - 2 * style.border_pixels;
+    int column_width = maximum_width * style.font.approximate_width() + 10
+      + 2 * style.horizontal_padding;
+    if (column_width > available_width)
+      column_width = available_width;
+    int columns = available_width / column_width;
+    int line_height = style.vertical_padding * 2
+      + style.font.height() + 2 * style.completions_spacing;
+
+    fill_rect(d, style.completions_background, rect);
+
+    int spacing = style.completions_spacing;
+    int border_pixels = style.border_pixels;
+
+    draw_border(d, style.border_color,
+                border_pixels, border_pixels, border_pixels, 0,
+                rect);
+
+    WRect rect2 = rect.inside_border(border_pixels, border_pixels,
+                                     border_pixels, 0);
+
+    int lines = (rect2.height - 2 * spacing) / line_height;
+    size_t end = std::min(entries.size(), size_t(lines * columns));
+
+    for (size_t i = 0; i < end; ++i)
+    {
+      int row = i / columns;
+      int col = i % columns;
+
+      WRect label_rect1(rect2.x + column_width * col,
+                        rect2.y + spacing + line_height * row,
+                        column_width, line_height);
+
+      WRect label_rect3 = label_rect1.inside_lr_tb_border(0, spacing)
+        .inside_lr_tb_border(style.horizontal_padding, style.vertical_padding);
+
+      const TextColor &text_color
+        = ((int)i == selected) ? style.entry_selected : style.entry_normal;
+
+      draw_label_with_text_background(d, entries[i], style.font,
+                                      text_color.foreground, text_color.background,
+                                      label_rect3);
+    }
+  }
+
+  void dump(const std::string &dir, const char *name, WPixmap &pixmap)
+  {
+    if (dir.empty())
+      return;
+    std::string path = dir + "/" + name + ".png";
+    cairo_surface_t *s = pixmap.drawable().surface();
+    cairo_surface_flush(s);
+    if (cairo_surface_write_to_png(s, path.c_str()) != CAIRO_STATUS_SUCCESS)
+      std::fprintf(stderr, "failed to write %s\n", path.c_str());
+  }
+}
+
+int main(int argc, char **argv)
+{
+  bench::Runner runner(argc, argv);
+
+  std::string style_path = JMSWM_BENCH_STYLE;
+  std::string dump_dir;
+  for (size_t i = 0; i < runner.args().size(); ++i)
+  {
+    if (runner.args()[i] == "--style" && i + 1 < runner.args().size())
+      style_path = runner.args()[++i];
+    else if (runner.args()[i] == "--dump" && i + 1 < runner.args().size())
+      dump_dir = runner.args()[++i];
+  }
+
+  style::DB db;
+  try
+  {
+    db.load(style_path);
+  } catch (style::LoadError &e)
+  {
+    std::fprintf(stderr, "%s:%d: %s\n", e.filename().c_str(), e.line_number(),
+                 e.message().c_str());
+    return 1;
+  }
+
+  WDrawContext dc;
+  FrameStyle frame_style(dc, db["wm_frame"]);
+  BarStyle bar_style(dc, db["bar"], db["default_bar_cell"]);
+  MenuStyle menu_style(dc, db["menu"], db["list_completion_entry_default"]);
+
+  const int screen_width = 1920, screen_height = 1200;
+
+  /* Frame decorations: a half-screen column frame, as drawn on
+     every focus change and title update. */
+  {
+    WRect bounds(0, 0, screen_width / 2, screen_height - bar_style.height());
+    WPixmap pixmap(dc, bounds.width, bounds.height);
+    WDrawable &d = pixmap.drawable();
+
+    runner.run("frame/active", [&] {
+        draw_frame(d, frame_style, frame_style.active_selected, bounds, "1 www",
+                   "~/src/jmswm", "emacs@localhost: draw_bench.cpp");
+      });
+    runner.run("frame/inactive_long_title", [&] {
+        draw_frame(d, frame_style, frame_style.inactive, bounds, "mail",
+                   "",
+                   "Re: [PATCH v3 07/12] draw: render frame decorations "
+                   "into retained per-window buffers - Mozilla Thunderbird");
+      });
+    runner.run("frame/shaded_height", [&] {
+        WRect shaded(0, 0, bounds.width,
+                     frame_style.bar_height() + 2 * (frame_style.padding_pixels
+                                                     + frame_style.spacing + 1));
+        draw_frame(d, frame_style, frame_style.inactive, shaded, "2",
+                   "", "xterm");
+      });
+    draw_frame(d, frame_style, frame_style.active_selected, bounds, "1 www",
+               "~/src/jmswm", "emacs@localhost: draw_bench.cpp");
+    dump(dump_dir, "frame", pixmap);
+  }
+
+  /* Status bar with a typical set of applet cells. */
+  {
+    WRect bounds(0, 0, screen_width, bar_style.height());
+    WPixmap pixmap(dc, bounds.width, bounds.height);
+    WDrawable &d = pixmap.drawable();
+    std::vector<utf8_string> left = { "1", "2", "www", "mail", "irc", "music" };
+    std::vector<utf8_string> right = { "#emacs(3) #boost", "INBOX 4",
+                                       "wlan0 74% 192.168.1.20", "vol 45%",
+                                       "bat 87% 3:12", "Mon 2026-10-19 14:03" };
+
+    runner.run("bar/full", [&] {
+        draw_bar(d, bar_style, bounds, left, right);
+      });
+    dump(dump_dir, "bar", pixmap);
+  }
+
+  /* Completion menu: input line plus a grid of file completions. */
+  {
+    WRect input_bounds(0, 0, screen_width,
+                       frame_style.bar_height() + 2 * (frame_style.padding_pixels
+                                                       + frame_style.spacing + 1));
+    WPixmap input_pixmap(dc, input_bounds.width, input_bounds.height);
+    WDrawable &d = input_pixmap.drawable();
+
+    runner.run("menu/input", [&] {
+        draw_menu_input(d, menu_style, input_bounds, "Edit file:",
+                        "~/src/jmswm/src/draw/dr", 23, 10);
+      });
+    dump(dump_dir, "menu_input", input_pixmap);
+
+    std::vector<utf8_string> entries;
+    for (int i = 0; i < 200; ++i)
+      entries.push_back("src/module_" + std::to_string(i) + "/file_"
+                        + std::to_string(i * 7919 % 1000) + ".cpp");
+
+    WRect list_bounds(0, 0, screen_width / 2, (screen_height - input_bounds.height) * 3 / 8);
+    WPixmap list_pixmap(dc, list_bounds.width, list_bounds.height);
+    WDrawable &ld = list_pixmap.drawable();
+
+    runner.run("menu/completion_list", [&] {
+        draw_completion_list(ld, menu_style, list_bounds, entries, 3);
+      });
+    dump(dump_dir, "menu_completions", list_pixmap);
+  }
+
+  /* Individual operations, for attributing the workload figures. */
+  {
+    WPixmap pixmap(dc, screen_width, 64);
+    WDrawable &d = pixmap.drawable();
+    WRect label_rect(0, 0, 600, frame_style.bar_height());
+
+    runner.run("op/compute_label_width", [&] {
+        bench::do_not_optimize(compute_label_width(d, "emacs@localhost: draw_bench.cpp",
+                                                   frame_style.label_font, 600));
+      });
+    runner.run("op/draw_label", [&] {
+        draw_label(d, "emacs@localhost: draw_bench.cpp", frame_style.label_font,
+                   frame_style.active_selected.label_foreground_color, label_rect);
+      });
+    runner.run("op/draw_label_ellipsized", [&] {
+        draw_label(d, std::string(400, 'x'), frame_style.label_font,
+                   frame_style.active_selected.label_foreground_color, label_rect);
+      });
+    runner.run("op/fill_rect_600x20", [&] {
+        fill_rect(d, frame_style.active_selected.label_background_color, label_rect);
+      });
+    runner.run("op/draw_border_frame", [&] {
+        draw_border(d, frame_style.active_selected.highlight_color, 1,
+                    frame_style.active_selected.shadow_color, 1,
+                    WRect(0, 0, screen_width, 64));
+      });
+  }
+
+  return 0;
+}
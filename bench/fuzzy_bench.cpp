@@ -0,0 +1,253 @@
+/* Benchmarks for the fuzzy matcher in menu/fuzzy_match.hpp, run over
+ * 100k path-like candidates as a file or project completer would see.
+ *
+ * Options: [--candidates FILE] [--count N]
+ * --candidates reads one candidate per line instead of generating
+ * them, e.g. the output of `git ls-files' or `find ~'. */
+
+#include "bench.hpp"
+
+#include <menu/fuzzy_match.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace menu::fuzzy;
+
+namespace
+{
+  std::vector<std::string> generate_candidates(size_t count)
+  {
+    static const char *const words[] = {
+      "src", "include", "lib", "test", "doc", "util", "menu", "wm", "draw",
+      "style", "extra", "bar", "frame", "client", "view", "column", "event",
+      "config", "build", "home", "jbms", "music", "photos", "2019", "archive",
+      "Projects", "README", "Makefile", "CMakeLists", "main", "fuzzy_match",
+      "list_completion", "file_completion", "url_completion", "key", "persistence",
+      "battery_applet", "volume_applet", "network", "mail", "org", "notes",
+    };
+    static const char *const extensions[] = {
+      ".cpp", ".hpp", ".c", ".h", ".txt", ".md", ".org", ".py", "", ".png", ".jpg",
+    };
+    const size_t num_words = sizeof(words) / sizeof(words[0]);
+    const size_t num_extensions = sizeof(extensions) / sizeof(extensions[0]);
+
+    std::mt19937 rng(42);
+    std::vector<std::string> result;
+    result.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+      std::string s;
+      size_t depth = 1 + rng() % 5;
+      for (size_t j = 0; j < depth; ++j)
+      {
+        if (j)
+          s += '/';
+        s += words[rng() % num_words];
+        if (rng() % 4 == 0)
+          s += std::to_string(rng() % 100);
+      }
+      s += extensions[rng() % num_extensions];
+      result.push_back(std::move(s));
+    }
+    return result;
+  }
+
+  struct Scored
+  {
+    int score;
+    size_t index;
+    bool operator<(const Scored &x) const { return score > x.score; }
+  };
+}
+
+int main(int argc, char **argv)
+{
+  bench::Runner runner(argc, argv);
+
+  std::string candidates_path;
+  size_t count = 100000;
+  for (size_t i = 0; i < runner.args().size(); ++i)
+  {
+    if (runner.args()[i] == "--candidates" && i + 1 < runner.args().size())
+      candidates_path = runner.args()[++i];
+    else if (runner.args()[i] == "--count" && i + 1 < runner.args().size())
+      count = std::stoul(runner.args()[++i]);
+  }
+
+  std::vector<std::string> candidates;
+  if (!candidates_path.empty())
+  {
+    std::ifstream in(candidates_path.c_str());
+    std::string line;
+    while (std::getline(in, line))
+      candidates.push_back(line);
+    if (candidates.empty())
+    {
+      std::fprintf(stderr, "%s: no candidates\n", candidates_path.c_str());
+      return 1;
+    }
+  } else
+    candidates = generate_candidates(count);
+
+  // Computed once per candidate list by the completer.
+  std::vector<CharMask> masks(candidates.size());
+  for (size_t i = 0; i < candidates.size(); ++i)
+    masks[i] = char_mask(candidates[i]);
+
+  std::vector<CharMask> scratch(candidates.size());
+  runner.run("char_mask/all", [&] {
+      for (size_t i = 0; i < candidates.size(); ++i)
+        scratch[i] = char_mask(candidates[i]);
+      bench::do_not_optimize(scratch.data());
+    });
+
+  static const char *const patterns[] = {
+    "m", "wm", "mcp", "srcmenu", "fuzzymatch", "Menu", "bar/frame.cpp", "zqxj",
+  };
+
+  for (const char *text : patterns)
+  {
+    Pattern pattern(text);
+    const std::string suffix = std::string("/") + text;
+
+    size_t passed = 0, matched = 0;
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+      int score;
+      if (pattern.may_match(masks[i]))
+      {
+        ++passed;
+        if (match(pattern, candidates[i], score))
+          ++matched;
+      }
+    }
+    std::printf("# %-16s %zu candidates, %zu pass the prefilter, %zu match\n",
+                text, candidates.size(), passed, matched);
+
+    runner.run("prefilter" + suffix, [&] {
+        size_t n = 0;
+        for (size_t i = 0; i < masks.size(); ++i)
+          n += pattern.may_match(masks[i]);
+        bench::do_not_optimize(n);
+      });
+
+    // The per-keystroke cost of the fuzzy completer, less drawing.
+    std::vector<Scored> scored;
+    runner.run("match_and_sort" + suffix, [&] {
+        scored.clear();
+        for (size_t i = 0; i < candidates.size(); ++i)
+        {
+          int score;
+          if (pattern.may_match(masks[i]) && match(pattern, candidates[i], score))
+            scored.push_back(Scored{score, i});
+        }
+        std::sort(scored.begin(), scored.end());
+        bench::do_not_optimize(scored.data());
+      });
+
+    // Without the prefilter, for comparison.
+    runner.run("match_unfiltered" + suffix, [&] {
+        size_t n = 0;
+        for (size_t i = 0; i < candidates.size(); ++i)
+        {
+          int score;
+          n += match(pattern, candidates[i], score);
+        }
+        bench::do_not_optimize(n);
+      });
+
+    // Match ranges are computed only for the entries drawn, ~50.
+    MatchRanges ranges;
+    runner.run("highlight_visible" + suffix, [&] {
+        for (size_t i = 0; i < scored.size() && i < 50; ++i)
+        {
+          int score;
+          match(pattern, candidates[scored[i].index], score, &ranges);
+          bench::do_not_optimize(ranges.data());
+        }
+      });
+
+    // Plain substring search, the cost floor of any scan.
+    runner.run("substring" + suffix, [&] {
+        size_t n = 0;
+        for (size_t i = 0; i < candidates.size(); ++i)
+          n += candidates[i].find(text) != std::string::npos;
+        bench::do_not_optimize(n);
+      });
+  }
+
+  // Typing a pattern one character at a time: each keystroke after
+  // the first, rescanning every candidate versus rescoring only the
+  // previous keystroke's matches, as the fuzzy completer does.  The
+  // first keystroke is a full scan either way.
+  static const char *const typed[] = { "srcmenu", "fuzzymatch", "bar/frame.cpp" };
+  for (const char *text : typed)
+  {
+    const std::string full(text);
+    std::vector<uint32_t> previous, current;
+    {
+      Pattern pattern(full.substr(0, 1));
+      for (uint32_t i = 0; i < candidates.size(); ++i)
+      {
+        int score;
+        if (pattern.may_match(masks[i]) && match(pattern, candidates[i], score))
+          previous.push_back(i);
+      }
+    }
+
+    for (size_t len = 2; len <= full.size(); ++len)
+    {
+      const std::string prefix = full.substr(0, len), suffix = "/" + prefix;
+      Pattern pattern(prefix);
+      current.clear();
+      for (uint32_t i : previous)
+      {
+        int score;
+        if (pattern.may_match(masks[i]) && match(pattern, candidates[i], score))
+          current.push_back(i);
+      }
+      std::printf("# %-16s %zu previous matches, %zu match\n",
+                  prefix.c_str(), previous.size(), current.size());
+
+      std::vector<Scored> scored;
+      std::vector<uint32_t> matched;
+
+      runner.run("keystroke_full_scan" + suffix, [&] {
+          scored.clear();
+          for (size_t i = 0; i < candidates.size(); ++i)
+          {
+            int score;
+            if (pattern.may_match(masks[i]) && match(pattern, candidates[i], score))
+              scored.push_back(Scored{score, i});
+          }
+          std::sort(scored.begin(), scored.end());
+          bench::do_not_optimize(scored.data());
+        });
+
+      runner.run("keystroke_narrowing" + suffix, [&] {
+          scored.clear();
+          matched.clear();
+          for (uint32_t i : previous)
+          {
+            int score;
+            if (pattern.may_match(masks[i]) && match(pattern, candidates[i], score))
+            {
+              scored.push_back(Scored{score, i});
+              matched.push_back(i);
+            }
+          }
+          std::sort(scored.begin(), scored.end());
+          bench::do_not_optimize(scored.data());
+        });
+
+      previous.swap(current);
+    }
+  }
+
+  return 0;
+}
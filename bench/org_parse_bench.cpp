@@ -0,0 +1,151 @@
+/* Benchmarks for wm/extra/org_bookmarks.hpp: parsing a generated org
+ * file of 10k headings, with links, bare URLs and categories, with the
+ * scanner and with the per-line boost::regex parser it replaces.
+ *
+ * Options: [--org FILE]
+ * Parses FILE instead of the generated text, which is otherwise
+ * written to /tmp for the file benchmark.  The size of the text and
+ * the number of bookmarks in it are printed with the timings. */
+
+#include "bench.hpp"
+
+#include <wm/extra/org_bookmarks.hpp>
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/regex.hpp>
+#include <cstdio>
+#include <random>
+#include <sstream>
+#include <string>
+
+namespace
+{
+  std::string generate(size_t headings)
+  {
+    std::mt19937 rng(42);
+    static const char *const words[] = {
+      "release", "notes", "kernel", "window", "manager", "cairo", "review",
+      "meeting", "draft", "paper", "build", "cache", "index", "menu"
+    };
+    const size_t word_count = sizeof(words) / sizeof(words[0]);
+    std::string text;
+    for (size_t i = 0; i < headings; ++i)
+    {
+      if (i % 500 == 0)
+        text += "#+CATEGORY: project" + std::to_string(i / 500) + "\n";
+      text += std::string(1 + rng() % 3, '*') + " " + words[rng() % word_count]
+        + " " + words[rng() % word_count] + "\n";
+      switch (rng() % 4)
+      {
+      case 0:
+        text += "  [[https://example.org/" + std::to_string(i) + "/"
+          + words[rng() % word_count] + "?id=" + std::to_string(rng())
+          + "][" + words[rng() % word_count] + " page]]\n";
+        break;
+      case 1:
+        text += "  see http://www.example.com/" + std::to_string(i)
+          + "/index.html for details\n";
+        break;
+      default:
+        text += "  SCHEDULED: <2009-01-01 Thu> plain text without links\n";
+      }
+      text += "  :PROPERTIES:\n  :ID: " + std::to_string(rng()) + "\n  :END:\n";
+    }
+    return text;
+  }
+
+  void regex_parse(const std::string &text, std::vector<BookmarkSpec> &cache)
+  {
+    static const boost::regex category_regex("^#\\+CATEGORY:[ \t]*([^ \t].*)$");
+    static const boost::regex outline_regex("^(\\*)+[ \t]*([^* \t][^*]*)$");
+    static const boost::regex org_url("\\[\\[((?:http|ftp|https)://[^\\]]+)\\]\\[([^\\]]+)\\]\\]");
+    static const boost::regex text_url("(?:http|ftp|https)://[/0-9A-Za-z_!~*'.;?:@&=+$,%#-]+");
+
+    std::istringstream ifs(text);
+    std::string line;
+    std::vector<utf8_string> categories;
+    boost::smatch results;
+    while (getline(ifs, line))
+    {
+      if (regex_match(line, results, category_regex))
+      {
+        categories.resize(1);
+        categories[0] = results[1];
+        continue;
+      }
+      if (regex_match(line, results, outline_regex))
+      {
+        int level = results[1].length();
+        categories.resize(level + 1);
+        categories[level] = results[2];
+      }
+      std::string::const_iterator begin = line.begin(), end = line.end();
+      while (begin != end)
+      {
+        if (regex_search(begin, end, results, org_url))
+        {
+          begin = results[0].second;
+          cache.push_back(BookmarkSpec(results[1], results[2], categories));
+        } else if (regex_search(begin, end, results, text_url))
+        {
+          begin = results[0].second;
+          cache.push_back(BookmarkSpec(results[0], utf8_string(), categories));
+        } else break;
+      }
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  bench::Runner runner(argc, argv);
+
+  std::string path;
+  bool generated = false;
+  for (size_t i = 0; i < runner.args().size(); ++i)
+    if (runner.args()[i] == "--org" && i + 1 < runner.args().size())
+      path = runner.args()[++i];
+
+  std::string text;
+  if (path.empty())
+  {
+    text = generate(10000);
+    path = "/tmp/jmswm-org-parse-bench.org";
+    generated = true;
+    boost::filesystem::ofstream(path) << text;
+  } else
+  {
+    boost::filesystem::ifstream ifs(path);
+    std::ostringstream os;
+    os << ifs.rdbuf();
+    text = os.str();
+  }
+
+  std::vector<BookmarkSpec> result;
+  parse_org_bookmarks(text.data(), text.data() + text.size(), result);
+  std::printf("%zu bytes, %zu bookmarks\n", text.size(), result.size());
+
+  runner.run("regex", [&] {
+      std::vector<BookmarkSpec> r;
+      regex_parse(text, r);
+      bench::do_not_optimize(r.size());
+    });
+
+  runner.run("scanner", [&] {
+      std::vector<BookmarkSpec> r;
+      parse_org_bookmarks(text.data(), text.data() + text.size(), r);
+      bench::do_not_optimize(r.size());
+    });
+
+  runner.run("scanner_read_file", [&] {
+      std::vector<BookmarkSpec> r;
+      read_org_bookmarks(path, r);
+      bench::do_not_optimize(r.size());
+    });
+
+  if (generated)
+    boost::filesystem::remove(path);
+
+  return 0;
+}
@@ -0,0 +1,99 @@
+/* Benchmarks for util/spawn.hpp: launching /bin/true and waiting for
+ * it, with spawnl's clone(CLONE_VM | CLONE_VFORK), against the fork
+ * and close loop it replaces and against posix_spawn.  Each is timed
+ * with a small address space, then again after touching a heap the
+ * size of a window manager with its font caches and bookmark indexes
+ * loaded, which is what makes fork slow.  Launches per second are the
+ * reciprocal of the mean.
+ *
+ * Options: [--heap-mb N] (default 512) [--program PATH] */
+
+#include "bench.hpp"
+
+#include <util/spawn.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <spawn.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+extern char **environ;
+
+namespace
+{
+  const char *program = "/bin/true";
+
+  void wait_for(int pid)
+  {
+    if (pid > 0)
+      waitpid(pid, 0, 0);
+  }
+
+  // spawnl as it was: a full fork, then a close for every possible
+  // descriptor below 1024.
+  int fork_spawn()
+  {
+    int pid = fork();
+    if (pid == 0)
+    {
+      setsid();
+      close(STDIN_FILENO);
+      for (int i = 3; i < 1024; ++i)
+        close(i);
+      execl(program, program, (char *)0);
+      _exit(127);
+    }
+    return pid;
+  }
+
+  int posix_spawn_program()
+  {
+    char *const argv[] = { const_cast<char *>(program), 0 };
+    pid_t pid;
+    if (posix_spawn(&pid, program, 0, 0, argv, environ) != 0)
+      return -1;
+    return pid;
+  }
+
+  void run_all(bench::Runner &runner, const std::string &suffix)
+  {
+    runner.run("fork_close_loop" + suffix, [] { wait_for(fork_spawn()); });
+    runner.run("posix_spawn" + suffix, [] { wait_for(posix_spawn_program()); });
+    runner.run("spawnl" + suffix, [] { wait_for(spawnl(0, program, program, (char *)0)); });
+  }
+}
+
+int main(int argc, char **argv)
+{
+  bench::Runner runner(argc, argv);
+
+  size_t heap_mb = 512;
+  for (size_t i = 0; i < runner.args().size(); ++i)
+  {
+    const std::string &a = runner.args()[i];
+    if (a == "--heap-mb" && i + 1 < runner.args().size())
+      heap_mb = std::strtoul(runner.args()[++i].c_str(), 0, 10);
+    else if (a == "--program" && i + 1 < runner.args().size())
+      program = runner.args()[++i].c_str();
+    else
+    {
+      std::fprintf(stderr, "unknown option: %s\n", a.c_str());
+      return 1;
+    }
+  }
+
+  run_all(runner, "/small");
+
+  // Touched, so that every page is mapped and fork must copy its page
+  // table entries.
+  std::vector<char> heap(heap_mb << 20);
+  for (size_t i = 0; i < heap.size(); i += 4096)
+    heap[i] = char(i);
+  bench::do_not_optimize(heap.data());
+
+  run_all(runner, "/heap=" + std::to_string(heap_mb) + "MB");
+  return 0;
+}
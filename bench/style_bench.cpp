@@ -0,0 +1,140 @@
+/* Benchmarks for style/db.hpp: loading and compiling the shipped style
+ * configuration, then resolving every property of every spec in it,
+ * as the STYLE_DEFINITION constructors do at startup, by identifier
+ * and with the keys kept.  The number of properties is printed with
+ * the timings.
+ *
+ * Options: [--style FILE] */
+
+#include "bench.hpp"
+
+#include <style/db.hpp>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace
+{
+  enum Type { INT, STRING, SPEC };
+
+  struct Property
+  {
+    size_t spec;
+    ascii_string identifier;
+    style::Key key;
+    Type type;
+  };
+
+  /* Every spec reachable from the root, and every property of each
+     with its type. */
+  class Properties
+  {
+  public:
+    std::vector<style::Spec> specs;
+    std::vector<Property> properties;
+
+    explicit Properties(const style::DB &db)
+    {
+      add(db.root(), 0);
+    }
+
+  private:
+    void add(const style::Spec &spec, int depth)
+    {
+      size_t index = specs.size();
+      specs.push_back(spec);
+      std::vector<ascii_string> identifiers = spec.identifiers();
+      for (size_t i = 0; i < identifiers.size(); ++i)
+      {
+        Property p = { index, identifiers[i], style::Key(identifiers[i]), STRING };
+        try
+        {
+          spec.get<int>(p.key);
+          p.type = INT;
+        } catch (style::PropertyAccessError &)
+        {
+          try
+          {
+            style::Spec child = spec.get<style::Spec>(p.key);
+            p.type = SPEC;
+            // Specs may contain themselves through their parents.
+            if (depth < 8)
+              add(child, depth + 1);
+          } catch (style::PropertyAccessError &)
+          {
+          }
+        }
+        properties.push_back(p);
+      }
+    }
+  };
+
+  template <class Identifier>
+  size_t resolve_all(const Properties &all, Identifier identifier)
+  {
+    size_t sum = 0;
+    for (size_t i = 0; i < all.properties.size(); ++i)
+    {
+      const Property &p = all.properties[i];
+      const style::Spec &spec = all.specs[p.spec];
+      switch (p.type)
+      {
+      case INT:
+        sum += spec.get<int>(identifier(p));
+        break;
+      case STRING:
+        sum += spec.get<ascii_string>(identifier(p)).size();
+        break;
+      case SPEC:
+        spec.get<style::Spec>(identifier(p));
+        ++sum;
+        break;
+      }
+    }
+    return sum;
+  }
+
+  const ascii_string &by_identifier(const Property &p) { return p.identifier; }
+  const style::Key &by_key(const Property &p) { return p.key; }
+}
+
+int main(int argc, char **argv)
+{
+  bench::Runner runner(argc, argv);
+
+  std::string style_path = JMSWM_BENCH_STYLE;
+  for (size_t i = 0; i < runner.args().size(); ++i)
+  {
+    if (runner.args()[i] == "--style" && i + 1 < runner.args().size())
+      style_path = runner.args()[++i];
+  }
+
+  runner.run("load", [&] {
+      style::DB db;
+      db.load(style_path);
+      bench::do_not_optimize(db.root());
+    });
+
+  style::DB db;
+  try
+  {
+    db.load(style_path);
+  } catch (style::LoadError &e)
+  {
+    std::fprintf(stderr, "%s:%d: %s\n", e.filename().c_str(), e.line_number(),
+                 e.message().c_str());
+    return 1;
+  }
+
+  Properties all(db);
+  std::printf("%zu specs, %zu properties\n", all.specs.size(), all.properties.size());
+
+  runner.run("resolve_all/identifier", [&] {
+      bench::do_not_optimize(resolve_all(all, by_identifier));
+    });
+  runner.run("resolve_all/key", [&] {
+      bench::do_not_optimize(resolve_all(all, by_key));
+    });
+  return 0;
+}
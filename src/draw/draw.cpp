@@ -163,6 +163,7 @@ void WDrawable::reset(Drawable d)
   if (xft_draw_)
     XftDrawDestroy(xft_draw_);
   d_ = d;
+  xft_draw_ = 0;
   if (d)
     xft_draw_ =  XftDrawCreate(c.xcontext().display(),
                                d,
@@ -196,6 +197,85 @@ void WPixmap::reset(unsigned int width, unsigned int height)
     XFreePixmap(c.xcontext().display(), d);
 }
 
+void WPixmap::release()
+{
+  Drawable d = d_.drawable();
+  d_.reset(0);
+  if (d)
+    XFreePixmap(d_.draw_context().xcontext().display(), d);
+}
+
+WBackBuffer::WBackBuffer(WDrawContext &c)
+  : pixmap_(c), width_(0), height_(0), valid_(false), damage_(0)
+{}
+
+WBackBuffer::~WBackBuffer()
+{
+  if (damage_)
+    XDestroyRegion(damage_);
+}
+
+void WBackBuffer::release()
+{
+  if (width_ || height_)
+    pixmap_.release();
+  width_ = height_ = 0;
+  valid_ = false;
+  if (damage_)
+  {
+    XDestroyRegion(damage_);
+    damage_ = 0;
+  }
+}
+
+void WBackBuffer::copy_to(Drawable dest, const WRect &rect)
+{
+  WDrawContext &c = pixmap_.drawable().draw_context();
+  XCopyArea(c.xcontext().display(), pixmap_.drawable().drawable(), dest, c.gc(),
+            rect.x, rect.y, rect.width, rect.height, rect.x, rect.y);
+
+  if (damage_)
+  {
+    XRectangle r = { (short)rect.x, (short)rect.y,
+                     (unsigned short)rect.width, (unsigned short)rect.height };
+    Region copied = XCreateRegion();
+    XUnionRectWithRegion(&r, copied, copied);
+    XSubtractRegion(damage_, copied, damage_);
+    XDestroyRegion(copied);
+  }
+}
+
+void WBackBuffer::add_damage(const WRect &rect)
+{
+  if (!damage_)
+    damage_ = XCreateRegion();
+  XRectangle r = { (short)rect.x, (short)rect.y,
+                   (unsigned short)rect.width, (unsigned short)rect.height };
+  XUnionRectWithRegion(&r, damage_, damage_);
+}
+
+bool WBackBuffer::damaged() const
+{
+  return damage_ && !XEmptyRegion(damage_);
+}
+
+void WBackBuffer::repair(Drawable dest)
+{
+  if (!damaged())
+    return;
+
+  WDrawContext &c = pixmap_.drawable().draw_context();
+  XRectangle box;
+  XClipBox(damage_, &box);
+  XSetRegion(c.xcontext().display(), c.gc(), damage_);
+  XCopyArea(c.xcontext().display(), pixmap_.drawable().drawable(), dest, c.gc(),
+            box.x, box.y, box.width, box.height, box.x, box.y);
+  XSetClipMask(c.xcontext().display(), c.gc(), None);
+
+  XDestroyRegion(damage_);
+  damage_ = 0;
+}
+
 static void wcolor_to_xftcolor(const WColor &c, XftColor &xftc)
 {
   xftc.color.red = c.red();
@@ -231,6 +311,16 @@ void draw_label_with_text_background(WDrawable &d, const utf8_string &text,
                                      const WFont &font, const WColor &c,
                                      const WColor &background,
                                      const WRect &rect)
+{
+  draw_label_with_text_background(d, text, font, c, background, rect,
+                                  std::vector<std::pair<uint32_t, uint32_t> >());
+}
+
+void draw_label_with_text_background(WDrawable &d, const utf8_string &text,
+                                     const WFont &font, const WColor &c,
+                                     const WColor &background,
+                                     const WRect &rect,
+                                     const std::vector<std::pair<uint32_t, uint32_t> > &underlined)
 {
   PangoLayout *pl = pango_layout_new(d.draw_context().pango_context());
   pango_layout_set_text(pl, text.data(), text.length());
@@ -248,6 +338,14 @@ void draw_label_with_text_background(WDrawable &d, const utf8_string &text,
   attr1->end_index = text.size();
   pango_attr_list_insert(attr_list, attr1);
 
+  for (size_t i = 0; i < underlined.size(); ++i)
+  {
+    PangoAttribute *attr = pango_attr_underline_new(PANGO_UNDERLINE_SINGLE);
+    attr->start_index = underlined[i].first;
+    attr->end_index = underlined[i].second;
+    pango_attr_list_insert(attr_list, attr);
+  }
+
   pango_layout_set_attributes(pl, attr_list);
   
 
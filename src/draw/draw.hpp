@@ -2,12 +2,28 @@
 #define _DRAW_HPP
 
 #include <util/string.hpp>
-
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/* Defining JMSWM_DRAW_HEADLESS selects the Pango-Cairo backend in
+   draw_cairo.cpp, which renders into in-memory image surfaces rather
+   than X drawables.  It provides the same drawing interface but none
+   of the X connection classes, and exists for benchmarking and
+   checking rendering without a display. */
+
+#ifdef JMSWM_DRAW_HEADLESS
+#include <cairo.h>
+#else
 #include <X11/Xlib.h>
+#include <X11/Xutil.h>
 #include <X11/Xft/Xft.h>
 #include <X11/Xcms.h>
+#endif
 #include <pango/pango.h>
 
+#ifndef JMSWM_DRAW_HEADLESS
+
 class WXDisplay
 {
 private:
@@ -51,6 +67,26 @@ public:
 
 };
 
+#endif /* !JMSWM_DRAW_HEADLESS */
+
+#ifdef JMSWM_DRAW_HEADLESS
+
+class WDrawContext
+{
+private:
+  PangoContext *pango_context_;
+public:
+  WDrawContext();
+  ~WDrawContext();
+
+  PangoContext *pango_context()
+  {
+    return pango_context_;
+  }
+};
+
+#else
+
 class WDrawContext
 {
 private:
@@ -77,6 +113,8 @@ public:
   }
 };
 
+#endif /* JMSWM_DRAW_HEADLESS */
+
 class WColor
 {
 private:
@@ -203,6 +241,39 @@ inline bool operator!=(WRect const &a, WRect const &b)
 }
 
 
+#ifdef JMSWM_DRAW_HEADLESS
+
+class WDrawable
+{
+private:
+  WDrawContext &c;
+  cairo_surface_t *surface_;
+  cairo_t *cr_;
+public:
+  WDrawable(WDrawContext &c);
+  WDrawable(WDrawContext &c, cairo_surface_t *surface);
+  ~WDrawable();
+
+  void reset(cairo_surface_t *surface);
+
+  WDrawContext &draw_context() const
+  {
+    return c;
+  }
+
+  cairo_surface_t *surface() const
+  {
+    return surface_;
+  }
+
+  cairo_t *cairo() const
+  {
+    return cr_;
+  }
+};
+
+#else
+
 class WDrawable
 {
 private:
@@ -232,6 +303,8 @@ public:
   }
 };
 
+#endif /* JMSWM_DRAW_HEADLESS */
+
 class WPixmap
 {
 private:
@@ -242,12 +315,93 @@ public:
   ~WPixmap();
   void reset(unsigned int width, unsigned int height);
 
+  /* Frees the pixmap; reset must be called before drawing again. */
+  void release();
+
   WDrawable &drawable()
   {
     return d_;
   }
 };
 
+/**
+ * A pixmap retained across draws of a single window, so that the
+ * window contents can be restored by copying instead of re-rendering.
+ * The pixmap is only reallocated when the window size changes.
+ *
+ * Exposed areas of the window are accumulated as damage with
+ * add_damage and restored together by repair; any area copied to the
+ * window in the meantime is no longer considered damaged.
+ */
+class WBackBuffer
+{
+private:
+  WPixmap pixmap_;
+  int width_, height_;
+  bool valid_;
+#ifndef JMSWM_DRAW_HEADLESS
+  Region damage_;
+#endif
+public:
+  WBackBuffer(WDrawContext &c);
+  ~WBackBuffer();
+
+  /* Returns the drawable to render a width x height window into.  The
+     buffer is marked valid on the assumption that the caller renders
+     the whole area. */
+  WDrawable &prepare(int width, int height)
+  {
+    if (width != width_ || height != height_)
+    {
+      pixmap_.reset(width, height);
+      width_ = width;
+      height_ = height;
+    }
+    valid_ = true;
+    return pixmap_.drawable();
+  }
+
+  WDrawable &drawable()
+  {
+    return pixmap_.drawable();
+  }
+
+  /* True if the buffer holds the last rendering of a width x height
+     window. */
+  bool valid(int width, int height) const
+  {
+    return valid_ && width == width_ && height == height_;
+  }
+
+  void invalidate()
+  {
+    valid_ = false;
+  }
+
+  /* Frees the pixmap; the next prepare allocates a new one.  Pending
+     damage is discarded, since it can no longer be repaired. */
+  void release();
+
+  /* Approximate server memory used, assuming 32 bits per pixel. */
+  size_t size_in_bytes() const
+  {
+    return size_t(width_) * size_t(height_) * 4;
+  }
+
+#ifndef JMSWM_DRAW_HEADLESS
+  /* Copies rect, in window coordinates, to the same position in dest. */
+  void copy_to(Drawable dest, const WRect &rect);
+
+  void add_damage(const WRect &rect);
+
+  bool damaged() const;
+
+  /* Copies the damaged region to dest, clipped to that region, and
+     clears the damage.  The buffer must be valid. */
+  void repair(Drawable dest);
+#endif
+};
+
 int compute_label_width(WDrawable &d, const utf8_string &text, const WFont &font,
                         int available_width);
 
@@ -260,6 +414,14 @@ void draw_label_with_text_background(WDrawable &d, const utf8_string &text,
                                      const WColor &background,
                                      const WRect &rect);
 
+/* As above, with the [begin, end) byte ranges of text in `underlined'
+   drawn underlined, e.g. to show the characters matched by a completion. */
+void draw_label_with_text_background(WDrawable &d, const utf8_string &text,
+                                     const WFont &font, const WColor &c,
+                                     const WColor &background,
+                                     const WRect &rect,
+                                     const std::vector<std::pair<uint32_t, uint32_t> > &underlined);
+
 /**
  * Returns the width used.  Note that rect.width is the maximum width,
  * not the width to use.
@@ -0,0 +1,607 @@
+#include "draw.hpp"
+
+#include <util/log.hpp>
+
+#include <pango/pangocairo.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <clocale>
+
+/* Pango-Cairo rendering into image surfaces.  This mirrors draw.cpp
+   call for call so that the cost of laying out and rasterizing
+   decorations can be measured without an X server. */
+
+WDrawContext::WDrawContext()
+{
+  pango_context_ = pango_font_map_create_context(pango_cairo_font_map_get_default());
+}
+
+WDrawContext::~WDrawContext()
+{
+  g_object_unref(pango_context_);
+}
+
+namespace
+{
+  /* The subset of the X color database used by the shipped style
+     file.  Names are compared ignoring case and spaces, as X does. */
+  struct NamedColor
+  {
+    const char *name;
+    unsigned char red, green, blue;
+  };
+
+  const NamedColor named_colors[] = {
+    { "black", 0, 0, 0 },
+    { "white", 255, 255, 255 },
+    { "red", 255, 0, 0 },
+    { "green", 0, 255, 0 },
+    { "blue", 0, 0, 255 },
+    { "yellow", 255, 255, 0 },
+    { "cyan", 0, 255, 255 },
+    { "magenta", 255, 0, 255 },
+    { "gold", 255, 215, 0 },
+    { "gold1", 255, 215, 0 },
+    { "gold3", 205, 173, 0 },
+    { "orchid", 218, 112, 214 },
+    { "mediumorchid", 186, 85, 211 },
+    { "mediumorchid1", 224, 102, 255 },
+    { "steelblue", 70, 130, 180 },
+    { "lightsteelblue", 176, 196, 222 },
+    { "royalblue", 65, 105, 225 },
+    { "royalblue3", 58, 95, 205 },
+    { "royalblue4", 39, 64, 139 },
+  };
+
+  ascii_string normalize_color_name(const ascii_string &name)
+  {
+    ascii_string result;
+    for (char ch : name)
+      if (ch != ' ')
+        result += std::tolower((unsigned char)ch);
+    return result;
+  }
+
+  bool parse_hex(const ascii_string &str, size_t pos, size_t len,
+                 unsigned int &value)
+  {
+    if (len == 0 || len > 4 || pos + len > str.size())
+      return false;
+    value = 0;
+    for (size_t i = pos; i < pos + len; ++i)
+    {
+      if (!std::isxdigit((unsigned char)str[i]))
+        return false;
+      char ch = std::tolower((unsigned char)str[i]);
+      value = value * 16 + (ch <= '9' ? ch - '0' : ch - 'a' + 10);
+    }
+    return true;
+  }
+
+  /* Parses the same forms as XParseColor for the cases that matter:
+     "#RGB" style (each component left-aligned in 16 bits), "rgb:R/G/B"
+     (each component scaled to 16 bits), "greyN"/"grayN", and the
+     named colors above. */
+  bool parse_color(const ascii_string &spec, unsigned short rgb[3])
+  {
+    if (!spec.empty() && spec[0] == '#')
+    {
+      size_t digits = spec.size() - 1;
+      if (digits % 3 != 0 || digits == 0 || digits > 12)
+        return false;
+      size_t n = digits / 3;
+      for (int i = 0; i < 3; ++i)
+      {
+        unsigned int v;
+        if (!parse_hex(spec, 1 + i * n, n, v))
+          return false;
+        rgb[i] = v << (16 - 4 * n);
+      }
+      return true;
+    }
+
+    if (boost::algorithm::istarts_with(spec, "rgb:"))
+    {
+      size_t pos = 4;
+      for (int i = 0; i < 3; ++i)
+      {
+        size_t end = (i == 2) ? spec.size() : spec.find('/', pos);
+        if (end == ascii_string::npos)
+          return false;
+        unsigned int v;
+        if (!parse_hex(spec, pos, end - pos, v))
+          return false;
+        unsigned int max = (1u << (4 * (end - pos))) - 1;
+        rgb[i] = (unsigned short)((v * 0xFFFFu) / max);
+        pos = end + 1;
+      }
+      return true;
+    }
+
+    ascii_string name = normalize_color_name(spec);
+
+    if (boost::algorithm::starts_with(name, "grey")
+        || boost::algorithm::starts_with(name, "gray"))
+    {
+      if (name.size() > 4)
+      {
+        char *end;
+        long level = std::strtol(name.c_str() + 4, &end, 10);
+        if (*end != 0 || level < 0 || level > 100)
+          return false;
+        unsigned short v = (unsigned short)std::lround(level * 255 / 100.0) * 257;
+        rgb[0] = rgb[1] = rgb[2] = v;
+        return true;
+      }
+      rgb[0] = rgb[1] = rgb[2] = 190 * 257;
+      return true;
+    }
+
+    for (const NamedColor &c : named_colors)
+    {
+      if (name == c.name)
+      {
+        rgb[0] = c.red * 257;
+        rgb[1] = c.green * 257;
+        rgb[2] = c.blue * 257;
+        return true;
+      }
+    }
+    return false;
+  }
+}
+
+static unsigned long rgb_to_pixel(unsigned short red,
+                                  unsigned short green,
+                                  unsigned short blue)
+{
+  return ((unsigned long)(red >> 8) << 16)
+    | ((unsigned long)(green >> 8) << 8)
+    | (unsigned long)(blue >> 8);
+}
+
+WColor::WColor(WDrawContext &c, const ascii_string &name)
+  : c(c)
+{
+  unsigned short rgb[3];
+  if (!parse_color(name, rgb))
+    ERROR("Failed to allocate color: %s", name.c_str());
+  red_ = rgb[0];
+  green_ = rgb[1];
+  blue_ = rgb[2];
+  pixel_ = rgb_to_pixel(red_, green_, blue_);
+}
+
+WColor::WColor(WDrawContext &c,
+       unsigned short red,
+       unsigned short green,
+       unsigned short blue)
+  : c(c), red_(red), green_(green), blue_(blue)
+{
+  pixel_ = rgb_to_pixel(red_, green_, blue_);
+}
+
+WColor::~WColor()
+{
+}
+
+WFont::WFont(WDrawContext &c, const ascii_string &name)
+  : c(c)
+{
+  pango_font_description_ = pango_font_description_from_string(name.c_str());
+
+  ascii_string loc = setlocale(LC_CTYPE, NULL);
+  ascii_string::size_type p = loc.find_first_of(".@");
+  if (p != ascii_string::npos)
+    loc.resize(p);
+
+  PangoFontMetrics *m
+    = pango_context_get_metrics(c.pango_context(),
+                                pango_font_description_,
+                                pango_language_from_string(loc.c_str()));
+
+  ascent_ = PANGO_PIXELS(pango_font_metrics_get_ascent(m));
+  descent_ = PANGO_PIXELS(pango_font_metrics_get_descent(m));
+  approx_width_ = PANGO_PIXELS(pango_font_metrics_get_approximate_char_width(m));
+  pango_font_metrics_unref(m);
+}
+
+WFont::~WFont()
+{
+  pango_font_description_free(pango_font_description_);
+}
+
+WDrawable::WDrawable(WDrawContext &c)
+  : c(c), surface_(0), cr_(0)
+{}
+
+WDrawable::WDrawable(WDrawContext &c, cairo_surface_t *surface)
+  : c(c), surface_(0), cr_(0)
+{
+  reset(surface);
+}
+
+WDrawable::~WDrawable()
+{
+  reset(0);
+}
+
+void WDrawable::reset(cairo_surface_t *surface)
+{
+  if (cr_)
+    cairo_destroy(cr_);
+  if (surface_)
+    cairo_surface_destroy(surface_);
+  surface_ = surface;
+  cr_ = 0;
+  if (surface)
+  {
+    cairo_surface_reference(surface);
+    cr_ = cairo_create(surface);
+  }
+}
+
+static cairo_surface_t *create_image_surface(unsigned int width,
+                                             unsigned int height)
+{
+  cairo_surface_t *s = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+                                                  width, height);
+  if (cairo_surface_status(s) != CAIRO_STATUS_SUCCESS)
+    ERROR("Failed to create %ux%u image surface: %s", width, height,
+          cairo_status_to_string(cairo_surface_status(s)));
+  return s;
+}
+
+WPixmap::WPixmap(WDrawContext &c)
+  : d_(c)
+{
+}
+
+WPixmap::WPixmap(WDrawContext &c, unsigned int width, unsigned int height)
+  : d_(c)
+{
+  reset(width, height);
+}
+
+WPixmap::~WPixmap()
+{
+}
+
+void WPixmap::reset(unsigned int width, unsigned int height)
+{
+  cairo_surface_t *s = create_image_surface(width, height);
+  d_.reset(s);
+  cairo_surface_destroy(s);
+}
+
+void WPixmap::release()
+{
+  d_.reset(0);
+}
+
+WBackBuffer::WBackBuffer(WDrawContext &c)
+  : pixmap_(c), width_(0), height_(0), valid_(false)
+{}
+
+WBackBuffer::~WBackBuffer()
+{
+}
+
+void WBackBuffer::release()
+{
+  if (width_ || height_)
+    pixmap_.release();
+  width_ = height_ = 0;
+  valid_ = false;
+}
+
+static void set_source_color(cairo_t *cr, const WColor &c)
+{
+  cairo_set_source_rgb(cr, c.red() / 65535.0, c.green() / 65535.0,
+                       c.blue() / 65535.0);
+}
+
+static PangoLayout *create_label_layout(WDrawable &d, const utf8_string &text,
+                                        const WFont &font, int width)
+{
+  PangoLayout *pl = pango_layout_new(d.draw_context().pango_context());
+  pango_layout_set_text(pl, text.data(), text.length());
+  pango_layout_set_font_description(pl, font.pango_font_description());
+  pango_layout_set_width(pl, width * PANGO_SCALE);
+  pango_layout_set_single_paragraph_mode(pl, TRUE);
+  pango_layout_set_ellipsize(pl, PANGO_ELLIPSIZE_MIDDLE);
+  return pl;
+}
+
+/* Renders with the baseline at (x, y), as pango_xft_render_layout_line
+   does. */
+static void render_layout_line(WDrawable &d, const WColor &c,
+                               PangoLayoutLine *line, int x, int y)
+{
+  cairo_t *cr = d.cairo();
+  set_source_color(cr, c);
+  cairo_move_to(cr, x, y);
+  pango_cairo_show_layout_line(cr, line);
+}
+
+void draw_label(WDrawable &d, const utf8_string &text,
+                const WFont &font, const WColor &c,
+                const WRect &rect)
+{
+  PangoLayout *pl = create_label_layout(d, text, font, rect.width);
+
+  int y = (rect.y + (rect.height - font.height()) / 2 + font.ascent());
+  int x = rect.x;
+
+  render_layout_line(d, c, pango_layout_get_line(pl, 0), x, y);
+  g_object_unref(pl);
+}
+
+void draw_label_with_text_background(WDrawable &d, const utf8_string &text,
+                                     const WFont &font, const WColor &c,
+                                     const WColor &background,
+                                     const WRect &rect)
+{
+  draw_label_with_text_background(d, text, font, c, background, rect,
+                                  std::vector<std::pair<uint32_t, uint32_t> >());
+}
+
+void draw_label_with_text_background(WDrawable &d, const utf8_string &text,
+                                     const WFont &font, const WColor &c,
+                                     const WColor &background,
+                                     const WRect &rect,
+                                     const std::vector<std::pair<uint32_t, uint32_t> > &underlined)
+{
+  PangoLayout *pl = create_label_layout(d, text, font, rect.width);
+
+  PangoAttrList *attr_list = pango_attr_list_new();
+  PangoAttribute *attr1
+    = pango_attr_background_new(background.red(),
+                                background.green(),
+                                background.blue());
+  attr1->start_index = 0;
+  attr1->end_index = text.size();
+  pango_attr_list_insert(attr_list, attr1);
+
+  for (size_t i = 0; i < underlined.size(); ++i)
+  {
+    PangoAttribute *attr = pango_attr_underline_new(PANGO_UNDERLINE_SINGLE);
+    attr->start_index = underlined[i].first;
+    attr->end_index = underlined[i].second;
+    pango_attr_list_insert(attr_list, attr);
+  }
+
+  pango_layout_set_attributes(pl, attr_list);
+
+  int y = (rect.y + (rect.height - font.height()) / 2 + font.ascent());
+  int x = rect.x;
+
+  render_layout_line(d, c, pango_layout_get_line(pl, 0), x, y);
+  g_object_unref(pl);
+  pango_attr_list_unref(attr_list);
+}
+
+int compute_label_width(WDrawable &d,
+                        const utf8_string &text,
+                        const WFont &font,
+                        int available_width)
+{
+  PangoLayout *pl = create_label_layout(d, text, font, available_width);
+
+  PangoLayoutLine *line = pango_layout_get_line(pl, 0);
+
+  PangoRectangle ink_rect;
+  pango_layout_line_get_pixel_extents(line, &ink_rect, 0);
+
+  g_object_unref(pl);
+  return ink_rect.width;
+}
+
+int draw_label_with_background(WDrawable &d,
+                               const utf8_string &text,
+                               const WFont &font,
+                               const WColor &foreground,
+                               const WColor &background,
+                               const WRect &rect,
+                               int label_horizontal_padding,
+                               int label_vertical_padding,
+                               bool right_aligned)
+{
+  PangoLayout *pl = create_label_layout(d, text, font,
+                                        rect.width - 2 * label_horizontal_padding);
+
+  PangoLayoutLine *line = pango_layout_get_line(pl, 0);
+
+  PangoRectangle ink_rect;
+  pango_layout_line_get_pixel_extents(line, &ink_rect, 0);
+
+  int frame_width = ink_rect.width + 2 * label_horizontal_padding;
+
+  int base_x = rect.x;
+
+  if (right_aligned)
+    base_x += (rect.width - frame_width);
+
+  int y = (rect.y + label_vertical_padding
+           + (rect.height - 2 * label_vertical_padding - font.height()) / 2
+           + font.ascent());
+  int x = base_x + label_horizontal_padding;
+
+  fill_rect(d, background,
+            WRect(base_x, rect.y,
+                  frame_width,
+                  rect.height));
+
+  render_layout_line(d, foreground, line, x, y);
+  g_object_unref(pl);
+
+  return frame_width;
+}
+
+void draw_label_with_cursor_and_selection(WDrawable &d, const utf8_string &text,
+                                          const WFont &font, const WColor &c,
+                                          const WColor &cursor_foreground,
+                                          const WColor &cursor_background,
+                                          const WColor &selection_foreground,
+                                          const WColor &selection_background,
+                                          const WRect &rect,
+                                          int cursor_position,
+                                          int selection_position)
+{
+  PangoLayout *pl = create_label_layout(d, text, font, rect.width);
+
+  PangoAttrList *attr_list = pango_attr_list_new();
+  PangoAttribute *attr1
+    = pango_attr_background_new(cursor_background.red(),
+                                cursor_background.green(),
+                                cursor_background.blue());
+  attr1->start_index = cursor_position;
+  attr1->end_index = cursor_position + 1;
+  pango_attr_list_insert(attr_list, attr1);
+
+  PangoAttribute *attr2
+    = pango_attr_foreground_new(cursor_foreground.red(),
+                                cursor_foreground.green(),
+                                cursor_foreground.blue());
+  attr2->start_index = cursor_position;
+  attr2->end_index = cursor_position + 1;
+  pango_attr_list_insert(attr_list, attr2);
+
+  if (selection_position != -1 && selection_position != cursor_position)
+  {
+    int selection_start, selection_end;
+    if (selection_position < cursor_position)
+    {
+      selection_start = selection_position;
+      selection_end = cursor_position;
+    } else
+    {
+      selection_start = cursor_position + 1;
+      selection_end = selection_position;
+    }
+    PangoAttribute *attr3
+      = pango_attr_background_new(selection_background.red(),
+                                  selection_background.green(),
+                                  selection_background.blue());
+    attr3->start_index = selection_start;
+    attr3->end_index = selection_end;
+    pango_attr_list_insert(attr_list, attr3);
+
+    PangoAttribute *attr4
+      = pango_attr_foreground_new(selection_foreground.red(),
+                                  selection_foreground.green(),
+                                  selection_foreground.blue());
+    attr4->start_index = selection_start;
+    attr4->end_index = selection_end;
+    pango_attr_list_insert(attr_list, attr4);
+  }
+
+  pango_layout_set_attributes(pl, attr_list);
+
+  int y = (rect.y + (rect.height - font.height()) / 2 + font.ascent());
+  int x = rect.x;
+
+  render_layout_line(d, c, pango_layout_get_line(pl, 0), x, y);
+  g_object_unref(pl);
+  pango_attr_list_unref(attr_list);
+}
+
+void fill_rect(WDrawable &d, const WColor &background,
+               const WRect &rect)
+{
+  if (rect.width <= 0 || rect.height <= 0)
+    return;
+
+  cairo_t *cr = d.cairo();
+  set_source_color(cr, background);
+  cairo_rectangle(cr, rect.x, rect.y, rect.width, rect.height);
+  cairo_fill(cr);
+}
+
+void draw_horizontal_line(WDrawable &d, const WColor &c,
+                          int x, int y, int length)
+{
+  fill_rect(d, c, WRect(x, y, length, 1));
+}
+
+void draw_vertical_line(WDrawable &d, const WColor &c,
+                          int x, int y, int length)
+{
+  fill_rect(d, c, WRect(x, y, 1, length));
+}
+
+void draw_border(WDrawable &d,
+                 const WColor &highlight_color, int highlight_pixels,
+                 const WColor &shadow_color, int shadow_pixels,
+                 const WRect &rect)
+{
+  int a, b;
+
+  a = (shadow_pixels != 0);
+  b = 0;
+  for (int i = 0; i < highlight_pixels; ++i)
+  {
+    draw_horizontal_line(d, highlight_color, rect.x + i, rect.y + i,
+                         rect.width - a - i);
+    draw_vertical_line(d, highlight_color, rect.x + i, rect.y + i + 1,
+                       rect.height - b - 1 - i);
+
+    if (a < shadow_pixels)
+      ++a;
+
+    if (b < shadow_pixels)
+      ++b;
+  }
+
+  a = (highlight_pixels != 0);
+  b = 0;
+  for (int i = 0; i < shadow_pixels; ++i)
+  {
+    draw_horizontal_line(d, shadow_color,
+                         rect.x + a,
+                         rect.y + rect.height - 1 - i,
+                         rect.width - a - i);
+    draw_vertical_line(d, shadow_color,
+                       rect.x + rect.width - 1 - i,
+                       rect.y + b,
+                       rect.height - b - 1 - i);
+
+    if (a < highlight_pixels)
+      ++a;
+
+    if (b < highlight_pixels)
+      ++b;
+  }
+}
+
+void draw_border(WDrawable &d,
+                 const WColor &c, int width,
+                 const WRect &rect)
+{
+  fill_rect(d, c, WRect(rect.x, rect.y, width, rect.height));
+  fill_rect(d, c, WRect(rect.x + width, rect.y, rect.width - width, width));
+
+  fill_rect(d, c, WRect(rect.x + rect.width - width, rect.y + width, width,
+                        rect.height - width));
+  fill_rect(d, c, WRect(rect.x + width, rect.y + rect.height - width,
+                        rect.width - width, width));
+}
+
+void draw_border(WDrawable &d,
+                 const WColor &c,
+                 int left_width, int top_width,
+                 int right_width, int bottom_width,
+                 const WRect &rect)
+{
+  fill_rect(d, c, WRect(rect.x, rect.y, left_width, rect.height));
+  fill_rect(d, c, WRect(rect.x + left_width, rect.y, rect.width - right_width, top_width));
+
+  fill_rect(d, c, WRect(rect.x + rect.width - right_width, rect.y, right_width,
+                        rect.height));
+  fill_rect(d, c, WRect(rect.x + left_width, rect.y + rect.height - bottom_width,
+                        rect.width - right_width, bottom_width));
+}
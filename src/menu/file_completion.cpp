@@ -1,10 +1,14 @@
 #include <menu/list_completion.hpp>
 #include <menu/file_completion.hpp>
+#include <algorithm>
 #include <vector>
 #include <util/string.hpp>
 #include <util/path.hpp>
+#include <util/dir_scan.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <sys/unistd.h>
 
@@ -13,9 +17,21 @@ namespace menu
   namespace file_completion
   {
 
-    /**
-       for x in $(echo $LS_COLORS | tr ':' '\n' | grep -o '\.[^=]*' | tr -d '.'); do echo "(ext_$x, menu::list_completion::EntryStyle, style::Spec),"; done > test.txt
+    /* File name extensions with their own style, ext_<extension>.
+       Generated with:
+       for x in $(echo $LS_COLORS | tr ':' '\n' | grep -o '\.[^=]*' | tr -d '.'); do echo -n " X($x)"; done
     */
+#define FILE_COMPLETION_EXTENSIONS(X) \
+      X(cmd) X(exe) X(com) X(btm) X(bat) X(sh) X(csh) X(tar) X(tgz) X(arj) \
+      X(taz) X(lzh) X(zip) X(z) X(Z) X(gz) X(bz2) X(bz) X(tbz2) X(tz) \
+      X(deb) X(rpm) X(rar) X(ace) X(zoo) X(cpio) X(jpg) X(jpeg) X(gif) \
+      X(bmp) X(ppm) X(tga) X(xbm) X(xpm) X(tif) X(tiff) X(png) X(mng) \
+      X(xcf) X(pcx) X(mpg) X(mpeg) X(m2v) X(avi) X(mkv) X(ogm) X(mp4) \
+      X(m4v) X(mp4v) X(mov) X(qt) X(wmv) X(asf) X(rm) X(rmvb) X(flc) \
+      X(fli) X(gl) X(dl) X(mp3) X(wav) X(mid) X(midi) X(au) X(ogg)
+
+#define FILE_COMPLETION_EXTENSION_FIELD(ext) \
+    , (ext_##ext, menu::list_completion::EntryStyle, style::Spec)
 
     STYLE_DEFINITION(Style,
                      ((file, menu::list_completion::EntryStyle, style::Spec),
@@ -25,168 +41,152 @@ namespace menu
                       (sock, menu::list_completion::EntryStyle, style::Spec),
                       (blk, menu::list_completion::EntryStyle, style::Spec),
                       (chr, menu::list_completion::EntryStyle, style::Spec),
-                      (exec, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_cmd, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_exe, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_com, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_btm, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_bat, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_sh, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_csh, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_tar, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_tgz, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_arj, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_taz, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_lzh, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_zip, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_z, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_Z, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_gz, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_bz2, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_bz, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_tbz2, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_tz, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_deb, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_rpm, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_rar, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_ace, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_zoo, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_cpio, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_jpg, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_jpeg, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_gif, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_bmp, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_ppm, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_tga, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_xbm, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_xpm, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_tif, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_tiff, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_png, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_mng, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_xcf, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_pcx, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_mpg, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_mpeg, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_m2v, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_avi, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_mkv, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_ogm, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_mp4, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_m4v, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_mp4v, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_mov, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_qt, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_wmv, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_asf, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_rm, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_rmvb, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_flc, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_fli, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_gl, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_dl, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_mp3, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_wav, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_mid, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_midi, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_au, menu::list_completion::EntryStyle, style::Spec),
-                      (ext_ogg, menu::list_completion::EntryStyle, style::Spec)))
+                      (exec, menu::list_completion::EntryStyle, style::Spec)
+                      FILE_COMPLETION_EXTENSIONS(FILE_COMPLETION_EXTENSION_FIELD)))
 
-    EntryStyler::EntryStyler(WDrawContext &dc, const style::Spec &style_spec)
-    : style(new Style(dc, style_spec))
+    namespace
     {
-      /*
-for x in $(echo $LS_COLORS | tr ':' '\n' | grep -o '\.[^=]*' | tr -d '.'); do echo "ext_map.insert(ExtMap::value_type(\".$x\", &style->ext_$x));"; done > test.txt
-      */
-      ext_map.insert(ExtMap::value_type(".cmd", &style->ext_cmd));
-      ext_map.insert(ExtMap::value_type(".exe", &style->ext_exe));
-      ext_map.insert(ExtMap::value_type(".com", &style->ext_com));
-      ext_map.insert(ExtMap::value_type(".btm", &style->ext_btm));
-      ext_map.insert(ExtMap::value_type(".bat", &style->ext_bat));
-      ext_map.insert(ExtMap::value_type(".sh", &style->ext_sh));
-      ext_map.insert(ExtMap::value_type(".csh", &style->ext_csh));
-      ext_map.insert(ExtMap::value_type(".tar", &style->ext_tar));
-      ext_map.insert(ExtMap::value_type(".tgz", &style->ext_tgz));
-      ext_map.insert(ExtMap::value_type(".arj", &style->ext_arj));
-      ext_map.insert(ExtMap::value_type(".taz", &style->ext_taz));
-      ext_map.insert(ExtMap::value_type(".lzh", &style->ext_lzh));
-      ext_map.insert(ExtMap::value_type(".zip", &style->ext_zip));
-      ext_map.insert(ExtMap::value_type(".z", &style->ext_z));
-      ext_map.insert(ExtMap::value_type(".Z", &style->ext_Z));
-      ext_map.insert(ExtMap::value_type(".gz", &style->ext_gz));
-      ext_map.insert(ExtMap::value_type(".bz2", &style->ext_bz2));
-      ext_map.insert(ExtMap::value_type(".bz", &style->ext_bz));
-      ext_map.insert(ExtMap::value_type(".tbz2", &style->ext_tbz2));
-      ext_map.insert(ExtMap::value_type(".tz", &style->ext_tz));
-      ext_map.insert(ExtMap::value_type(".deb", &style->ext_deb));
-      ext_map.insert(ExtMap::value_type(".rpm", &style->ext_rpm));
-      ext_map.insert(ExtMap::value_type(".rar", &style->ext_rar));
-      ext_map.insert(ExtMap::value_type(".ace", &style->ext_ace));
-      ext_map.insert(ExtMap::value_type(".zoo", &style->ext_zoo));
-      ext_map.insert(ExtMap::value_type(".cpio", &style->ext_cpio));
-      ext_map.insert(ExtMap::value_type(".jpg", &style->ext_jpg));
-      ext_map.insert(ExtMap::value_type(".jpeg", &style->ext_jpeg));
-      ext_map.insert(ExtMap::value_type(".gif", &style->ext_gif));
-      ext_map.insert(ExtMap::value_type(".bmp", &style->ext_bmp));
-      ext_map.insert(ExtMap::value_type(".ppm", &style->ext_ppm));
-      ext_map.insert(ExtMap::value_type(".tga", &style->ext_tga));
-      ext_map.insert(ExtMap::value_type(".xbm", &style->ext_xbm));
-      ext_map.insert(ExtMap::value_type(".xpm", &style->ext_xpm));
-      ext_map.insert(ExtMap::value_type(".tif", &style->ext_tif));
-      ext_map.insert(ExtMap::value_type(".tiff", &style->ext_tiff));
-      ext_map.insert(ExtMap::value_type(".png", &style->ext_png));
-      ext_map.insert(ExtMap::value_type(".mng", &style->ext_mng));
-      ext_map.insert(ExtMap::value_type(".xcf", &style->ext_xcf));
-      ext_map.insert(ExtMap::value_type(".pcx", &style->ext_pcx));
-      ext_map.insert(ExtMap::value_type(".mpg", &style->ext_mpg));
-      ext_map.insert(ExtMap::value_type(".mpeg", &style->ext_mpeg));
-      ext_map.insert(ExtMap::value_type(".m2v", &style->ext_m2v));
-      ext_map.insert(ExtMap::value_type(".avi", &style->ext_avi));
-      ext_map.insert(ExtMap::value_type(".mkv", &style->ext_mkv));
-      ext_map.insert(ExtMap::value_type(".ogm", &style->ext_ogm));
-      ext_map.insert(ExtMap::value_type(".mp4", &style->ext_mp4));
-      ext_map.insert(ExtMap::value_type(".m4v", &style->ext_m4v));
-      ext_map.insert(ExtMap::value_type(".mp4v", &style->ext_mp4v));
-      ext_map.insert(ExtMap::value_type(".mov", &style->ext_mov));
-      ext_map.insert(ExtMap::value_type(".qt", &style->ext_qt));
-      ext_map.insert(ExtMap::value_type(".wmv", &style->ext_wmv));
-      ext_map.insert(ExtMap::value_type(".asf", &style->ext_asf));
-      ext_map.insert(ExtMap::value_type(".rm", &style->ext_rm));
-      ext_map.insert(ExtMap::value_type(".rmvb", &style->ext_rmvb));
-      ext_map.insert(ExtMap::value_type(".flc", &style->ext_flc));
-      ext_map.insert(ExtMap::value_type(".fli", &style->ext_fli));
-      ext_map.insert(ExtMap::value_type(".gl", &style->ext_gl));
-      ext_map.insert(ExtMap::value_type(".dl", &style->ext_dl));
-      ext_map.insert(ExtMap::value_type(".mp3", &style->ext_mp3));
-      ext_map.insert(ExtMap::value_type(".wav", &style->ext_wav));
-      ext_map.insert(ExtMap::value_type(".mid", &style->ext_mid));
-      ext_map.insert(ExtMap::value_type(".midi", &style->ext_midi));
-      ext_map.insert(ExtMap::value_type(".au", &style->ext_au));
-      ext_map.insert(ExtMap::value_type(".ogg", &style->ext_ogg));
+#define FILE_COMPLETION_EXTENSION_NAME(ext) #ext,
+#define FILE_COMPLETION_EXTENSION_MEMBER(ext) &Style::ext_##ext,
+
+      constexpr const char *extension_names[] = {
+        FILE_COMPLETION_EXTENSIONS(FILE_COMPLETION_EXTENSION_NAME)
+      };
+
+      const menu::list_completion::EntryStyle Style::*const extension_styles[] = {
+        FILE_COMPLETION_EXTENSIONS(FILE_COMPLETION_EXTENSION_MEMBER)
+      };
+
+#undef FILE_COMPLETION_EXTENSION_NAME
+#undef FILE_COMPLETION_EXTENSION_MEMBER
+
+      constexpr size_t num_extensions = sizeof(extension_names) / sizeof(extension_names[0]);
+
+      /* A perfect hash of the extensions into 512 slots, each holding
+         an extension's index + 1, or 0.  The compiler searches for a
+         seed under which no two extensions collide, so a lookup hashes
+         once and compares against at most one name. */
+      constexpr size_t extension_table_size = 512;
+
+      constexpr size_t constexpr_strlen(const char *s)
+      {
+        size_t n = 0;
+        while (s[n])
+          ++n;
+        return n;
+      }
+
+      constexpr size_t extension_slot(const char *s, size_t n, uint32_t seed)
+      {
+        // FNV-1a, with the seed mixed into the offset basis
+        uint32_t h = 2166136261u ^ seed;
+        for (size_t i = 0; i < n; ++i)
+          h = (h ^ (unsigned char)s[i]) * 16777619u;
+        return (h ^ (h >> 16)) & (extension_table_size - 1);
+      }
+
+      constexpr bool extension_seed_works(uint32_t seed)
+      {
+        bool used[extension_table_size] = {};
+        for (size_t i = 0; i < num_extensions; ++i)
+        {
+          size_t slot = extension_slot(extension_names[i],
+                                       constexpr_strlen(extension_names[i]), seed);
+          if (used[slot])
+            return false;
+          used[slot] = true;
+        }
+        return true;
+      }
+
+      constexpr uint32_t find_extension_seed()
+      {
+        uint32_t seed = 0;
+        while (!extension_seed_works(seed))
+          ++seed;
+        return seed;
+      }
+
+      constexpr uint32_t extension_seed = find_extension_seed();
+
+      struct ExtensionTable
+      {
+        uint8_t slots[extension_table_size];
+      };
+
+      constexpr ExtensionTable make_extension_table()
+      {
+        ExtensionTable table = {};
+        for (size_t i = 0; i < num_extensions; ++i)
+          table.slots[extension_slot(extension_names[i],
+                                     constexpr_strlen(extension_names[i]),
+                                     extension_seed)] = (uint8_t)(i + 1);
+        return table;
+      }
+
+      constexpr ExtensionTable extension_table = make_extension_table();
+
+      constexpr bool extension_table_complete()
+      {
+        for (size_t i = 0; i < num_extensions; ++i)
+          if (extension_table.slots[extension_slot(extension_names[i],
+                                                   constexpr_strlen(extension_names[i]),
+                                                   extension_seed)] != i + 1)
+            return false;
+        return true;
+      }
+
+      static_assert(num_extensions < 256, "extension indices must fit in a slot");
+      static_assert(extension_table_complete(), "extension hash is not perfect");
+
+      /* Index of the styled extension of a file name, or -1.  As with
+         boost::filesystem::extension, the extension follows the last
+         '.', even in a dot file's name. */
+      int find_extension(boost::string_ref name)
+      {
+        size_t dot = name.rfind('.');
+        if (dot == boost::string_ref::npos || name == "." || name == "..")
+          return -1;
+        boost::string_ref ext = name.substr(dot + 1);
+        uint8_t entry = extension_table.slots[extension_slot(ext.data(), ext.size(),
+                                                             extension_seed)];
+        if (entry == 0 || ext != extension_names[entry - 1])
+          return -1;
+        return entry - 1;
+      }
     }
 
+    EntryStyler::EntryStyler(WDrawContext &dc, const style::Spec &style_spec)
+    : style(new Style(dc, style_spec))
+    {}
+
     EntryStyler::~EntryStyler() {}
 
     const menu::list_completion::EntryStyle &
     EntryStyler::operator()(const boost::filesystem::path &path,
                             struct stat const &stat_info) const
     {
-      if (S_ISDIR(stat_info.st_mode))
+      return (*this)(path.filename().native(), stat_info.st_mode);
+    }
+
+    const menu::list_completion::EntryStyle &
+    EntryStyler::operator()(boost::string_ref name, mode_t mode) const
+    {
+      if (S_ISDIR(mode))
         return style->dir;
-      if ((stat_info.st_mode & S_IFMT) == S_IFLNK)
+      if ((mode & S_IFMT) == S_IFLNK)
         return style->link;
-      if (S_ISFIFO(stat_info.st_mode))
+      if (S_ISFIFO(mode))
         return style->fifo;
-      if (S_ISBLK(stat_info.st_mode))
+      if (S_ISBLK(mode))
         return style->blk;
-      if (S_ISCHR(stat_info.st_mode))
+      if (S_ISCHR(mode))
         return style->chr;
-      if (stat_info.st_mode & S_IXUSR)
+      if (mode & S_IXUSR)
         return style->exec;
-      std::string extension = boost::filesystem::extension(path);
-      ExtMap::const_iterator it = ext_map.find(extension);
-      if (it != ext_map.end())
-        return *it->second;
+      int ext = find_extension(name);
+      if (ext >= 0)
+        return (*style).*extension_styles[ext];
       return style->file;
     }
 
@@ -198,18 +198,300 @@ for x in $(echo $LS_COLORS | tr ':' '\n' | grep -o '\.[^=]*' | tr -d '.'); do ec
       state.cursor_position = state.text.size();
     }
 
+    static const uint32_t directory_watch_mask =
+      IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB
+      | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK;
+
+    DirectoryCache::DirectoryCache(EventService &event_service,
+                                   size_t max_directories,
+                                   size_t max_entries)
+      : cached_entries(0), next_version(0),
+        max_directories(max_directories), max_entries(max_entries),
+        inotify(event_service, boost::bind(&DirectoryCache::handle_inotify, this, _1, _2, _3, _4))
+    {}
+
+    DirectoryCache::~DirectoryCache() {}
+
+    static DirectoryCache::ListingPtr read_directory(const std::string &dir,
+                                                     const DirectoryCache::Progress &progress)
+    {
+      boost::shared_ptr<DirectoryCache::Listing> listing(new DirectoryCache::Listing);
+      DirScanner scan(dir.c_str());
+      while (scan.next())
+      {
+        listing->push_back(DirectoryCache::Entry(std::string(scan.name(), scan.name_length()),
+                                                 scan.type()));
+        if ((listing->size() & 1023) == 0 && progress && !progress(*listing))
+          return DirectoryCache::ListingPtr();
+      }
+      if (scan.error())
+        return DirectoryCache::ListingPtr();
+      return listing;
+    }
+
+    DirectoryCache::ListingPtr DirectoryCache::get(const std::string &dir,
+                                                   const Progress &progress)
+    {
+      bool watched = false;
+      uint64_t version = 0;
+      {
+        boost::mutex::scoped_lock l(mutex);
+        DirectoryMap::iterator it = directories.find(dir);
+        if (it != directories.end())
+        {
+          if (it->second.listing)
+          {
+            lru.splice(lru.begin(), lru, it->second.lru_position);
+            return it->second.listing;
+          }
+        } else
+        {
+          // Watch before reading, so that no change goes unnoticed.  A
+          // directory that cannot be watched is read, but not cached.
+          int wd = inotify.add_watch(dir.c_str(), directory_watch_mask, false);
+          if (wd >= 0)
+          {
+            lru.push_front(dir);
+            Directory d;
+            d.wd = wd;
+            d.version = next_version++;
+            d.lru_position = lru.begin();
+            it = directories.insert(DirectoryMap::value_type(dir, d)).first;
+            watches.insert(std::make_pair(wd, dir));
+            trim();
+          }
+        }
+        if (it != directories.end())
+        {
+          watched = true;
+          version = it->second.version;
+        }
+      }
+
+      ListingPtr listing = read_directory(dir, progress);
+      if (!listing || !watched || listing->size() > max_entries)
+        return listing;
+
+      boost::mutex::scoped_lock l(mutex);
+      DirectoryMap::iterator it = directories.find(dir);
+      if (it != directories.end() && it->second.version == version
+          && !it->second.listing)
+      {
+        it->second.listing = listing;
+        cached_entries += listing->size();
+        lru.splice(lru.begin(), lru, it->second.lru_position);
+        trim();
+      }
+      return listing;
+    }
+
+    bool DirectoryCache::resolve_modes(const std::string &dir,
+                                       const std::vector<const Entry *> &entries)
+    {
+      // Opened only if some entry needs it, and not for reading
+      boost::scoped_ptr<DirScanner> scan;
+      size_t count = 0;
+      for (size_t i = 0; i < entries.size(); ++i)
+      {
+        const Entry &e = *entries[i];
+        if (!e.needs_mode())
+          continue;
+        if ((++count & 1023) == 0 && completion_cancelled())
+          return false;
+        if (!scan)
+          scan.reset(new DirScanner(dir.c_str(), 0));
+        mode_t mode = scan->stat_mode(e.name.c_str());
+        // A vanished entry keeps the type it was listed with.
+        if (mode == 0)
+          mode = e.type ? e.type : S_IFREG;
+        e.mode_.store(mode, std::memory_order_release);
+      }
+      return true;
+    }
+
+    void DirectoryCache::clear()
+    {
+      boost::mutex::scoped_lock l(mutex);
+      while (!directories.empty())
+        evict(directories.begin());
+    }
+
+    void DirectoryCache::invalidate(Directory &d)
+    {
+      if (d.listing)
+      {
+        cached_entries -= d.listing->size();
+        d.listing.reset();
+      }
+      d.version = next_version++;
+    }
+
+    void DirectoryCache::evict(DirectoryMap::iterator it, bool watch_removed)
+    {
+      Directory &d = it->second;
+      if (d.listing)
+        cached_entries -= d.listing->size();
+      lru.erase(d.lru_position);
+
+      typedef std::multimap<int, std::string>::iterator WatchIterator;
+      std::pair<WatchIterator, WatchIterator> range = watches.equal_range(d.wd);
+      for (WatchIterator w = range.first; w != range.second; ++w)
+      {
+        if (w->second == it->first)
+        {
+          watches.erase(w);
+          break;
+        }
+      }
+      if (!watch_removed && watches.count(d.wd) == 0)
+        inotify.rm_watch(d.wd);
+
+      directories.erase(it);
+    }
+
+    void DirectoryCache::trim()
+    {
+      while (!lru.empty()
+             && (directories.size() > max_directories || cached_entries > max_entries))
+        evict(directories.find(lru.back()));
+    }
+
+    void DirectoryCache::handle_inotify(int wd, uint32_t mask, uint32_t cookie,
+                                        const char *name)
+    {
+      boost::mutex::scoped_lock l(mutex);
+
+      if (mask & IN_Q_OVERFLOW)
+      {
+        for (DirectoryMap::iterator it = directories.begin(); it != directories.end(); ++it)
+          invalidate(it->second);
+        return;
+      }
+
+      std::vector<DirectoryMap::iterator> affected;
+      typedef std::multimap<int, std::string>::iterator WatchIterator;
+      std::pair<WatchIterator, WatchIterator> range = watches.equal_range(wd);
+      for (WatchIterator w = range.first; w != range.second; ++w)
+        affected.push_back(directories.find(w->second));
+
+      // The kernel removes the watch itself when the directory is
+      // deleted or unmounted; a moved directory is no longer at its path.
+      const bool watch_removed = mask & (IN_IGNORED | IN_DELETE_SELF | IN_UNMOUNT);
+      for (size_t i = 0; i < affected.size(); ++i)
+      {
+        if (watch_removed || (mask & IN_MOVE_SELF))
+          evict(affected[i], watch_removed);
+        else
+          invalidate(affected[i]->second);
+      }
+    }
+
+    static void find_matching_entries(const DirectoryCache::Listing &listing,
+                                      const std::string &prefix,
+                                      std::vector<const DirectoryCache::Entry *> &matches)
+    {
+      using boost::algorithm::starts_with;
+
+      for (DirectoryCache::Listing::const_iterator it = listing.begin();
+           it != listing.end(); ++it)
+      {
+        if (starts_with(it->name, ".") && !starts_with(prefix, "."))
+          continue;
+        if (starts_with(it->name, prefix))
+          matches.push_back(&*it);
+      }
+      // Partial results are sorted the same way, so that entries keep
+      // their relative order as more of the directory is read.
+      std::sort(matches.begin(), matches.end(),
+                [](const DirectoryCache::Entry *a, const DirectoryCache::Entry *b)
+                { return a->name < b->name; });
+    }
+
+    static std::string join_path(const std::string &dir, const std::string &name)
+    {
+      if (!dir.empty() && dir[dir.size() - 1] == '/')
+        return dir + name;
+      return dir + '/' + name;
+    }
+
+    static void rank_matches(const std::string &dir, const Frecency::RankingPtr &ranking,
+                             std::vector<const DirectoryCache::Entry *> &matches)
+    {
+      if (!ranking || ranking->empty())
+        return;
+      std::vector<std::pair<int, const DirectoryCache::Entry *> > ranked;
+      ranked.reserve(matches.size());
+      bool any = false;
+      for (size_t i = 0; i < matches.size(); ++i)
+      {
+        int bonus = ranking->bonus(join_path(dir, matches[i]->name));
+        any = any || bonus;
+        ranked.push_back(std::make_pair(bonus, matches[i]));
+      }
+      if (!any)
+        return;
+      std::stable_sort(ranked.begin(), ranked.end(),
+                       [](const std::pair<int, const DirectoryCache::Entry *> &a,
+                          const std::pair<int, const DirectoryCache::Entry *> &b)
+                       { return a.first > b.first; });
+      for (size_t i = 0; i < ranked.size(); ++i)
+        matches[i] = ranked[i].second;
+    }
+
+    static void list_entries(const std::vector<const DirectoryCache::Entry *> &matches,
+                             const EntryStyler &styler,
+                             std::vector<menu::list_completion::Entry> &list)
+    {
+      for (size_t i = 0; i < matches.size(); ++i)
+      {
+        const DirectoryCache::Entry &e = *matches[i];
+        mode_t mode = e.mode();
+        const menu::list_completion::EntryStyle &style = styler(e.name, mode);
+        utf8_string name = e.name;
+        if (S_ISDIR(mode))
+          name += '/';
+        list.push_back(menu::list_completion::Entry(name, &style));
+      }
+    }
+
+    static bool file_completion_progress(const DirectoryCache::Listing &partial,
+                                         const InputState &state,
+                                         const std::string &dir,
+                                         const std::string &base,
+                                         const std::string &prefix,
+                                         const EntryStyler &styler,
+                                         const Frecency::RankingPtr &ranking,
+                                         Menu::PartialResultSink &sink)
+    {
+      if (completion_cancelled())
+        return false;
+      // Large directories, or slow file systems
+      // Regular files are shown without the exec style until the
+      // final result.
+      if (sink.ready())
+      {
+        std::vector<const DirectoryCache::Entry *> matches;
+        find_matching_entries(partial, prefix, matches);
+        rank_matches(dir, ranking, matches);
+        std::vector<menu::list_completion::Entry> list;
+        list_entries(matches, styler, list);
+        sink.post(completion_list(state, list, boost::bind(&apply_path_completion,
+                                                           base, _1, _2)));
+      }
+      return true;
+    }
+
     static Menu::CompletionsPtr file_completions(const boost::filesystem::path &default_dir,
                                                  const InputState &state,
-                                                 const EntryStyler &styler)
+                                                 Menu::PartialResultSink &sink,
+                                                 const EntryStyler &styler,
+                                                 DirectoryCache &cache,
+                                                 const Frecency::RankingPtr &ranking)
     {
       // No completions for the special input of ~
       if (state.text == "~")
         return Menu::CompletionsPtr();
 
-      using boost::filesystem::path;
-      using boost::filesystem::directory_iterator;
-      using boost::algorithm::starts_with;
-
       std::string prefix;
       std::string base;
       {
@@ -226,39 +508,58 @@ for x in $(echo $LS_COLORS | tr ':' '\n' | grep -o '\.[^=]*' | tr -d '.'); do ec
         }
       }
 
-      std::vector<menu::list_completion::Entry> list;
-      try
+      std::string dir = interpret_path(default_dir, expand_path_home(base)).string();
+      DirectoryCache::ListingPtr listing
+        = cache.get(dir, boost::bind(&file_completion_progress, _1, boost::cref(state),
+                                     boost::cref(dir), boost::cref(base), boost::cref(prefix),
+                                     boost::cref(styler), boost::cref(ranking),
+                                     boost::ref(sink)));
+      if (!listing && completion_cancelled())
+        return Menu::CompletionsPtr();
+
+      std::vector<const DirectoryCache::Entry *> matches;
+      if (listing)
       {
-        for (directory_iterator it(interpret_path(default_dir, expand_path_home(base))), end;
-             it != end; ++it)
-        {
-          const boost::filesystem::path &p = it->path();
-          std::string leaf = p.leaf().native();
-          if (starts_with(leaf, ".") && !starts_with(prefix, "."))
-            continue;
-          if (starts_with(leaf, prefix))
-          {
-            struct stat stat_info;
-            if (lstat(p.string().c_str(), &stat_info) == 0)
-            {
-              const menu::list_completion::EntryStyle &style = styler(*it, stat_info);
-              utf8_string name = leaf;
-              if (S_ISDIR(stat_info.st_mode))
-                name += '/';
-              list.push_back(menu::list_completion::Entry(name, &style));
-            }
-          }
-        }
-      } catch (boost::filesystem::filesystem_error &e)
-      {}
+        find_matching_entries(*listing, prefix, matches);
+        if (!DirectoryCache::resolve_modes(dir, matches))
+          return Menu::CompletionsPtr();
+        rank_matches(dir, ranking, matches);
+      }
+      std::vector<menu::list_completion::Entry> list;
+      list_entries(matches, styler, list);
       return completion_list(state, list, boost::bind(&apply_path_completion,
                                                       base, _1, _2));
     }
 
-    Menu::Completer file_completer(const boost::filesystem::path &default_dir,
-                                   const EntryStyler &styler)
+    Menu::StreamingCompleter file_completer(const boost::filesystem::path &default_dir,
+                                            const EntryStyler &styler,
+                                            DirectoryCache &cache,
+                                            const Frecency::RankingPtr &ranking)
+    {
+      return boost::bind(&file_completions, default_dir, _1, _2,
+                         boost::cref(styler), boost::ref(cache), ranking);
+    }
+
+    static void record_file_and_call(Frecency &frecency, const utf8_string &context,
+                                     const boost::filesystem::path &default_dir,
+                                     const Menu::SuccessAction &action,
+                                     const utf8_string &text, Menu::success_command_t command)
+    {
+      std::string path = text;
+      // A directory is ranked without its trailing slash.
+      while (path.size() > 1 && path[path.size() - 1] == '/')
+        path.erase(path.size() - 1);
+      if (!path.empty())
+        frecency.record(context, interpret_path(default_dir, expand_path_home(path)).string());
+      action(text, command);
+    }
+
+    Menu::SuccessAction file_recorder(Frecency &frecency, const utf8_string &context,
+                                      const boost::filesystem::path &default_dir,
+                                      const Menu::SuccessAction &action)
     {
-      return boost::bind(&file_completions, default_dir, _1, boost::cref(styler));
+      return boost::bind(&record_file_and_call, boost::ref(frecency), context,
+                         default_dir, action, _1, _2);
     }
 
   } // namespace file_completion
@@ -4,8 +4,16 @@
 #include <menu/menu.hpp>
 #include <boost/filesystem/path.hpp>
 #include <menu/list_completion.hpp>
+#include <util/event.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <atomic>
+#include <list>
 #include <map>
+#include <vector>
 
 namespace menu
 {
@@ -17,16 +25,128 @@ namespace menu
     class EntryStyler
     {
       std::unique_ptr<Style> style;
-      typedef std::map<std::string, const menu::list_completion::EntryStyle *> ExtMap;
-      ExtMap ext_map;
     public:
       EntryStyler(WDrawContext &dc, const style::Spec &style_spec);
       ~EntryStyler();
       const menu::list_completion::EntryStyle &operator()(const boost::filesystem::path &path,
                                                           struct stat const &stat_info) const;
+      /* name is a file name without directory; does not allocate. */
+      const menu::list_completion::EntryStyle &operator()(boost::string_ref name,
+                                                          mode_t mode) const;
     };
 
-    Menu::Completer file_completer(const boost::filesystem::path &default_dir, const EntryStyler &styler);
+    /* Listings of recently completed directories, shared by all file
+       completers and safe to use from the completion thread.  Each
+       cached directory is watched with inotify, and its listing is
+       dropped as soon as an entry is created, removed, renamed or has
+       its attributes changed, so a cached listing is never stale; an
+       inotify queue overflow drops every listing.  The least recently
+       used directories are evicted beyond max_directories, or beyond
+       max_entries entries in total. */
+    class DirectoryCache
+    {
+    public:
+      class Entry
+      {
+        friend class DirectoryCache;
+        mutable std::atomic<mode_t> mode_;
+      public:
+        std::string name;
+        // File type reported by the directory, or 0 if unknown
+        mode_t type;
+
+        Entry(const std::string &name, mode_t type)
+          : mode_(0), name(name), type(type)
+        {}
+        Entry(const Entry &e)
+          : mode_(e.mode_.load(std::memory_order_relaxed)), name(e.name), type(e.type)
+        {}
+        Entry(Entry &&e) noexcept
+          : mode_(e.mode_.load(std::memory_order_relaxed)), name(std::move(e.name)), type(e.type)
+        {}
+
+        /* Type and permissions if they have been resolved, and
+           otherwise just the type. */
+        mode_t mode() const
+        {
+          mode_t m = mode_.load(std::memory_order_acquire);
+          return m ? m : type;
+        }
+
+        /* True if the permissions matter but are not yet known: only
+           regular files are styled by their permissions. */
+        bool needs_mode() const
+        {
+          return mode_.load(std::memory_order_acquire) == 0
+            && (type == 0 || type == S_IFREG);
+        }
+      };
+      typedef std::vector<Entry> Listing;
+      typedef boost::shared_ptr<const Listing> ListingPtr;
+
+      /* Called every 1024 entries while a directory is being read, with
+         the entries read so far.  Returning false abandons the read. */
+      typedef boost::function<bool (const Listing &partial)> Progress;
+
+      DirectoryCache(EventService &event_service,
+                     size_t max_directories = 64,
+                     size_t max_entries = 250000);
+      ~DirectoryCache();
+
+      /* Returns the listing of dir, reading it unless it is cached.
+         Returns null if dir cannot be read or the read was abandoned. */
+      ListingPtr get(const std::string &dir, const Progress &progress = Progress());
+
+      /* Listings give only the file type of each entry.  Stats the
+         entries of dir that need_mode(), and keeps their modes with
+         the listing.  Returns false if cancelled. */
+      static bool resolve_modes(const std::string &dir,
+                                const std::vector<const Entry *> &entries);
+
+      void clear();
+
+    private:
+      struct Directory
+      {
+        int wd;
+        ListingPtr listing;
+        // Renewed on every invalidation, so that a read racing with a
+        // change is not cached.
+        uint64_t version;
+        std::list<std::string>::iterator lru_position;
+      };
+      typedef std::map<std::string, Directory> DirectoryMap;
+
+      boost::mutex mutex;
+      DirectoryMap directories;
+      // A directory reached by several paths has a single watch.
+      std::multimap<int, std::string> watches;
+      // Most recently used first
+      std::list<std::string> lru;
+      size_t cached_entries;
+      uint64_t next_version;
+      const size_t max_directories, max_entries;
+      InotifyEvent inotify;
+
+      void handle_inotify(int wd, uint32_t mask, uint32_t cookie, const char *name);
+      void invalidate(Directory &d);
+      void evict(DirectoryMap::iterator it, bool watch_removed = false);
+      void trim();
+    };
+
+    /* Completes paths relative to default_dir.  With a ranking, the
+       entries of a directory are ordered by the bonus of their
+       absolute paths, stably. */
+    Menu::StreamingCompleter file_completer(const boost::filesystem::path &default_dir,
+                                            const EntryStyler &styler,
+                                            DirectoryCache &cache,
+                                            const Frecency::RankingPtr &ranking = Frecency::RankingPtr());
+
+    /* An action that records the absolute path of the text, as ranked
+       by file_completer, in context, then calls action. */
+    Menu::SuccessAction file_recorder(Frecency &frecency, const utf8_string &context,
+                                      const boost::filesystem::path &default_dir,
+                                      const Menu::SuccessAction &action);
 
   } // namespace menu::file_completion
 } // namespace menu
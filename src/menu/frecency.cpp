@@ -0,0 +1,274 @@
+
+#include <menu/frecency.hpp>
+#include <util/log.hpp>
+#include <boost/bind.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/foreach.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace menu
+{
+  namespace
+  {
+    // Items with fewer weighted uses are dropped when compacting.
+    const double min_weight = 1.0 / 4096;
+    // The most items kept per context when compacting
+    const size_t max_items = 2000;
+
+    double current_time()
+    {
+      struct timeval tv;
+      gettimeofday(&tv, 0);
+      return tv.tv_sec + tv.tv_usec * 1e-6;
+    }
+
+    void escape(std::string &out, const utf8_string &s)
+    {
+      BOOST_FOREACH (char c, s)
+      {
+        if (c == '\\')
+          out += "\\\\";
+        else if (c == '\t')
+          out += "\\t";
+        else if (c == '\n')
+          out += "\\n";
+        else
+          out += c;
+      }
+    }
+
+    utf8_string unescape(const char *begin, const char *end)
+    {
+      utf8_string s;
+      for (const char *p = begin; p != end; ++p)
+      {
+        if (*p == '\\' && p + 1 != end)
+        {
+          ++p;
+          s += (*p == 't' ? '\t' : *p == 'n' ? '\n' : *p);
+        } else
+          s += *p;
+      }
+      return s;
+    }
+
+    std::string format_line(double time, const utf8_string &context, const utf8_string &item)
+    {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "%.3f\t", time);
+      std::string line(buf);
+      escape(line, context);
+      line += '\t';
+      escape(line, item);
+      line += '\n';
+      return line;
+    }
+
+    bool write_all(int fd, const std::string &data)
+    {
+      const char *p = data.data();
+      size_t remaining = data.size();
+      while (remaining)
+      {
+        ssize_t n = write(fd, p, remaining);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n < 0)
+          return false;
+        p += n;
+        remaining -= n;
+      }
+      return true;
+    }
+  }
+
+  const int Frecency::Ranking::max_bonus;
+
+  int Frecency::Ranking::bonus(const utf8_string &item) const
+  {
+    Entries::const_iterator it = entries->find(item);
+    if (it == entries->end())
+      return 0;
+    double weight = std::exp2((it->second - now) / half_life);
+    return std::min(max_bonus, int(std::lround(16 * std::log2(1 + weight))));
+  }
+
+  Frecency::Frecency(const boost::filesystem::path &path, double half_life)
+    : path(path), half_life(half_life), item_count(0), redundant_lines(0)
+  {
+    load();
+  }
+
+  void Frecency::add(const utf8_string &context, const utf8_string &item, double time)
+  {
+    boost::shared_ptr<Entries> &entries = contexts[context];
+    if (!entries)
+      entries.reset(new Entries);
+    else if (!entries.unique())
+      entries.reset(new Entries(*entries));
+
+    std::pair<Entries::iterator, bool> r = entries->insert(std::make_pair(item, time));
+    if (r.second)
+    {
+      ++item_count;
+      return;
+    }
+    // Summed in the log domain, which keeps the effective time exact
+    // however many uses there are.
+    double &t = r.first->second;
+    double hi = std::max(t, time), lo = std::min(t, time);
+    t = hi + half_life * std::log2(1 + std::exp2((lo - hi) / half_life));
+    ++redundant_lines;
+  }
+
+  void Frecency::load()
+  {
+    FILE *f = fopen(path.c_str(), "re");
+    if (!f)
+    {
+      if (errno != ENOENT)
+        WARN_SYS("failed to open frecency log: %s", path.c_str());
+      return;
+    }
+    char *line = 0;
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &capacity, f)) > 0)
+    {
+      const char *begin = line, *end = line + length;
+      if (end[-1] == '\n')
+        --end;
+      const char *tab1 = std::find(begin, end, '\t');
+      const char *tab2 = std::find(tab1 == end ? end : tab1 + 1, end, '\t');
+      char *time_end;
+      double time = strtod(line, &time_end);
+      if (tab2 == end || time_end != tab1 || !std::isfinite(time))
+      {
+        // A line cut short by a crash while appending
+        ++redundant_lines;
+        continue;
+      }
+      add(unescape(tab1 + 1, tab2), unescape(tab2 + 1, end), time);
+    }
+    free(line);
+    fclose(f);
+  }
+
+  void Frecency::compact()
+  {
+    const double cutoff = current_time() + half_life * std::log2(min_weight);
+    std::string data;
+    item_count = 0;
+    for (ContextMap::iterator c = contexts.begin(); c != contexts.end(); ++c)
+    {
+      std::vector<std::pair<double, Entries::const_iterator> > items;
+      for (Entries::const_iterator it = c->second->begin(); it != c->second->end(); ++it)
+        if (it->second >= cutoff)
+          items.push_back(std::make_pair(it->second, it));
+      if (items.size() > max_items)
+      {
+        std::nth_element(items.begin(), items.begin() + max_items, items.end(),
+                         [](const std::pair<double, Entries::const_iterator> &a,
+                            const std::pair<double, Entries::const_iterator> &b)
+                         { return a.first > b.first; });
+        items.resize(max_items);
+      }
+
+      boost::shared_ptr<Entries> kept(new Entries);
+      for (size_t i = 0; i < items.size(); ++i)
+      {
+        kept->insert(*items[i].second);
+        data += format_line(items[i].first, c->first, items[i].second->first);
+      }
+      c->second = kept;
+      item_count += kept->size();
+    }
+    redundant_lines = 0;
+
+    // Written beside the log and renamed over it, so that a crash
+    // loses at most the uses appended since.
+    const std::string temp = path.string() + ".tmp." + std::to_string(getpid());
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+      WARN_SYS("failed to create frecency log: %s", temp.c_str());
+      return;
+    }
+    if (!write_all(fd, data) || fsync(fd) != 0)
+    {
+      WARN_SYS("failed to write frecency log: %s", temp.c_str());
+      close(fd);
+      unlink(temp.c_str());
+      return;
+    }
+    close(fd);
+    if (rename(temp.c_str(), path.c_str()) != 0)
+    {
+      WARN_SYS("failed to replace frecency log: %s", path.c_str());
+      unlink(temp.c_str());
+    }
+  }
+
+  Frecency::RankingPtr Frecency::ranking(const utf8_string &context) const
+  {
+    boost::shared_ptr<const Entries> entries;
+    ContextMap::const_iterator it = contexts.find(context);
+    if (it != contexts.end())
+      entries = it->second;
+    else
+      entries.reset(new Entries);
+    return RankingPtr(new Ranking(entries, current_time(), half_life));
+  }
+
+  void Frecency::record(const utf8_string &context, const utf8_string &item)
+  {
+    if (item.empty())
+      return;
+    const double time = current_time();
+    add(context, item, time);
+
+    try
+    {
+      boost::filesystem::create_directories(path.parent_path());
+    } catch (boost::filesystem::filesystem_error &e)
+    {
+      WARN("failed to create directory for frecency log: %s", e.what());
+      return;
+    }
+
+    if (redundant_lines > std::max<size_t>(256, item_count))
+    {
+      compact();
+      return;
+    }
+
+    // A single write of a line with O_APPEND is not interleaved with
+    // another process's.
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0 || !write_all(fd, format_line(time, context, item)))
+      WARN_SYS("failed to append to frecency log: %s", path.c_str());
+    if (fd >= 0)
+      close(fd);
+  }
+
+  static void record_and_call(Frecency &frecency, const utf8_string &context,
+                              const Menu::SuccessAction &action,
+                              const utf8_string &text, Menu::success_command_t command)
+  {
+    frecency.record(context, text);
+    action(text, command);
+  }
+
+  Menu::SuccessAction Frecency::recorder(const utf8_string &context,
+                                         const Menu::SuccessAction &action)
+  {
+    return boost::bind(&record_and_call, boost::ref(*this), context, action, _1, _2);
+  }
+
+} // namespace menu
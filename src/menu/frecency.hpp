@@ -0,0 +1,82 @@
+#ifndef _MENU_FRECENCY_HPP
+#define _MENU_FRECENCY_HPP
+
+#include <menu/menu.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <map>
+
+namespace menu
+{
+  /**
+   * Remembers the items accepted in each kind of menu (the context),
+   * ranked by how often and how recently they were chosen.
+   *
+   * Each use counts for 2^(-age / half_life), so the uses of an item
+   * sum to 2^((t - now) / half_life) for a single effective time t,
+   * which is all that is kept: recording a use at time u sets t to
+   * half_life * log2(2^(t / half_life) + 2^(u / half_life)).
+   *
+   * Uses are appended to a log file as they are recorded, one line
+   * "time\tcontext\titem" each.  A line of the compacted log has the
+   * same form, with the effective time, so a use and a compacted item
+   * are read alike.  The log is rewritten once enough has been
+   * appended.
+   */
+  class Frecency
+  {
+  public:
+    typedef boost::unordered_map<utf8_string, double> Entries;
+
+    /* An immutable view of one context as of when it was taken. */
+    class Ranking
+    {
+      boost::shared_ptr<const Entries> entries;
+      double now, half_life;
+    public:
+      Ranking(const boost::shared_ptr<const Entries> &entries, double now, double half_life)
+        : entries(entries), now(now), half_life(half_life)
+      {}
+
+      bool empty() const { return entries->empty(); }
+
+      /* Up to max_bonus: 16 for an item chosen once just now, 16 more
+         for each doubling of the weighted use count.  Comparable to
+         the 16 per character of a fuzzy match. */
+      int bonus(const utf8_string &item) const;
+      static const int max_bonus = 64;
+    };
+    typedef boost::shared_ptr<const Ranking> RankingPtr;
+
+  private:
+    boost::filesystem::path path;
+    double half_life;
+    // Copied on write once a Ranking shares them
+    typedef std::map<utf8_string, boost::shared_ptr<Entries> > ContextMap;
+    ContextMap contexts;
+    size_t item_count;
+    // Lines in the log beyond one per item
+    size_t redundant_lines;
+
+    void load();
+    void compact();
+    void add(const utf8_string &context, const utf8_string &item, double time);
+
+  public:
+    /* half_life is in seconds. */
+    explicit Frecency(const boost::filesystem::path &path,
+                      double half_life = 7 * 24 * 60 * 60);
+
+    RankingPtr ranking(const utf8_string &context) const;
+
+    void record(const utf8_string &context, const utf8_string &item);
+
+    /* An action that records the text in context, then calls action. */
+    Menu::SuccessAction recorder(const utf8_string &context,
+                                 const Menu::SuccessAction &action);
+  };
+
+} // namespace menu
+
+#endif /* _MENU_FRECENCY_HPP */
@@ -0,0 +1,437 @@
+#include <menu/fuzzy_match.hpp>
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace menu
+{
+  namespace fuzzy
+  {
+    namespace
+    {
+      // Scoring follows fzf's: each matched character scores
+      // score_match plus a bonus depending on its context, and gaps
+      // between matched characters are penalized.
+      const int score_match = 16;
+      const int score_gap_start = -3;
+      const int score_gap_extension = -1;
+
+      const int bonus_boundary = 8;            // after punctuation
+      const int bonus_boundary_white = 10;     // after whitespace or at the start
+      const int bonus_boundary_delimiter = 9;  // after '/', ':', ...
+      const int bonus_camel = 7;               // lower to upper case, or to a digit
+      const int bonus_consecutive = -(score_gap_start + score_gap_extension);
+      const int bonus_first_char_multiplier = 2;
+
+      // Bound on pattern length times window length for the full
+      // alignment search.  Beyond that, the shortest window is used,
+      // and failing that the leftmost alignment is scored as is.
+      const size_t max_alignment_cells = 1 << 16;
+
+      const int no_score = INT_MIN / 2;
+
+      inline unsigned char fold(unsigned char c)
+      {
+        return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+      }
+
+      inline int mask_bit(unsigned char c)
+      {
+        c = fold(c);
+        if (c >= 'a' && c <= 'z')
+          return c - 'a';
+        if (c >= '0' && c <= '9')
+          return 26 + (c - '0');
+        if (c >= 0x80)
+          return 63;
+        return 36 + c % 27;
+      }
+
+      struct MaskTable
+      {
+        CharMask bits[256];
+        MaskTable()
+        {
+          for (int c = 0; c < 256; ++c)
+            bits[c] = CharMask(1) << mask_bit(c);
+        }
+      };
+
+      const MaskTable mask_table;
+
+      enum char_class { CLASS_WHITE, CLASS_DELIMITER, CLASS_NONWORD,
+                        CLASS_LOWER, CLASS_UPPER, CLASS_DIGIT, CLASS_OTHER };
+
+      inline char_class classify(unsigned char c)
+      {
+        if (c >= 'a' && c <= 'z')
+          return CLASS_LOWER;
+        if (c >= 'A' && c <= 'Z')
+          return CLASS_UPPER;
+        if (c >= '0' && c <= '9')
+          return CLASS_DIGIT;
+        if (c >= 0x80)
+          return CLASS_OTHER;
+        switch (c)
+        {
+        case ' ': case '\t': case '\n':
+          return CLASS_WHITE;
+        case '/': case ',': case ':': case ';': case '|':
+          return CLASS_DELIMITER;
+        default:
+          return CLASS_NONWORD;
+        }
+      }
+
+      inline int bonus_for(char_class prev, char_class cur)
+      {
+        if (cur > CLASS_NONWORD)
+        {
+          if (prev == CLASS_WHITE)
+            return bonus_boundary_white;
+          if (prev == CLASS_DELIMITER)
+            return bonus_boundary_delimiter;
+          if (prev == CLASS_NONWORD)
+            return bonus_boundary;
+        }
+        if ((prev == CLASS_LOWER && cur == CLASS_UPPER)
+            || (prev != CLASS_DIGIT && cur == CLASS_DIGIT))
+          return bonus_camel;
+        if (cur == CLASS_WHITE)
+          return bonus_boundary_white;
+        if (cur != CLASS_LOWER && cur != CLASS_UPPER && cur != CLASS_OTHER)
+          return bonus_boundary;
+        return 0;
+      }
+
+      /* Returns the index of the first of bytes a or b in s[from, n), or n. */
+      inline size_t find_either(const char *s, size_t n, size_t from,
+                                unsigned char a, unsigned char b)
+      {
+        size_t i = from;
+#ifdef __SSE2__
+        const __m128i va = _mm_set1_epi8(char(a)), vb = _mm_set1_epi8(char(b));
+        for (; i + 16 <= n; i += 16)
+        {
+          __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+          int m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va),
+                                                 _mm_cmpeq_epi8(v, vb)));
+          if (m)
+            return i + __builtin_ctz(m);
+        }
+#endif
+        for (; i < n; ++i)
+        {
+          unsigned char c = s[i];
+          if (c == a || c == b)
+            return i;
+        }
+        return n;
+      }
+
+      class Matcher
+      {
+        const Pattern &p;
+        const char *s;
+        size_t n;
+        bool cs;
+
+      public:
+        Matcher(const Pattern &p, const char *s, size_t n)
+          : p(p), s(s), n(n), cs(p.case_sensitive())
+        {}
+
+        size_t unit_length(size_t u) const
+        {
+          return p.unit_offsets()[u + 1] - p.unit_offsets()[u];
+        }
+
+        bool unit_at(size_t u, size_t j) const
+        {
+          const char *t = p.text().data() + p.unit_offsets()[u];
+          size_t len = unit_length(u);
+          if (len == 1)
+            return (cs ? (unsigned char)s[j] : fold(s[j])) == (unsigned char)t[0];
+          return j + len <= n && std::memcmp(s + j, t, len) == 0;
+        }
+
+        /* Index of the first occurrence of unit u at or after from, or n. */
+        size_t find(size_t u, size_t from) const
+        {
+          unsigned char c = p.text()[p.unit_offsets()[u]];
+          unsigned char other = c;
+          if (!cs && c >= 'a' && c <= 'z')
+            other = c - ('a' - 'A');
+          if (unit_length(u) == 1)
+            return find_either(s, n, from, c, other);
+          for (size_t i = find_either(s, n, from, c, c); i < n;
+               i = find_either(s, n, i + 1, c, c))
+            if (unit_at(u, i))
+              return i;
+          return n;
+        }
+
+        /* Index of the last occurrence of unit u starting before end, or n. */
+        size_t rfind(size_t u, size_t end) const
+        {
+          for (size_t j = end; j-- > 0; )
+            if (unit_at(u, j))
+              return j;
+          return n;
+        }
+
+        int bonus_at(size_t j) const
+        {
+          char_class prev = j ? classify(s[j - 1]) : CLASS_WHITE;
+          return bonus_for(prev, classify(s[j]));
+        }
+
+        /* Scores a given alignment. */
+        int score(const std::vector<uint32_t> &positions) const
+        {
+          int total = 0, chunk_bonus = 0;
+          for (size_t u = 0; u < positions.size(); ++u)
+          {
+            size_t j = positions[u];
+            int b = bonus_at(j);
+            if (u == 0)
+            {
+              total += score_match + b * bonus_first_char_multiplier;
+              chunk_bonus = b;
+              continue;
+            }
+            size_t prev_end = positions[u - 1] + unit_length(u - 1);
+            if (j == prev_end)
+            {
+              chunk_bonus = std::max(chunk_bonus, b);
+              total += score_match + std::max(chunk_bonus, bonus_consecutive);
+            } else
+            {
+              total += score_gap_start + score_gap_extension * int(j - prev_end - 1);
+              total += score_match + b;
+              chunk_bonus = b;
+            }
+          }
+          return total;
+        }
+
+        /* Finds the best-scoring alignment with all characters in
+           [lo, hi).  Returns false if there is none. */
+        bool align(size_t lo, size_t hi, int &best_score,
+                   std::vector<uint32_t> &positions) const
+        {
+          const size_t m = p.length(), w = hi - lo;
+
+          // score[u * w + r]: best score of units 0..u with unit u at
+          // lo + r; chunk[] is the bonus of the consecutive run it ends,
+          // and from[] the position of unit u - 1.
+          static thread_local std::vector<int> score, chunk, from, bonus;
+          score.assign(m * w, no_score);
+          chunk.resize(m * w);
+          from.resize(m * w);
+          bonus.resize(w);
+
+          for (size_t r = 0; r < w; ++r)
+            bonus[r] = bonus_at(lo + r);
+
+          for (size_t r = 0; r < w; ++r)
+            if (unit_at(0, lo + r))
+            {
+              score[r] = score_match + bonus[r] * bonus_first_char_multiplier;
+              chunk[r] = bonus[r];
+            }
+
+          for (size_t u = 1; u < m; ++u)
+          {
+            const int *prev = &score[(u - 1) * w];
+            const int *prev_chunk = &chunk[(u - 1) * w];
+            int *cur = &score[u * w];
+            int *cur_chunk = &chunk[u * w];
+            int *cur_from = &from[u * w];
+            const size_t prev_len = unit_length(u - 1);
+
+            // Best score of a predecessor separated by a gap, already
+            // charged for the gap up to the current position.
+            int gap = no_score;
+            int gap_from = -1;
+
+            for (size_t r = 0; r < w; ++r)
+            {
+              if (gap != no_score)
+                gap += score_gap_extension;
+              if (r >= prev_len + 1)
+              {
+                size_t k = r - prev_len - 1;
+                if (prev[k] != no_score && prev[k] + score_gap_start > gap)
+                {
+                  gap = prev[k] + score_gap_start;
+                  gap_from = int(k);
+                }
+              }
+
+              if (!unit_at(u, lo + r))
+                continue;
+
+              int b = bonus[r];
+              if (gap != no_score)
+              {
+                cur[r] = gap + score_match + b;
+                cur_chunk[r] = b;
+                cur_from[r] = gap_from;
+              }
+              if (r >= prev_len && prev[r - prev_len] != no_score)
+              {
+                size_t k = r - prev_len;
+                int c = std::max(prev_chunk[k], b);
+                int v = prev[k] + score_match + std::max(c, bonus_consecutive);
+                if (v >= cur[r])
+                {
+                  cur[r] = v;
+                  cur_chunk[r] = c;
+                  cur_from[r] = int(k);
+                }
+              }
+            }
+          }
+
+          const int *last = &score[(m - 1) * w];
+          size_t best = w;
+          for (size_t r = 0; r < w; ++r)
+            if (last[r] != no_score && (best == w || last[r] > last[best]))
+              best = r;
+          if (best == w)
+            return false;
+
+          best_score = last[best];
+          positions.resize(m);
+          size_t r = best;
+          for (size_t u = m; u-- > 0; )
+          {
+            positions[u] = uint32_t(lo + r);
+            if (u)
+              r = from[u * w + r];
+          }
+          return true;
+        }
+
+        void to_ranges(const std::vector<uint32_t> &positions, MatchRanges &ranges) const
+        {
+          ranges.clear();
+          for (size_t u = 0; u < positions.size(); ++u)
+          {
+            uint32_t b = positions[u], e = b + unit_length(u);
+            if (!ranges.empty() && ranges.back().second == b)
+              ranges.back().second = e;
+            else
+              ranges.push_back(std::make_pair(b, e));
+          }
+        }
+      };
+    }
+
+    CharMask char_mask(const char *s, size_t n)
+    {
+      CharMask m = 0;
+      for (size_t i = 0; i < n; ++i)
+        m |= mask_table.bits[(unsigned char)s[i]];
+      return m;
+    }
+
+    Pattern::Pattern(const utf8_string &text)
+      : case_sensitive_(false), mask_(0)
+    {
+      for (unsigned char c : text)
+        if (c >= 'A' && c <= 'Z')
+          case_sensitive_ = true;
+
+      text_.reserve(text.size());
+      for (size_t i = 0; i < text.size(); ++i)
+      {
+        unsigned char c = text[i];
+        // Skip continuation bytes when recording character offsets.
+        if ((c & 0xC0) != 0x80)
+          unit_offsets_.push_back(uint32_t(i));
+        text_ += char(case_sensitive_ ? c : fold(c));
+      }
+      unit_offsets_.push_back(uint32_t(text_.size()));
+      mask_ = char_mask(text_);
+    }
+
+    bool match(const Pattern &pattern, const char *s, size_t n, int &score,
+               MatchRanges *ranges)
+    {
+      if (pattern.empty())
+      {
+        score = 0;
+        if (ranges)
+          ranges->clear();
+        return true;
+      }
+
+      Matcher matcher(pattern, s, n);
+      const size_t m = pattern.length();
+
+      // Leftmost alignment, which also determines whether s matches.
+      static thread_local std::vector<uint32_t> positions;
+      positions.resize(m);
+      size_t pos = 0;
+      for (size_t u = 0; u < m; ++u)
+      {
+        size_t i = matcher.find(u, pos);
+        if (i == n)
+          return false;
+        positions[u] = uint32_t(i);
+        pos = i + matcher.unit_length(u);
+      }
+
+      if (m == 1)
+      {
+        // A single character: take the occurrence with the best bonus.
+        const size_t len = matcher.unit_length(0);
+        int best = matcher.bonus_at(positions[0]);
+        for (size_t i = matcher.find(0, positions[0] + len); i < n; i = matcher.find(0, i + len))
+        {
+          int b = matcher.bonus_at(i);
+          if (b > best)
+          {
+            best = b;
+            positions[0] = uint32_t(i);
+          }
+        }
+        score = score_match + best * bonus_first_char_multiplier;
+        if (ranges)
+          matcher.to_ranges(positions, *ranges);
+        return true;
+      }
+
+      // Every alignment lies between the first occurrence of the first
+      // character and the last occurrence of the last.
+      size_t lo = positions[0];
+      size_t hi = matcher.rfind(m - 1, n) + matcher.unit_length(m - 1);
+
+      if (m * (hi - lo) > max_alignment_cells)
+      {
+        // Shortest window ending where the leftmost alignment ends.
+        hi = pos;
+        size_t end = hi;
+        for (size_t u = m; u-- > 0; )
+          end = matcher.rfind(u, end - matcher.unit_length(u) + 1);
+        lo = end;
+      }
+
+      if (m * (hi - lo) > max_alignment_cells
+          || !matcher.align(lo, hi, score, positions))
+        score = matcher.score(positions);
+
+      if (ranges)
+        matcher.to_ranges(positions, *ranges);
+      return true;
+    }
+
+  } // namespace menu::fuzzy
+} // namespace menu
@@ -0,0 +1,81 @@
+#ifndef _MENU_FUZZY_MATCH_HPP
+#define _MENU_FUZZY_MATCH_HPP
+
+#include <util/string.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace menu
+{
+  namespace fuzzy
+  {
+    /* Fuzzy subsequence matching in the style of fzf: a candidate
+       matches if every character of the pattern occurs in it in order.
+       Matches are scored by rewarding characters at word boundaries and
+       consecutive runs, and penalizing gaps.
+
+       Matching is on UTF-8 bytes, but a multi-byte pattern character
+       only matches a whole, identical character.  ASCII letters match
+       either case unless the pattern contains an upper-case letter. */
+
+    /* Bitmask of the case-folded characters that occur in a string.  A
+       candidate whose mask lacks a bit of the pattern's mask cannot
+       match, which rejects most candidates with a single AND. */
+    typedef uint64_t CharMask;
+
+    CharMask char_mask(const char *s, size_t n);
+
+    inline CharMask char_mask(const utf8_string &s)
+    {
+      return char_mask(s.data(), s.size());
+    }
+
+    /* [begin, end) byte ranges of the matched characters, merged where
+       adjacent. */
+    typedef std::vector<std::pair<uint32_t, uint32_t> > MatchRanges;
+
+    class Pattern
+    {
+      utf8_string text_;
+      bool case_sensitive_;
+      CharMask mask_;
+      // Byte offset in text_ of each character, followed by text_.size()
+      std::vector<uint32_t> unit_offsets_;
+
+    public:
+      explicit Pattern(const utf8_string &text);
+
+      bool empty() const { return text_.empty(); }
+      bool case_sensitive() const { return case_sensitive_; }
+      CharMask mask() const { return mask_; }
+      const utf8_string &text() const { return text_; }
+      /* Number of characters */
+      size_t length() const { return unit_offsets_.size() - 1; }
+      const std::vector<uint32_t> &unit_offsets() const { return unit_offsets_; }
+
+      /* True if a candidate with the given mask could match. */
+      bool may_match(CharMask candidate_mask) const
+      {
+        return (mask_ & ~candidate_mask) == 0;
+      }
+    };
+
+    /* Returns true if pattern matches s, setting score.  Higher scores
+       are better.  If ranges is non-null it receives the matched
+       characters of the best-scoring alignment.  An empty pattern
+       matches everything with a score of 0. */
+    bool match(const Pattern &pattern, const char *s, size_t n, int &score,
+               MatchRanges *ranges = 0);
+
+    inline bool match(const Pattern &pattern, const utf8_string &s, int &score,
+                      MatchRanges *ranges = 0)
+    {
+      return match(pattern, s.data(), s.size(), score, ranges);
+    }
+
+  } // namespace menu::fuzzy
+} // namespace menu
+
+#endif /* _MENU_FUZZY_MATCH_HPP */
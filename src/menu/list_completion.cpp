@@ -1,6 +1,8 @@
 
 #include <wm/all.hpp>
 #include <menu/list_completion.hpp>
+#include <menu/fuzzy_match.hpp>
+#include <boost/make_shared.hpp>
 
 namespace menu
 {
@@ -10,21 +12,26 @@ namespace menu
     class ListCompletions : public Completions
     {
     private:
-      typedef std::vector<Entry> CompletionList;
-      CompletionList completions;
+      EntryList list;
+      std::vector<uint32_t> indices;
       StringCompletionApplicator applicator;
       bool complete_common_prefix;
+      Highlighter highlighter;
 
       int selected;
       int columns;
       int column_width;
       int lines;
       int line_height;
+
+      const Entry &entry(size_t i) const { return (*list)[indices[i]]; }
     public:
       ListCompletions(const InputState &initial_input,
-                      const CompletionList &list,
+                      const EntryList &list,
+                      std::vector<uint32_t> indices,
                       const StringCompletionApplicator &applicator,
-                      bool complete_common_prefix);
+                      bool complete_common_prefix,
+                      const Highlighter &highlighter);
 
       virtual void compute_dimensions(Menu &menu, int width, int height, int &out_width, int &out_height);
       virtual void draw(Menu &menu, const WRect &rect, WDrawable &d);
@@ -33,23 +40,27 @@ namespace menu
     };
 
     ListCompletions::ListCompletions(const InputState &initial_input,
-                                     const CompletionList &list,
+                                     const EntryList &list,
+                                     std::vector<uint32_t> indices,
                                      const StringCompletionApplicator &applicator,
-                                     bool complete_common_prefix)
-      : completions(list),
+                                     bool complete_common_prefix,
+                                     const Highlighter &highlighter)
+      : list(list),
+        indices(std::move(indices)),
         applicator(applicator),
         complete_common_prefix(complete_common_prefix),
+        highlighter(highlighter),
         selected(-1)
     {
-      if (completions.empty())
+      if (this->indices.empty())
         throw std::invalid_argument("empty completion list");
 
       /* For improved appearance, if there is only a single completion and
          it is equal to the current input, select that completion. */
-      if (completions.size() == 1)
+      if (this->indices.size() == 1)
       {
         InputState temp_state(initial_input);
-        applicator(temp_state, completions.front().first);
+        applicator(temp_state, entry(0).first);
         if (temp_state == initial_input)
         {
           selected = 0;
@@ -64,8 +75,8 @@ namespace menu
       int available_height = height - (style.border_pixels + 2 * style.completions_spacing);
 
       int maximum_width = 0;
-      BOOST_FOREACH (const Entry &e, completions) {
-        const utf8_string &str = e.first;
+      BOOST_FOREACH (uint32_t i, indices) {
+        const utf8_string &str = (*list)[i].first;
 
         if ((int)str.size() > maximum_width)
           maximum_width = (int)str.size();
@@ -89,7 +100,7 @@ namespace menu
 
       int max_lines = available_height / line_height;
 
-      lines = (completions.size() + columns - 1)
+      lines = (indices.size() + columns - 1)
         / columns;
       if (lines > max_lines)
         lines = max_lines;
@@ -102,7 +113,7 @@ namespace menu
       int required_columns;
 
       if (lines == 1)
-        required_columns = completions.size();
+        required_columns = indices.size();
       else
         required_columns = columns;
 
@@ -140,11 +151,13 @@ namespace menu
         begin_pos_index = 0;
       }
 
-      if (end_pos_index > completions.size())
-        end_pos_index = completions.size();
+      if (end_pos_index > indices.size())
+        end_pos_index = indices.size();
 
       int base_y = rect2.y + spacing;
 
+      std::vector<std::pair<uint32_t, uint32_t> > underlined;
+
       for (size_t pos_index = begin_pos_index; pos_index < end_pos_index; ++pos_index)
       {
         int row = (pos_index - begin_pos_index) / columns;
@@ -160,15 +173,20 @@ namespace menu
           (style.label.horizontal_padding,
            style.label.vertical_padding);
 
-        const EntryStyle &entry_style = *completions[pos_index].second;
+        const Entry &e = entry(pos_index);
+        const EntryStyle &entry_style = *e.second;
 
         const style::TextColor &text_color =
           ((int)pos_index == selected) ? entry_style.selected : entry_style.normal;
 
-        draw_label_with_text_background(d, completions[pos_index].first,
+        underlined.clear();
+        if (highlighter)
+          highlighter(e.first, underlined);
+
+        draw_label_with_text_background(d, e.first,
                                         style.label.font,
                                         text_color.foreground, text_color.background,
-                                        label_rect3);
+                                        label_rect3, underlined);
       }
     }
 
@@ -179,10 +197,10 @@ namespace menu
       {
         // Find the largest common prefix
 
-        utf8_string prefix = completions[0].first;
-        for (size_t i = 1; i < completions.size(); ++i)
+        utf8_string prefix = entry(0).first;
+        for (size_t i = 1; i < indices.size(); ++i)
         {
-          const utf8_string &str = completions[i].first;
+          const utf8_string &str = entry(i).first;
           if (prefix.empty())
             break;
           if (prefix.length() > str.length())
@@ -204,9 +222,9 @@ namespace menu
       if (selected  < 0)
         selected = 0;
       else
-        selected = (selected + 1) % completions.size();
+        selected = (selected + 1) % indices.size();
 
-      applicator(input, completions[selected].first);
+      applicator(input, entry(selected).first);
       return false;
     }
 
@@ -224,47 +242,254 @@ namespace menu
                                          const std::vector<Entry> &list,
                                          const StringCompletionApplicator &applicator,
                                          bool complete_common_prefix)
+    {
+      if (list.empty())
+        return Menu::CompletionsPtr();
+
+      std::vector<uint32_t> indices(list.size());
+      for (size_t i = 0; i < indices.size(); ++i)
+        indices[i] = i;
+      return completion_list(initial_input, boost::make_shared<const std::vector<Entry> >(list),
+                             std::move(indices), applicator, complete_common_prefix);
+    }
+
+    Menu::CompletionsPtr completion_list(const InputState &initial_input,
+                                         const EntryList &list,
+                                         std::vector<uint32_t> indices,
+                                         const StringCompletionApplicator &applicator,
+                                         bool complete_common_prefix,
+                                         const Highlighter &highlighter)
     {
       Menu::CompletionsPtr result;
-      if (!list.empty())
-        result.reset(new ListCompletions(initial_input, list, applicator, complete_common_prefix));
+      if (!indices.empty())
+        result.reset(new ListCompletions(initial_input, list, std::move(indices),
+                                         applicator, complete_common_prefix, highlighter));
 
       return result;
     }
 
+    PrefixIndex::PrefixIndex(std::vector<Entry> entries)
+    {
+      std::sort(entries.begin(), entries.end(),
+                [](const Entry &a, const Entry &b) { return a.first < b.first; });
+      entries_ = boost::make_shared<const std::vector<Entry> >(std::move(entries));
+    }
+
+    std::pair<uint32_t, uint32_t> PrefixIndex::range(const utf8_string &prefix) const
+    {
+      return range(prefix, std::make_pair(uint32_t(0), uint32_t(entries_->size())));
+    }
+
+    std::pair<uint32_t, uint32_t> PrefixIndex::range(const utf8_string &prefix,
+                                                     std::pair<uint32_t, uint32_t> within) const
+    {
+      const std::vector<Entry> &v = *entries_;
+
+      // Every string with the prefix compares >= prefix, and they are
+      // followed by the strings that are greater and lack it.
+      std::vector<Entry>::const_iterator begin =
+        std::lower_bound(v.begin() + within.first, v.begin() + within.second, prefix,
+                         [](const Entry &e, const utf8_string &s) { return e.first < s; });
+      std::vector<Entry>::const_iterator end =
+        std::partition_point(begin, v.begin() + within.second,
+                             [&](const Entry &e) { return boost::algorithm::starts_with(e.first, prefix); });
+
+      return std::make_pair(uint32_t(begin - v.begin()), uint32_t(end - v.begin()));
+    }
 
     class PrefixCompleter
     {
-      boost::shared_ptr<std::vector<utf8_string> > list;
-      const EntryStyle &entry_style;
+      boost::shared_ptr<const PrefixIndex> index;
+
+      // The range matched by the last input, which contains the range
+      // for any extension of it.
+      struct LastRange
+      {
+        boost::mutex mutex;
+        bool valid = false;
+        utf8_string text;
+        std::pair<uint32_t, uint32_t> range;
+      };
+      boost::shared_ptr<LastRange> last;
+      // Bonus of each entry of index, if there is a ranking
+      boost::shared_ptr<const std::vector<int> > bonus;
     public:
       PrefixCompleter(const std::vector<utf8_string> &list,
-                      const EntryStyle &style, bool sort = false)
-        : list(new std::vector<utf8_string>(list)),
-          entry_style(style)
+                      const EntryStyle &style,
+                      const Frecency::RankingPtr &ranking)
+      {
+        std::vector<Entry> entries;
+        entries.reserve(list.size());
+        BOOST_FOREACH (const utf8_string &str, list)
+          entries.push_back(Entry(str, &style));
+        index = boost::make_shared<const PrefixIndex>(std::move(entries));
+        last = boost::make_shared<LastRange>();
+        if (ranking && !ranking->empty())
+        {
+          boost::shared_ptr<std::vector<int> > b(new std::vector<int>);
+          b->reserve(list.size());
+          BOOST_FOREACH (const Entry &e, *index->entries())
+            b->push_back(ranking->bonus(e.first));
+          bonus = b;
+        }
+      }
+
+      Menu::CompletionsPtr operator()(const InputState &state) const
+      {
+        std::pair<uint32_t, uint32_t> r;
+        {
+          boost::mutex::scoped_lock l(last->mutex);
+          if (last->valid && input_extends(last->text, state.text))
+            r = index->range(state.text, last->range);
+          else
+            r = index->range(state.text);
+          last->valid = true;
+          last->text = state.text;
+          last->range = r;
+        }
+
+        std::vector<uint32_t> indices(r.second - r.first);
+        for (uint32_t i = 0; i < indices.size(); ++i)
+          indices[i] = r.first + i;
+        if (bonus)
+        {
+          const std::vector<int> &b = *bonus;
+          std::stable_sort(indices.begin(), indices.end(),
+                           [&](uint32_t x, uint32_t y) { return b[x] > b[y]; });
+        }
+        return completion_list(state, index->entries(), std::move(indices));
+      }
+    };
+
+    Menu::Completer prefix_completer(const std::vector<utf8_string> &list,
+                                     const EntryStyle &style,
+                                     const Frecency::RankingPtr &ranking)
+    {
+      return PrefixCompleter(list, style, ranking);
+    }
+
+    static void fuzzy_highlight(const boost::shared_ptr<const fuzzy::Pattern> &pattern,
+                                const utf8_string &str,
+                                std::vector<std::pair<uint32_t, uint32_t> > &ranges)
+    {
+      int score;
+      fuzzy::match(*pattern, str, score, &ranges);
+    }
+
+    class FuzzyCompleter
+    {
+      EntryList entries;
+      boost::shared_ptr<const std::vector<fuzzy::CharMask> > masks;
+      boost::shared_ptr<CandidateCache> cache;
+      boost::shared_ptr<const std::vector<int> > bonus;
+    public:
+      FuzzyCompleter(const std::vector<utf8_string> &list,
+                     const EntryStyle &style,
+                     const Frecency::RankingPtr &ranking)
       {
-        if (sort)
-          std::sort(this->list->begin(), this->list->end());
+        boost::shared_ptr<std::vector<Entry> > e(new std::vector<Entry>);
+        boost::shared_ptr<std::vector<fuzzy::CharMask> > m(new std::vector<fuzzy::CharMask>);
+        e->reserve(list.size());
+        m->reserve(list.size());
+        BOOST_FOREACH (const utf8_string &str, list)
+        {
+          e->push_back(Entry(str, &style));
+          m->push_back(fuzzy::char_mask(str));
+        }
+        entries = e;
+        masks = m;
+        cache = boost::make_shared<CandidateCache>();
+        if (ranking && !ranking->empty())
+        {
+          boost::shared_ptr<std::vector<int> > b(new std::vector<int>);
+          b->reserve(list.size());
+          BOOST_FOREACH (const utf8_string &str, list)
+            b->push_back(ranking->bonus(str));
+          bonus = b;
+        }
       }
 
       Menu::CompletionsPtr operator()(const InputState &state) const
       {
-        std::vector<Entry> results;
-        BOOST_FOREACH (const utf8_string &str, *list)
+        boost::shared_ptr<const fuzzy::Pattern> pattern(new fuzzy::Pattern(state.text));
+        const std::vector<Entry> &v = *entries;
+        const std::vector<fuzzy::CharMask> &m = *masks;
+
+        struct Scored
+        {
+          int score;
+          uint32_t length, index;
+          bool operator<(const Scored &x) const
+          {
+            if (score != x.score)
+              return score > x.score;
+            if (length != x.length)
+              return length < x.length;
+            return index < x.index;
+          }
+        };
+
+        // Extending the pattern can only remove matches, so when the
+        // input was extended only the previous matches are rescored.
+        std::vector<uint32_t> matched;
+        CandidateCache::Candidates previous = cache->take(state.text);
+
+        std::vector<Scored> scored;
+        auto consider = [&](uint32_t i) {
+          int score;
+          if (pattern->may_match(m[i]) && fuzzy::match(*pattern, v[i].first, score))
+          {
+            if (bonus)
+              score += (*bonus)[i];
+            Scored s = { score, uint32_t(v[i].first.size()), i };
+            scored.push_back(s);
+            matched.push_back(i);
+          }
+        };
+
+        if (previous)
+        {
+          for (size_t j = 0; j < previous->size(); ++j)
+          {
+            if ((j & 1023) == 0 && completion_cancelled())
+              return Menu::CompletionsPtr();
+            consider((*previous)[j]);
+          }
+        } else
         {
-          if (boost::algorithm::starts_with(str, state.text))
+          for (uint32_t i = 0; i < v.size(); ++i)
           {
-            results.push_back(Entry(str, &entry_style));
+            if ((i & 1023) == 0 && completion_cancelled())
+              return Menu::CompletionsPtr();
+            consider(i);
           }
         }
-        return completion_list(state, results);
+
+        if (!pattern->empty())
+          cache->store(state.text, std::move(matched));
+
+        std::sort(scored.begin(), scored.end());
+
+        std::vector<uint32_t> indices;
+        indices.reserve(scored.size());
+        BOOST_FOREACH (const Scored &s, scored)
+          indices.push_back(s.index);
+
+        Highlighter highlighter;
+        if (!pattern->empty())
+          highlighter = boost::bind(&fuzzy_highlight, pattern, _1, _2);
+
+        // The common prefix of fuzzy matches is rarely useful.
+        return completion_list(state, entries, std::move(indices),
+                               apply_completion_simple, false, highlighter);
       }
     };
 
-    Menu::Completer prefix_completer(const std::vector<utf8_string> &list,
-                                     const EntryStyle &style)
+    Menu::Completer fuzzy_completer(const std::vector<utf8_string> &list,
+                                    const EntryStyle &style,
+                                    const Frecency::RankingPtr &ranking)
     {
-      return PrefixCompleter(list, style);
+      return FuzzyCompleter(list, style, ranking);
     }
   } // namespace menu::list_completion
 } // namespace menu
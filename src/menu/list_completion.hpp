@@ -3,6 +3,7 @@
 
 #include <util/range.hpp>
 #include <menu/menu.hpp>
+#include <menu/frecency.hpp>
 #include <style/common.hpp>
 
 namespace menu
@@ -16,8 +17,17 @@ namespace menu
     
     typedef std::pair<utf8_string, const EntryStyle *> Entry;
 
+    /* Immutable entry storage shared between a completer and the
+       completion lists it produces. */
+    typedef boost::shared_ptr<const std::vector<Entry> > EntryList;
+
     typedef boost::function<void (InputState &, const utf8_string &)> StringCompletionApplicator;
 
+    /* Computes the byte ranges of an entry to draw underlined.  Called
+       only for the entries actually drawn. */
+    typedef boost::function<void (const utf8_string &,
+                                  std::vector<std::pair<uint32_t, uint32_t> > &)> Highlighter;
+
     void apply_completion_simple(InputState &state, const utf8_string &completion);
 
     Menu::CompletionsPtr completion_list(const InputState &initial_input,
@@ -25,12 +35,56 @@ namespace menu
                                          const StringCompletionApplicator &applicator = apply_completion_simple,
                                          bool complete_common_prefix = true);
 
-    Menu::Completer prefix_completer(const std::vector<utf8_string> &list, const EntryStyle &style);
+    /* Shows the entries of `list' selected by `indices', in that order,
+       without copying them. */
+    Menu::CompletionsPtr completion_list(const InputState &initial_input,
+                                         const EntryList &list,
+                                         std::vector<uint32_t> indices,
+                                         const StringCompletionApplicator &applicator = apply_completion_simple,
+                                         bool complete_common_prefix = true,
+                                         const Highlighter &highlighter = Highlighter());
+
+    /* Entries sorted by text, so that the entries beginning with a
+       given prefix form a contiguous range found by binary search. */
+    class PrefixIndex
+    {
+      EntryList entries_;
+    public:
+      explicit PrefixIndex(std::vector<Entry> entries);
+      const EntryList &entries() const { return entries_; }
+
+      /* Returns the [begin, end) range of entries starting with prefix. */
+      std::pair<uint32_t, uint32_t> range(const utf8_string &prefix) const;
+
+      /* As above, searching only within `within', which must contain
+         the result, e.g. the range for a prefix of prefix. */
+      std::pair<uint32_t, uint32_t> range(const utf8_string &prefix,
+                                          std::pair<uint32_t, uint32_t> within) const;
+    };
+
+    /* Lists the entries beginning with the input; with a ranking,
+       those used most often and recently come first. */
+    Menu::Completer prefix_completer(const std::vector<utf8_string> &list, const EntryStyle &style,
+                                     const Frecency::RankingPtr &ranking = Frecency::RankingPtr());
+
+    template <class Range>
+    Menu::Completer prefix_completer(const Range &rng, const EntryStyle &style,
+                                     const Frecency::RankingPtr &ranking = Frecency::RankingPtr())
+    {
+      return prefix_completer(boost::copy_range<std::vector<utf8_string> >(rng), style, ranking);
+    }
+
+    /* Completes by fuzzy subsequence match (see menu/fuzzy_match.hpp),
+       best matches first, with the matched characters underlined.  The
+       bonus from a ranking is added to the match score. */
+    Menu::Completer fuzzy_completer(const std::vector<utf8_string> &list, const EntryStyle &style,
+                                    const Frecency::RankingPtr &ranking = Frecency::RankingPtr());
 
     template <class Range>
-    Menu::Completer prefix_completer(const Range &rng, const EntryStyle &style)
+    Menu::Completer fuzzy_completer(const Range &rng, const EntryStyle &style,
+                                    const Frecency::RankingPtr &ranking = Frecency::RankingPtr())
     {
-      return prefix_completer(boost::copy_range<std::vector<utf8_string> >(rng), style);
+      return fuzzy_completer(boost::copy_range<std::vector<utf8_string> >(rng), style, ranking);
     }
     
   } // namespace menu::list_completion
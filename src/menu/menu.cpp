@@ -22,7 +22,10 @@ namespace menu
     : wm_(wm_),
       style_(wm_.dc, style_spec),
       completions_valid(false),
+      input_generation(0),
       bindctx(wm_, mod_info, None, false),
+      buffer(wm_.dc),
+      completions_buffer(wm_.dc),
       completion_delay(wm_.event_service(),
                        boost::bind(&Menu::update_completions, this)),
       initialized(false)
@@ -70,9 +73,17 @@ namespace menu
 
     scheduled_update_server = false;
     scheduled_draw = false;
+    scheduled_repaint = false;
 
   }
 
+  static Menu::CompletionsPtr ignore_partial_results(const Menu::Completer &completer,
+                                                     const InputState &input,
+                                                     Menu::PartialResultSink &)
+  {
+    return completer(input);
+  }
+
   bool Menu::read_string(const utf8_string &prompt,
                          const InitialState &initial_state,
                          const SuccessAction &success_action,
@@ -80,6 +91,21 @@ namespace menu
                          const Completer &completer,
                          bool use_delay,
                          bool use_separate_thread)
+  {
+    StreamingCompleter c;
+    if (completer)
+      c = boost::bind(&ignore_partial_results, completer, _1, _2);
+    return read_string(prompt, initial_state, success_action, failure_action,
+                       c, use_delay, use_separate_thread);
+  }
+
+  bool Menu::read_string(const utf8_string &prompt,
+                         const InitialState &initial_state,
+                         const SuccessAction &success_action,
+                         const FailureAction &failure_action,
+                         const StreamingCompleter &completer,
+                         bool use_delay,
+                         bool use_separate_thread)
   {
     if (active)
       return false;
@@ -117,11 +143,11 @@ namespace menu
     bounds.x = 0;
     bounds.y = wm().screen_height() - bounds.height;
 
-    WRect inner_rect = bounds.inside_border(style().border_pixels);
+    WRect inner_rect = WRect(0, 0, bounds.width, bounds.height).inside_border(style().border_pixels);
     if (!prompt.empty())
     {
       int available_text_width = inner_rect.width - 2 * style().label.horizontal_padding;
-      int prompt_width = compute_label_width(wm().buffer_pixmap.drawable(),
+      int prompt_width = compute_label_width(buffer.drawable(),
                                              prompt,
                                              style().label.font,
                                              available_text_width);
@@ -163,7 +189,7 @@ namespace menu
 
       completions_bounds.height = out_height;
       completions_bounds.width = out_width;
-      completions_bounds.x = input_rect.x - style().border_pixels;
+      completions_bounds.x = bounds.x + input_rect.x - style().border_pixels;
       completions_bounds.y = bounds.y - out_height;
     }
   }
@@ -173,10 +199,16 @@ namespace menu
     if (!active)
       return;
 
-    if (ev.count)
+    WRect rect(ev.x, ev.y, ev.width, ev.height);
+    if (ev.window == xwin_)
+      buffer.add_damage(rect);
+    else if (ev.window == completions_xwin_ && completions
+             && completions_bounds.width > 0 && completions_bounds.height > 0)
+      completions_buffer.add_damage(rect);
+    else
       return;
 
-    scheduled_draw = true;
+    scheduled_repaint = true;
   }
 
   void Menu::handle_screen_size_changed()
@@ -265,30 +297,41 @@ namespace menu
       draw();
     }
 
+    if (active && scheduled_repaint)
+    {
+      if (!buffer.valid(bounds.width, bounds.height)
+          || (completions && !completions_buffer.valid(completions_bounds.width,
+                                                       completions_bounds.height)))
+        draw();
+
+      buffer.repair(xwin_);
+      if (completions)
+        completions_buffer.repair(completions_xwin_);
+    }
+
     scheduled_draw = false;
     scheduled_update_server = false;
+    scheduled_repaint = false;
   }
 
   void Menu::draw()
   {
-    WDrawable &d = wm().buffer_pixmap.drawable();
-
     // Draw completions
     if (completions)
     {
       WRect rect(0, 0, completions_bounds.width, completions_bounds.height);
+      WDrawable &d = completions_buffer.prepare(rect.width, rect.height);
 
       completions->draw(*this, rect, d);
-      XCopyArea(wm().display(), d.drawable(),
-                completions_xwin(),
-                wm().dc.gc(),
-                0, 0, completions_bounds.width, completions_bounds.height,
-                0, 0);
+      completions_buffer.copy_to(completions_xwin(), rect);
     }
 
     // Draw input area
     {
-      draw_border(d, style().border_color, style().border_pixels, bounds);
+      WRect rect(0, 0, bounds.width, bounds.height);
+      WDrawable &d = buffer.prepare(rect.width, rect.height);
+
+      draw_border(d, style().border_color, style().border_pixels, rect);
 
       // draw prompt area
       if (!prompt.empty())
@@ -311,11 +354,7 @@ namespace menu
          style().selected.foreground, style().selected.background,
          input_text_rect, input.cursor_position, mark_position);
 
-      XCopyArea(wm().display(), d.drawable(),
-                xwin(),
-                wm().dc.gc(),
-                bounds.x, bounds.y, bounds.width, bounds.height,
-                0, 0);
+      buffer.copy_to(xwin(), rect);
     }
   }
 
@@ -346,26 +385,69 @@ namespace menu
   }
 
 
+  static thread_local const std::atomic<bool> *current_cancelled = 0;
+
+  bool completion_cancelled()
+  {
+    return current_cancelled && current_cancelled->load(std::memory_order_relaxed);
+  }
+
   void Menu::finished_updating_completions(const boost::weak_ptr<Menu::CompletionState> &completion_state,
                                            const Menu::CompletionsPtr &completions)
   {
     if (boost::shared_ptr<CompletionState> s = completion_state.lock())
     {
-      s->menu.completion_state.reset();
-      if (s->recompute)
-        s->menu.update_completions();
-      else if (!s->expired)
-        s->menu.set_completions(completions);
+      Menu &menu = s->menu;
+      menu.completion_state.reset();
+      if (s->recompute && menu.active)
+        menu.update_completions();
+      else if (s->generation == menu.input_generation)
+        menu.set_completions(completions);
       /* TODO: decide if expired completions should also be shown somehow. */
     }
   }
 
+  void Menu::partial_completions(const boost::weak_ptr<Menu::CompletionState> &completion_state,
+                                 const Menu::CompletionsPtr &completions)
+  {
+    if (boost::shared_ptr<CompletionState> s = completion_state.lock())
+    {
+      Menu &menu = s->menu;
+      if (s->generation != menu.input_generation || menu.completions_valid)
+        return;
+
+      // Shown, but not yet valid: a completion command still waits
+      // for the final result.
+      menu.completions = completions;
+      menu.scheduled_draw = true;
+      menu.scheduled_update_server = true;
+      menu.compute_bounds();
+    }
+  }
+
+  void Menu::post_partial_completions(const boost::weak_ptr<Menu::CompletionState> &completion_state,
+                                      EventService &event_service,
+                                      const Menu::CompletionsPtr &completions)
+  {
+    event_service.post(boost::bind(&Menu::partial_completions, completion_state, completions));
+  }
+
   void Menu::update_completions_separate_thread(const boost::weak_ptr<Menu::CompletionState> &completion_state,
-                                                const Menu::Completer &completer,
+                                                const boost::shared_ptr<std::atomic<bool> > &cancelled,
+                                                const Menu::StreamingCompleter &completer,
                                                 const InputState &input,
                                                 EventService &event_service)
   {
-    CompletionsPtr completions(completer(input));
+    // Partial results at most every 50ms.
+    PartialResultSink sink(boost::bind(&post_partial_completions, completion_state,
+                                       boost::ref(event_service), _1),
+                           time_duration::milliseconds(50));
+
+    current_cancelled = cancelled.get();
+    CompletionsPtr completions;
+    if (!cancelled->load(std::memory_order_relaxed))
+      completions = completer(input, sink);
+    current_cancelled = 0;
 
     event_service.post(boost::bind(&Menu::finished_updating_completions, completion_state, completions));
   }
@@ -376,19 +458,22 @@ namespace menu
     {
       if (completion_state)
       {
+        // The running job has been cancelled; start again once it returns.
         completion_state->recompute = true;
       } else
       {
-        completion_state.reset(new CompletionState(*this));
+        completion_state.reset(new CompletionState(*this, input_generation));
         boost::thread(boost::bind(&Menu::update_completions_separate_thread,
                                   boost::weak_ptr<CompletionState>(completion_state),
+                                  completion_state->cancelled,
                                   completer,
                                   input,
                                   boost::ref(wm().event_service())));
       }
     } else
     {
-      set_completions(completer(input));
+      PartialResultSink sink;
+      set_completions(completer(input, sink));
     }
   }
 
@@ -401,8 +486,9 @@ namespace menu
 
     completions_valid = false;
 
+    ++input_generation;
     if (completion_state)
-      completion_state->expired = true;
+      completion_state->cancel();
 
     if (use_delay)
     {
@@ -481,7 +567,11 @@ namespace menu
       failure_action.clear();
       completer.clear();
       completions.reset();
-      completion_state.reset();
+      // The cancelled job is kept until it returns, so that a menu
+      // opened meanwhile waits for it rather than running beside it.
+      ++input_generation;
+      if (completion_state)
+        completion_state->cancel();
     }
   }
 
@@ -2,6 +2,8 @@
 #define _MENU_MENU_HPP
 
 #include <util/string.hpp>
+#include <cstdint>
+#include <vector>
 
 #include <wm/key.hpp>
 #include <draw/draw.hpp>
@@ -10,6 +12,9 @@
 #include <util/event.hpp>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread/mutex.hpp>
+#include <atomic>
 #include <style/style.hpp>
 #include <style/common.hpp>
 
@@ -53,6 +58,67 @@ namespace menu
     }
   };
 
+  /* For completers run on the completion thread: true once the input
+     has changed since this completion started, meaning its result will
+     be discarded.  Completers that may take a while should check it
+     periodically, e.g. every 1024 candidates, and return early.  Always
+     false on the main thread. */
+  bool completion_cancelled();
+
+  /* True if current was obtained by appending to previous.  For a
+     completer that filters candidates by the input, the candidates
+     matching current are then a subset of those matching previous. */
+  inline bool input_extends(const utf8_string &previous, const utf8_string &current)
+  {
+    return current.size() >= previous.size()
+      && current.compare(0, previous.size(), previous) == 0;
+  }
+
+  /* Remembers which candidates matched the last input, so that a
+     completer can narrow that set when the input is extended instead
+     of scanning every candidate.  Candidates are identified by index;
+     the cache must be cleared if the candidate list changes.  Shared
+     by copies of a completer, and safe to use from the completion
+     thread. */
+  class CandidateCache
+  {
+  public:
+    typedef boost::shared_ptr<const std::vector<uint32_t> > Candidates;
+
+  private:
+    boost::mutex mutex;
+    utf8_string text;
+    // Null if nothing is cached
+    Candidates candidates;
+
+  public:
+    /* If the cached input is a prefix of text, returns the cached
+       candidates, otherwise null.  They stay cached until replaced by
+       store, so a job that is cancelled after taking them loses
+       nothing. */
+    Candidates take(const utf8_string &text)
+    {
+      boost::mutex::scoped_lock l(mutex);
+      if (!candidates || !input_extends(this->text, text))
+        return Candidates();
+      return candidates;
+    }
+
+    void store(const utf8_string &text, std::vector<uint32_t> candidates)
+    {
+      Candidates c(boost::make_shared<const std::vector<uint32_t> >(std::move(candidates)));
+      boost::mutex::scoped_lock l(mutex);
+      this->text = text;
+      this->candidates = c;
+    }
+
+    void clear()
+    {
+      boost::mutex::scoped_lock l(mutex);
+      candidates.reset();
+    }
+  };
+
   class InitialState
   {
   public:
@@ -81,6 +147,44 @@ namespace menu
     typedef boost::function<void (const utf8_string &, success_command_t)> SuccessAction;
     typedef boost::function<void (void)> FailureAction;
     typedef boost::function<CompletionsPtr (const InputState &state)> Completer;
+
+    /* Lets a completer running on the completion thread show partial
+       results before it finishes.  A completer should periodically
+       check ready() and, if it returns true, post() completions for
+       what it has found so far, best first; each post replaces the
+       previous one.  ready() is rate limited, so building partial
+       results costs little overall. */
+    class PartialResultSink
+    {
+      boost::function<void (const CompletionsPtr &)> post_;
+      time_duration interval;
+      time_point next;
+    public:
+      /* Never ready */
+      PartialResultSink() {}
+      PartialResultSink(const boost::function<void (const CompletionsPtr &)> &post,
+                        time_duration interval)
+        : post_(post), interval(interval), next(time_point::current() + interval)
+      {}
+
+      bool ready() const
+      {
+        return post_ && !completion_cancelled() && !(time_point::current() < next);
+      }
+
+      void post(const CompletionsPtr &completions)
+      {
+        if (!post_ || !completions)
+          return;
+        post_(completions);
+        next = time_point::current() + interval;
+      }
+    };
+
+    /* A completer that may stream partial results.  Partial results
+       are only shown if the completer runs on the completion thread. */
+    typedef boost::function<CompletionsPtr (const InputState &state,
+                                            PartialResultSink &sink)> StreamingCompleter;
     
   private:
     
@@ -93,16 +197,27 @@ namespace menu
     bool use_delay;
     bool use_separate_thread;
 
+    /* Incremented on every input change; a completion job computes
+       the completions for one generation. */
+    uint64_t input_generation;
+
+    /* The running completion job, if any.  At most one runs at a time:
+       an input change or closing the menu cancels it, and a new job,
+       even for the next menu, is started only once it has returned. */
     class CompletionState
     {
     public:
       Menu &menu;
-      bool expired;
+      uint64_t generation;
       bool recompute;
-    
-      CompletionState(Menu &menu)
-        : menu(menu), expired(false), recompute(false)
+      boost::shared_ptr<std::atomic<bool> > cancelled;
+
+      CompletionState(Menu &menu, uint64_t generation)
+        : menu(menu), generation(generation), recompute(false),
+          cancelled(new std::atomic<bool>(false))
       {}
+
+      void cancel() { cancelled->store(true, std::memory_order_relaxed); }
     };
   
     boost::shared_ptr<CompletionState> completion_state;
@@ -119,8 +234,12 @@ namespace menu
 
     WRect current_window_bounds, current_completions_window_bounds;
 
+    /* Retained contents of xwin_ and completions_xwin_ */
+    WBackBuffer buffer, completions_buffer;
+
     bool scheduled_update_server;
     bool scheduled_draw;
+    bool scheduled_repaint;
 
     bool keyboard_grabbed;
 
@@ -130,10 +249,12 @@ namespace menu
     utf8_string prompt;
 
   
-    Completer completer;
+    StreamingCompleter completer;
     SuccessAction success_action;
     FailureAction failure_action;
 
+    /* bounds and completions_bounds are in root window coordinates;
+       the other rectangles are relative to xwin_. */
     WRect bounds, completions_bounds, input_rect, input_text_rect, prompt_rect, prompt_text_rect;
 
     // recompute input line and completion bounds
@@ -154,8 +275,14 @@ namespace menu
     void set_completions(const CompletionsPtr &);
     static void finished_updating_completions(const boost::weak_ptr<CompletionState> &completion_state,
                                               const CompletionsPtr &completions);
+    static void partial_completions(const boost::weak_ptr<CompletionState> &completion_state,
+                                    const CompletionsPtr &completions);
+    static void post_partial_completions(const boost::weak_ptr<CompletionState> &completion_state,
+                                         EventService &event_service,
+                                         const CompletionsPtr &completions);
     static void update_completions_separate_thread(const boost::weak_ptr<CompletionState> &completion_state,
-                                                   const Completer &completer,
+                                                   const boost::shared_ptr<std::atomic<bool> > &cancelled,
+                                                   const StreamingCompleter &completer,
                                                    const InputState &input,
                                                    EventService &event_service);
 
@@ -188,6 +315,14 @@ namespace menu
                      bool use_delay = true,
                      bool use_separate_thread = false);
 
+    bool read_string(const utf8_string &prompt,
+                     const InitialState &initial_state,
+                     const SuccessAction &success_action,
+                     const FailureAction &failure_action,
+                     const StreamingCompleter &completer,
+                     bool use_delay = true,
+                     bool use_separate_thread = false);
+
     void handle_expose(const XExposeEvent &ev);
     void handle_screen_size_changed();
     void handle_keypress(const XKeyEvent &ev);
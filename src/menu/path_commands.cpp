@@ -0,0 +1,329 @@
+
+#include <menu/path_commands.hpp>
+#include <util/dir_scan.hpp>
+#include <util/log.hpp>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/make_shared.hpp>
+#include <algorithm>
+#include <cstring>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+namespace menu
+{
+  namespace path_commands
+  {
+
+    static const uint32_t directory_watch_mask =
+      IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB
+      | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK;
+
+    /* Added to any watch the ancestor already has, which may be that
+       of another directory on the path. */
+    static const uint32_t parent_watch_mask =
+      IN_CREATE | IN_MOVED_TO | IN_ONLYDIR | IN_MASK_ADD;
+
+    std::string CommandIndex::Commands::resolve(const utf8_string &name) const
+    {
+      const std::vector<list_completion::Entry> &v = *entries;
+      std::vector<list_completion::Entry>::const_iterator it =
+        std::lower_bound(v.begin(), v.end(), name,
+                         [](const list_completion::Entry &e, const utf8_string &s)
+                         { return e.first < s; });
+      if (it == v.end() || it->first != name)
+        return std::string();
+      return dirs[dir_indices[it - v.begin()]] + "/" + name;
+    }
+
+    CommandIndex::CommandIndex(EventService &event_service, const std::string &search_path,
+                               const list_completion::EntryStyle &style)
+      : style(style),
+        inotify(event_service, boost::bind(&CommandIndex::handle_inotify, this, _1, _2, _3, _4)),
+        rescan_timer(event_service, boost::bind(&CommandIndex::rescan, this))
+    {
+      boost::shared_ptr<Commands> empty(new Commands);
+      empty->entries = boost::make_shared<const std::vector<list_completion::Entry> >();
+      commands_ = empty;
+
+      std::string::size_type pos = 0;
+      while (pos <= search_path.size())
+      {
+        std::string::size_type end = search_path.find(':', pos);
+        if (end == std::string::npos)
+          end = search_path.size();
+        std::string dir = search_path.substr(pos, end - pos);
+        pos = end + 1;
+        while (dir.size() > 1 && dir[dir.size() - 1] == '/')
+          dir.erase(dir.size() - 1);
+        if (dir.empty() || dir[0] != '/')
+          continue;
+        bool seen = false;
+        BOOST_FOREACH (const Directory &d, dirs)
+          seen = seen || d.path == dir;
+        if (seen)
+          continue;
+        Directory d;
+        d.path = dir;
+        d.wd = -1;
+        d.parent_wd = -1;
+        d.dirty = true;
+        dirs.push_back(d);
+        watch(dirs.back());
+      }
+
+      // Scanned from the event loop rather than delaying startup.
+      rescan_timer.wait_for(0, 0);
+    }
+
+    CommandIndex::~CommandIndex() {}
+
+    /* Watches d, or else the nearest existing ancestor of d, so that
+       d is rescanned once it is created. */
+    void CommandIndex::watch(Directory &d)
+    {
+      d.wd = inotify.add_watch(d.path.c_str(), directory_watch_mask, false);
+      if (d.wd >= 0)
+      {
+        release_parent_watch(d);
+        return;
+      }
+
+      int parent_wd = -1;
+      std::string parent = d.path;
+      while (parent_wd < 0 && parent.size() > 1)
+      {
+        std::string::size_type pos = parent.rfind('/');
+        parent.erase(pos == 0 ? 1 : pos);
+        parent_wd = inotify.add_watch(parent.c_str(), parent_watch_mask, false);
+      }
+      if (parent_wd != d.parent_wd)
+      {
+        release_parent_watch(d);
+        d.parent_wd = parent_wd;
+      }
+    }
+
+    void CommandIndex::release_parent_watch(Directory &d)
+    {
+      int wd = d.parent_wd;
+      if (wd < 0)
+        return;
+      d.parent_wd = -1;
+      BOOST_FOREACH (const Directory &other, dirs)
+        if (other.wd == wd || other.parent_wd == wd)
+          return;
+      inotify.rm_watch(wd);
+    }
+
+    CommandIndex::CommandsPtr CommandIndex::commands() const
+    {
+      boost::mutex::scoped_lock l(mutex);
+      return commands_;
+    }
+
+    void CommandIndex::handle_inotify(int wd, uint32_t mask, uint32_t cookie,
+                                      const char *name)
+    {
+      BOOST_FOREACH (Directory &d, dirs)
+      {
+        if (mask & IN_Q_OVERFLOW)
+          d.dirty = true;
+        else if (d.wd == wd)
+        {
+          d.dirty = true;
+          // The kernel has removed the watch; it is added again, if
+          // the directory is back, when rescanning.
+          if (mask & IN_IGNORED)
+            d.wd = -1;
+        } else if (d.parent_wd == wd)
+        {
+          // Something was created on the way to d.
+          d.dirty = true;
+          if (mask & IN_IGNORED)
+            d.parent_wd = -1;
+        }
+      }
+      // Waits for a burst of changes, such as a package install, to
+      // settle before rescanning.
+      rescan_timer.wait_for(0, 100000);
+    }
+
+    void CommandIndex::rescan()
+    {
+      bool changed = false;
+      BOOST_FOREACH (Directory &d, dirs)
+      {
+        if (!d.dirty)
+          continue;
+        d.dirty = false;
+        if (d.wd < 0)
+          watch(d);
+
+        std::vector<std::string> names;
+        std::string path = d.path + "/";
+        const size_t dir_length = path.size();
+        DirScanner scan(d.path.c_str());
+        while (scan.next())
+        {
+          if (scan.type() != 0 && scan.type() != S_IFREG && scan.type() != S_IFLNK)
+            continue;
+          path.resize(dir_length);
+          path.append(scan.name(), scan.name_length());
+          // Follows symbolic links, which most of /usr/bin may be.
+          struct stat st;
+          if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) && (st.st_mode & 0111))
+            names.push_back(std::string(scan.name(), scan.name_length()));
+        }
+        std::sort(names.begin(), names.end());
+        if (names != d.names)
+        {
+          d.names.swap(names);
+          changed = true;
+        }
+      }
+      if (!changed)
+        return;
+
+      // The first directory with a name shadows the later ones.
+      std::map<std::string, uint32_t> merged;
+      for (uint32_t i = 0; i < dirs.size(); ++i)
+        BOOST_FOREACH (const std::string &name, dirs[i].names)
+          merged.insert(std::make_pair(name, i));
+
+      boost::shared_ptr<Commands> c(new Commands);
+      boost::shared_ptr<std::vector<list_completion::Entry> > entries
+        (new std::vector<list_completion::Entry>);
+      entries->reserve(merged.size());
+      c->masks.reserve(merged.size());
+      c->dir_indices.reserve(merged.size());
+      for (std::map<std::string, uint32_t>::const_iterator it = merged.begin();
+           it != merged.end(); ++it)
+      {
+        entries->push_back(list_completion::Entry(it->first, &style));
+        c->masks.push_back(fuzzy::char_mask(it->first));
+        c->dir_indices.push_back(it->second);
+      }
+      c->entries = entries;
+      BOOST_FOREACH (const Directory &d, dirs)
+        c->dirs.push_back(d.path);
+
+      boost::mutex::scoped_lock l(mutex);
+      commands_ = c;
+    }
+
+    bool is_simple_command(const utf8_string &command)
+    {
+      // Everything that quotes, expands, redirects, separates commands
+      // or assigns variables; '=' and '~' only matter at the start of
+      // a word, but are rare elsewhere.
+      static const char special[] = "|&;<>()$`\\\"'*?[]{}#~=!\t\n";
+      return command.find_first_not_of(' ') != utf8_string::npos
+        && command.find_first_of(special, 0, sizeof(special) - 1) == utf8_string::npos;
+    }
+
+    static void apply_command_completion(InputState &state, const utf8_string &completion)
+    {
+      utf8_string::size_type end = state.text.find(' ');
+      state.text = completion
+        + (end == utf8_string::npos ? utf8_string() : state.text.substr(end));
+      state.cursor_position = completion.size();
+    }
+
+    static void command_highlight(const boost::shared_ptr<const fuzzy::Pattern> &pattern,
+                                  const utf8_string &str,
+                                  std::vector<std::pair<uint32_t, uint32_t> > &ranges)
+    {
+      int score;
+      fuzzy::match(*pattern, str, score, &ranges);
+    }
+
+    class CommandCompleter
+    {
+      CommandIndex::CommandsPtr commands;
+      Frecency::RankingPtr ranking;
+      boost::shared_ptr<CandidateCache> cache;
+    public:
+      CommandCompleter(const CommandIndex &index, const Frecency::RankingPtr &ranking)
+        : commands(index.commands()),
+          ranking(ranking && !ranking->empty() ? ranking : Frecency::RankingPtr()),
+          cache(boost::make_shared<CandidateCache>())
+      {}
+
+      Menu::CompletionsPtr operator()(const InputState &state) const
+      {
+        // Only the command itself is completed.
+        if (state.text.find(' ') != utf8_string::npos
+            || state.cursor_position != state.text.size())
+          return Menu::CompletionsPtr();
+
+        boost::shared_ptr<const fuzzy::Pattern> pattern(new fuzzy::Pattern(state.text));
+        const std::vector<list_completion::Entry> &v = *commands->entries;
+        const std::vector<fuzzy::CharMask> &m = commands->masks;
+
+        struct Scored
+        {
+          int score;
+          uint32_t length, index;
+          bool operator<(const Scored &x) const
+          {
+            if (score != x.score)
+              return score > x.score;
+            if (length != x.length)
+              return length < x.length;
+            return index < x.index;
+          }
+        };
+
+        CandidateCache::Candidates previous = cache->take(state.text);
+        std::vector<uint32_t> all, matched;
+        if (!previous)
+        {
+          all.resize(v.size());
+          for (uint32_t i = 0; i < all.size(); ++i)
+            all[i] = i;
+        }
+        const std::vector<uint32_t> &candidates = previous ? *previous : all;
+
+        std::vector<Scored> scored;
+        for (size_t j = 0; j < candidates.size(); ++j)
+        {
+          if ((j & 1023) == 0 && completion_cancelled())
+            return Menu::CompletionsPtr();
+          const uint32_t i = candidates[j];
+          int score;
+          if (pattern->may_match(m[i]) && fuzzy::match(*pattern, v[i].first, score))
+          {
+            if (ranking)
+              score += ranking->bonus(v[i].first);
+            Scored s = { score, uint32_t(v[i].first.size()), i };
+            scored.push_back(s);
+            matched.push_back(i);
+          }
+        }
+
+        if (!pattern->empty())
+          cache->store(state.text, std::move(matched));
+
+        std::sort(scored.begin(), scored.end());
+        std::vector<uint32_t> indices;
+        indices.reserve(scored.size());
+        BOOST_FOREACH (const Scored &s, scored)
+          indices.push_back(s.index);
+
+        list_completion::Highlighter highlighter;
+        if (!pattern->empty())
+          highlighter = boost::bind(&command_highlight, pattern, _1, _2);
+        return list_completion::completion_list(state, commands->entries, std::move(indices),
+                                                apply_command_completion, false, highlighter);
+      }
+    };
+
+    Menu::Completer command_completer(const CommandIndex &index,
+                                      const Frecency::RankingPtr &ranking)
+    {
+      return CommandCompleter(index, ranking);
+    }
+
+  } // namespace menu::path_commands
+} // namespace menu
@@ -0,0 +1,92 @@
+#ifndef _MENU_PATH_COMMANDS_HPP
+#define _MENU_PATH_COMMANDS_HPP
+
+#include <menu/menu.hpp>
+#include <menu/frecency.hpp>
+#include <menu/fuzzy_match.hpp>
+#include <menu/list_completion.hpp>
+#include <util/event.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <vector>
+
+namespace menu
+{
+  namespace path_commands
+  {
+
+    /* The executables found on a search path, by name, the first of a
+       name shadowing the rest as for execvp.  Each directory is
+       watched with inotify, and rescanned shortly after an entry is
+       created, removed, renamed or has its permissions changed.  A
+       directory that does not exist is waited for by watching its
+       nearest existing ancestor.  Scanning is done on the event thread; commands() may be called
+       from any thread. */
+    class CommandIndex
+    {
+    public:
+      struct Commands
+      {
+        // Sorted by name
+        list_completion::EntryList entries;
+        std::vector<fuzzy::CharMask> masks;
+        // Index into dirs of the directory of each entry
+        std::vector<uint32_t> dir_indices;
+        std::vector<std::string> dirs;
+
+        /* The absolute path of the command name, or an empty string
+           if it is not on the path. */
+        std::string resolve(const utf8_string &name) const;
+      };
+      typedef boost::shared_ptr<const Commands> CommandsPtr;
+
+      /* search_path is colon-separated, as $PATH; relative and empty
+         elements are ignored. */
+      CommandIndex(EventService &event_service, const std::string &search_path,
+                   const list_completion::EntryStyle &style);
+      ~CommandIndex();
+
+      CommandsPtr commands() const;
+
+    private:
+      struct Directory
+      {
+        std::string path;
+        int wd;
+        // While wd < 0, the watch on the nearest existing ancestor
+        int parent_wd;
+        bool dirty;
+        // Executable names, sorted
+        std::vector<std::string> names;
+      };
+      std::vector<Directory> dirs;
+      const list_completion::EntryStyle &style;
+
+      mutable boost::mutex mutex;
+      CommandsPtr commands_;
+
+      InotifyEvent inotify;
+      TimerEvent rescan_timer;
+
+      void watch(Directory &d);
+      void release_parent_watch(Directory &d);
+      void handle_inotify(int wd, uint32_t mask, uint32_t cookie, const char *name);
+      void rescan();
+    };
+
+    /* True if command is a plain list of words that /bin/sh would
+       pass as they are, so that it may be run without the shell. */
+    bool is_simple_command(const utf8_string &command);
+
+    /* Completes the first word of a command line by fuzzy match against
+       the commands on the path, plus the bonus from ranking.  Nothing
+       is completed after the first word. */
+    Menu::Completer command_completer(const CommandIndex &index,
+                                      const Frecency::RankingPtr &ranking
+                                      = Frecency::RankingPtr());
+
+  } // namespace menu::path_commands
+} // namespace menu
+
+#endif /* _MENU_PATH_COMMANDS_HPP */
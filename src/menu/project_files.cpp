@@ -0,0 +1,664 @@
+
+#include <menu/project_files.hpp>
+#include <util/dir_scan.hpp>
+#include <util/log.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/make_shared.hpp>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <fnmatch.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+namespace menu
+{
+  namespace project_files
+  {
+
+    struct IgnoreRule
+    {
+      std::string pattern;
+      bool negate;
+      bool dir_only;
+      // Matched against the path below the ignore file's directory,
+      // rather than against the file name
+      bool anchored;
+    };
+
+    struct IgnoreRules
+    {
+      IgnoreRulesPtr parent;
+      // Directory of the ignore file relative to the root, "" or
+      // ending in '/'
+      std::string base;
+      std::vector<IgnoreRule> rules;
+    };
+
+    static void read_ignore_file(const std::string &filename,
+                                 std::vector<IgnoreRule> &rules)
+    {
+      std::ifstream in(filename.c_str());
+      std::string line;
+      while (std::getline(in, line))
+      {
+        while (!line.empty() && (line.back() == ' ' || line.back() == '\t'
+                                 || line.back() == '\r'))
+          line.pop_back();
+        if (line.empty() || line[0] == '#')
+          continue;
+
+        IgnoreRule r;
+        r.negate = false;
+        r.dir_only = false;
+        r.anchored = false;
+        if (line[0] == '!')
+        {
+          r.negate = true;
+          line.erase(0, 1);
+        } else if (line[0] == '\\')
+          line.erase(0, 1);
+        if (!line.empty() && line.back() == '/')
+        {
+          r.dir_only = true;
+          line.pop_back();
+        }
+        if (boost::algorithm::starts_with(line, "**/"))
+          line.erase(0, 3);
+        else if (line.find('/') != std::string::npos)
+        {
+          r.anchored = true;
+          if (line[0] == '/')
+            line.erase(0, 1);
+        }
+        if (line.empty())
+          continue;
+        r.pattern = line;
+        rules.push_back(r);
+      }
+    }
+
+    /* path is relative to the root, and its file name starts at
+       name_pos.  As in git, the last matching rule of the innermost
+       ignore file decides. */
+    static bool is_ignored(const IgnoreRules *rules, const std::string &path,
+                           size_t name_pos, bool is_dir)
+    {
+      for (; rules; rules = rules->parent.get())
+      {
+        for (std::vector<IgnoreRule>::const_reverse_iterator it = rules->rules.rbegin();
+             it != rules->rules.rend(); ++it)
+        {
+          if (it->dir_only && !is_dir)
+            continue;
+          bool matched;
+          if (it->anchored)
+            matched = fnmatch(it->pattern.c_str(), path.c_str() + rules->base.size(),
+                              FNM_PATHNAME) == 0;
+          else
+            matched = fnmatch(it->pattern.c_str(), path.c_str() + name_pos, 0) == 0;
+          if (matched)
+            return !it->negate;
+        }
+      }
+      return false;
+    }
+
+    static bool is_vcs_directory(const char *name)
+    {
+      return !strcmp(name, ".git") || !strcmp(name, ".hg") || !strcmp(name, ".svn")
+        || !strcmp(name, ".bzr");
+    }
+
+    static const uint32_t project_watch_mask =
+      IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+      | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+    // Entries per published chunk
+    static const size_t chunk_size = 1024;
+
+    ProjectIndex::ProjectIndex(const std::string &root, ThreadPool &pool,
+                               EventService &event_service, const Limits &limits)
+      : root_(root), pool(pool), limits(limits), generation(0),
+        removed_count(0), file_count(0), truncated(false), outstanding(0), stopping(false),
+        inotify(event_service, boost::bind(&ProjectIndex::handle_inotify, this, _1, _2, _3, _4)),
+        publish_timer(event_service, boost::bind(&ProjectIndex::handle_publish_timer, this)),
+        publish_scheduled(false)
+    {
+      boost::mutex::scoped_lock l(mutex);
+      start_walk("", 0, IgnoreRulesPtr());
+    }
+
+    ProjectIndex::~ProjectIndex()
+    {
+      boost::mutex::scoped_lock l(mutex);
+      stopping = true;
+      while (outstanding)
+        changed.wait(l);
+    }
+
+    // Called with the mutex held.
+    void ProjectIndex::start_walk(const std::string &dir, size_t depth,
+                                  const IgnoreRulesPtr &parent_rules)
+    {
+      ++outstanding;
+      pool.post(boost::bind(&ProjectIndex::walk, this, dir, depth, parent_rules));
+    }
+
+    void ProjectIndex::walk(const std::string &dir, size_t depth,
+                            const IgnoreRulesPtr &parent_rules)
+    {
+      bool stop;
+      {
+        boost::mutex::scoped_lock l(mutex);
+        stop = stopping;
+      }
+
+      IgnoreRulesPtr rules = parent_rules;
+      std::vector<std::string> files, subdirs;
+      int wd = -1;
+      if (!stop)
+      {
+        const std::string full = root_ + "/" + dir;
+
+        // Watched before reading, so that no change goes unnoticed.
+        wd = inotify.add_watch(full.c_str(), project_watch_mask, false);
+
+        boost::shared_ptr<IgnoreRules> own(new IgnoreRules);
+        own->parent = parent_rules;
+        own->base = dir;
+        read_ignore_file(full + ".gitignore", own->rules);
+        read_ignore_file(full + ".ignore", own->rules);
+        if (!own->rules.empty())
+          rules = own;
+
+        // Registered before scanning, so that files created during the
+        // scan are added from their events.
+        if (wd >= 0)
+        {
+          boost::mutex::scoped_lock l(mutex);
+          if (!stopping)
+          {
+            Directory d = { wd, depth, rules };
+            directories[dir] = d;
+            watches[wd] = dir;
+          }
+        }
+
+        DirScanner scan(full.c_str());
+        while (scan.next())
+        {
+          mode_t type = scan.type();
+          if (type == 0)
+            type = scan.stat_mode(scan.name()) & S_IFMT;
+          const bool is_dir = S_ISDIR(type);
+          if (is_dir && is_vcs_directory(scan.name()))
+            continue;
+          std::string path = dir;
+          path.append(scan.name(), scan.name_length());
+          if (is_ignored(rules.get(), path, dir.size(), is_dir))
+            continue;
+          // Symbolic links are indexed, but not followed.
+          if (!is_dir)
+            files.push_back(path);
+          else if (depth < limits.max_depth)
+            subdirs.push_back(path + '/');
+        }
+      }
+
+      boost::mutex::scoped_lock l(mutex);
+      if (!stopping && !stop)
+      {
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+          // Possibly already added on an inotify event
+          if (!contains(files[i]))
+            add_file(files[i]);
+        }
+        for (size_t i = 0; i < subdirs.size(); ++i)
+          start_walk(subdirs[i], depth + 1, rules);
+      }
+      if (--outstanding == 0 || pending.size() >= chunk_size)
+        publish();
+      if (outstanding == 0)
+        changed.notify_all();
+    }
+
+    // Called with the mutex held.
+    bool ProjectIndex::contains(const std::string &path) const
+    {
+      return paths.count(boost::string_ref(path)) || pending_paths.count(path);
+    }
+
+    // Called with the mutex held.
+    void ProjectIndex::add_file(const std::string &path)
+    {
+      if (file_count >= limits.max_files)
+      {
+        if (!truncated)
+          WARN("%s: indexing only the first %zu files", root_.c_str(), limits.max_files);
+        truncated = true;
+        return;
+      }
+      ++file_count;
+      pending.push_back(Entry(path));
+      pending_paths.insert(path);
+    }
+
+    // Called with the mutex held, on the event loop's thread.  Files
+    // created while the walk is not running are published together,
+    // after a short wait or once there are a chunk's worth.
+    void ProjectIndex::schedule_publish()
+    {
+      if (pending.size() >= chunk_size)
+        publish();
+      else if (!pending.empty() && !publish_scheduled)
+      {
+        publish_scheduled = true;
+        publish_timer.wait_for(0, 20000);
+      }
+    }
+
+    void ProjectIndex::handle_publish_timer()
+    {
+      boost::mutex::scoped_lock l(mutex);
+      publish_scheduled = false;
+      publish();
+    }
+
+    // Called with the mutex held.
+    void ProjectIndex::publish()
+    {
+      if (pending.empty())
+        return;
+      // Files removed before being published are left out.
+      boost::shared_ptr<Chunk> chunk(new Chunk);
+      chunk->reserve(pending.size());
+      for (Chunk::iterator it = pending.begin(); it != pending.end(); ++it)
+        if (!it->removed())
+          chunk->push_back(std::move(*it));
+      pending.clear();
+      pending_paths.clear();
+      if (chunk->empty())
+        return;
+      chunks.push_back(chunk);
+      for (Chunk::const_iterator it = chunk->begin(); it != chunk->end(); ++it)
+        paths[boost::string_ref(it->path)] = &*it;
+      changed.notify_all();
+    }
+
+    // Called with the mutex held.
+    void ProjectIndex::remove_file(const std::string &path)
+    {
+      std::map<boost::string_ref, const Entry *>::iterator it
+        = paths.find(boost::string_ref(path));
+      if (it != paths.end())
+      {
+        it->second->removed_.store(true, std::memory_order_relaxed);
+        --file_count;
+        ++removed_count;
+        paths.erase(it);
+      }
+      else if (pending_paths.erase(path))
+      {
+        for (Chunk::iterator e = pending.begin(); e != pending.end(); ++e)
+          if (e->path == path && !e->removed())
+          {
+            e->removed_.store(true, std::memory_order_relaxed);
+            break;
+          }
+        --file_count;
+      }
+    }
+
+    // Called with the mutex held.  path ends in '/'.
+    void ProjectIndex::remove_below(const std::string &path)
+    {
+      std::map<boost::string_ref, const Entry *>::iterator it
+        = paths.lower_bound(boost::string_ref(path));
+      while (it != paths.end() && it->first.starts_with(path))
+      {
+        it->second->removed_.store(true, std::memory_order_relaxed);
+        --file_count;
+        ++removed_count;
+        paths.erase(it++);
+      }
+      for (Chunk::iterator e = pending.begin(); e != pending.end(); ++e)
+      {
+        if (!e->removed() && boost::algorithm::starts_with(e->path, path))
+        {
+          e->removed_.store(true, std::memory_order_relaxed);
+          pending_paths.erase(e->path);
+          --file_count;
+        }
+      }
+
+      std::map<std::string, Directory>::iterator d = directories.lower_bound(path);
+      while (d != directories.end() && boost::algorithm::starts_with(d->first, path))
+      {
+        inotify.rm_watch(d->second.wd);
+        watches.erase(d->second.wd);
+        directories.erase(d++);
+      }
+    }
+
+    // Called with the mutex held.  Entries are marked removed rather
+    // than dropped, as readers index the chunks by position, until
+    // they outnumber the live ones; then the chunks are rebuilt, and
+    // readers that see the new generation start over.
+    void ProjectIndex::compact()
+    {
+      if (removed_count < chunk_size || removed_count < paths.size())
+        return;
+
+      std::vector<ChunkPtr> rebuilt;
+      boost::shared_ptr<Chunk> chunk;
+      for (std::map<boost::string_ref, const Entry *>::const_iterator it = paths.begin();
+           it != paths.end(); ++it)
+      {
+        if (!chunk)
+        {
+          chunk.reset(new Chunk);
+          chunk->reserve(chunk_size);
+        }
+        chunk->push_back(*it->second);
+        if (chunk->size() == chunk_size)
+        {
+          rebuilt.push_back(chunk);
+          chunk.reset();
+        }
+      }
+      if (chunk)
+        rebuilt.push_back(chunk);
+
+      paths.clear();
+      for (std::vector<ChunkPtr>::const_iterator c = rebuilt.begin(); c != rebuilt.end(); ++c)
+        for (Chunk::const_iterator it = (*c)->begin(); it != (*c)->end(); ++it)
+          paths[boost::string_ref(it->path)] = &*it;
+      chunks.swap(rebuilt);
+      removed_count = 0;
+      ++generation;
+      changed.notify_all();
+    }
+
+    // Called with the mutex held.  Everything is dropped and found
+    // again.
+    void ProjectIndex::rescan()
+    {
+      WARN("%s: inotify queue overflow, rescanning", root_.c_str());
+      for (std::map<boost::string_ref, const Entry *>::iterator it = paths.begin();
+           it != paths.end(); ++it)
+        it->second->removed_.store(true, std::memory_order_relaxed);
+      paths.clear();
+      pending.clear();
+      pending_paths.clear();
+      chunks.clear();
+      removed_count = 0;
+      ++generation;
+      changed.notify_all();
+      for (std::map<int, std::string>::iterator it = watches.begin(); it != watches.end(); ++it)
+        inotify.rm_watch(it->first);
+      watches.clear();
+      directories.clear();
+      file_count = 0;
+      truncated = false;
+      start_walk("", 0, IgnoreRulesPtr());
+    }
+
+    void ProjectIndex::handle_inotify(int wd, uint32_t mask, uint32_t cookie,
+                                      const char *name)
+    {
+      boost::mutex::scoped_lock l(mutex);
+      if (stopping)
+        return;
+
+      if (mask & IN_Q_OVERFLOW)
+      {
+        rescan();
+        return;
+      }
+
+      std::map<int, std::string>::iterator w = watches.find(wd);
+      if (w == watches.end())
+        return;
+      const std::string dir = w->second;
+      if (mask & IN_IGNORED)
+      {
+        directories.erase(dir);
+        watches.erase(w);
+        return;
+      }
+      if (!name || !*name)
+        return;
+
+      const Directory d = directories[dir];
+      const std::string path = dir + name;
+      const bool is_dir = mask & IN_ISDIR;
+
+      if (mask & (IN_DELETE | IN_MOVED_FROM))
+      {
+        if (is_dir)
+          remove_below(path + '/');
+        else
+          remove_file(path);
+        compact();
+      } else if (mask & (IN_CREATE | IN_MOVED_TO))
+      {
+        if (is_dir && is_vcs_directory(name))
+          return;
+        if (is_ignored(d.rules.get(), path, dir.size(), is_dir))
+          return;
+        if (is_dir)
+        {
+          if (d.depth < limits.max_depth)
+            start_walk(path + '/', d.depth + 1, d.rules);
+        } else if (!contains(path))
+        {
+          add_file(path);
+          schedule_publish();
+        }
+      }
+    }
+
+    ProjectIndex::Snapshot ProjectIndex::snapshot() const
+    {
+      boost::mutex::scoped_lock l(mutex);
+      Snapshot s;
+      s.chunks = chunks;
+      s.generation = generation;
+      s.complete = outstanding == 0;
+      return s;
+    }
+
+    void ProjectIndex::wait_for_change(size_t known_chunks, unsigned long known_generation,
+                                       long timeout_ms) const
+    {
+      boost::mutex::scoped_lock l(mutex);
+      if (chunks.size() > known_chunks || generation != known_generation || outstanding == 0)
+        return;
+      changed.timed_wait(l, boost::posix_time::milliseconds(timeout_ms));
+    }
+
+    IndexSet::IndexSet(EventService &event_service, size_t max_indices,
+                       const Limits &limits)
+      : event_service(event_service), limits(limits), max_indices(max_indices)
+    {}
+
+    IndexSet::~IndexSet() {}
+
+    boost::shared_ptr<ProjectIndex> IndexSet::get(const std::string &root)
+    {
+      boost::shared_ptr<ProjectIndex> index;
+      for (std::list<boost::shared_ptr<ProjectIndex> >::iterator it = indices.begin();
+           it != indices.end(); ++it)
+      {
+        if ((*it)->root() == root)
+        {
+          indices.splice(indices.begin(), indices, it);
+          index = indices.front();
+          break;
+        }
+      }
+
+      if (!index)
+      {
+        index = boost::make_shared<ProjectIndex>(root, boost::ref(pool),
+                                                 boost::ref(event_service), limits);
+        indices.push_front(index);
+        if (indices.size() > max_indices)
+        {
+          retired.push_back(indices.back());
+          indices.pop_back();
+        }
+      }
+
+      for (std::list<boost::shared_ptr<ProjectIndex> >::iterator it = retired.begin();
+           it != retired.end();)
+      {
+        if (it->use_count() == 1)
+          it = retired.erase(it);
+        else
+          ++it;
+      }
+      return index;
+    }
+
+    std::string find_project_root(const std::string &dir)
+    {
+      static const char *const markers[] = { ".git", ".hg", ".svn" };
+      for (boost::filesystem::path p(dir); !p.empty(); p = p.parent_path())
+      {
+        for (size_t i = 0; i < sizeof(markers) / sizeof(markers[0]); ++i)
+        {
+          struct stat st;
+          if (lstat((p / markers[i]).string().c_str(), &st) == 0)
+            return p.string();
+        }
+      }
+      return dir;
+    }
+
+    namespace
+    {
+      struct Scored
+      {
+        int score;
+        uint32_t length;
+        const ProjectIndex::Entry *entry;
+        bool operator<(const Scored &x) const
+        {
+          if (score != x.score)
+            return score > x.score;
+          if (length != x.length)
+            return length < x.length;
+          return entry->path < x.entry->path;
+        }
+      };
+    }
+
+    // Only the best are listed; more are never looked at.
+    static const size_t max_results = 1000;
+
+    static void project_file_highlight(const boost::shared_ptr<const fuzzy::Pattern> &pattern,
+                                       const utf8_string &str,
+                                       std::vector<std::pair<uint32_t, uint32_t> > &ranges)
+    {
+      int score;
+      fuzzy::match(*pattern, str, score, &ranges);
+    }
+
+    static Menu::CompletionsPtr make_completions(const InputState &state,
+                                                 std::vector<Scored> &scored,
+                                                 const boost::shared_ptr<const fuzzy::Pattern> &pattern,
+                                                 const list_completion::EntryStyle &style)
+    {
+      const size_t n = std::min(scored.size(), max_results);
+      std::partial_sort(scored.begin(), scored.begin() + n, scored.end());
+
+      boost::shared_ptr<std::vector<list_completion::Entry> > list
+        (new std::vector<list_completion::Entry>);
+      list->reserve(n);
+      std::vector<uint32_t> indices(n);
+      for (size_t i = 0; i < n; ++i)
+      {
+        list->push_back(list_completion::Entry(scored[i].entry->path, &style));
+        indices[i] = i;
+      }
+
+      list_completion::Highlighter highlighter;
+      if (!pattern->empty())
+        highlighter = boost::bind(&project_file_highlight, pattern, _1, _2);
+      return list_completion::completion_list(state, list, std::move(indices),
+                                              list_completion::apply_completion_simple,
+                                              false, highlighter);
+    }
+
+    static Menu::CompletionsPtr project_file_completions(const boost::shared_ptr<ProjectIndex> &index,
+                                                         const list_completion::EntryStyle &style,
+                                                         const Frecency::RankingPtr &ranking,
+                                                         const InputState &state,
+                                                         Menu::PartialResultSink &sink)
+    {
+      boost::shared_ptr<const fuzzy::Pattern> pattern(new fuzzy::Pattern(state.text));
+      std::vector<ProjectIndex::ChunkPtr> scanned;
+      unsigned long generation = 0;
+      std::vector<Scored> scored;
+      size_t count = 0;
+      const Frecency::Ranking *rank = ranking && !ranking->empty() ? ranking.get() : 0;
+
+      // Chunks are only appended within a generation, so each pass
+      // scores just the chunks published since the last.
+      for (;;)
+      {
+        ProjectIndex::Snapshot snapshot = index->snapshot();
+        if (snapshot.generation != generation)
+        {
+          scored.clear();
+          scanned.clear();
+          generation = snapshot.generation;
+        }
+        for (size_t c = scanned.size(); c < snapshot.chunks.size(); ++c)
+        {
+          const ProjectIndex::Chunk &chunk = *snapshot.chunks[c];
+          for (ProjectIndex::Chunk::const_iterator it = chunk.begin(); it != chunk.end(); ++it)
+          {
+            if ((++count & 1023) == 0 && completion_cancelled())
+              return Menu::CompletionsPtr();
+            int score;
+            if (!it->removed() && pattern->may_match(it->mask)
+                && fuzzy::match(*pattern, it->path, score))
+            {
+              if (rank)
+                score += rank->bonus(it->path);
+              Scored s = { score, uint32_t(it->path.size()), &*it };
+              scored.push_back(s);
+            }
+          }
+          scanned.push_back(snapshot.chunks[c]);
+        }
+
+        if (snapshot.complete)
+          break;
+
+        if (sink.ready())
+          sink.post(make_completions(state, scored, pattern, style));
+        index->wait_for_change(scanned.size(), generation, 50);
+        if (completion_cancelled())
+          return Menu::CompletionsPtr();
+      }
+
+      return make_completions(state, scored, pattern, style);
+    }
+
+    Menu::StreamingCompleter project_file_completer(const boost::shared_ptr<ProjectIndex> &index,
+                                                    const list_completion::EntryStyle &style,
+                                                    const Frecency::RankingPtr &ranking)
+    {
+      return boost::bind(&project_file_completions, index, boost::cref(style), ranking, _1, _2);
+    }
+
+  } // namespace menu::project_files
+} // namespace menu
@@ -0,0 +1,188 @@
+#ifndef _MENU_PROJECT_FILES_HPP
+#define _MENU_PROJECT_FILES_HPP
+
+#include <menu/menu.hpp>
+#include <menu/fuzzy_match.hpp>
+#include <menu/list_completion.hpp>
+#include <util/event.hpp>
+#include <util/thread_pool.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_set.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <atomic>
+#include <list>
+#include <map>
+#include <vector>
+
+namespace menu
+{
+  namespace project_files
+  {
+
+    struct Limits
+    {
+      // Directories deeper than this below the root are not walked.
+      size_t max_depth;
+      // Files beyond this many are left out of the index.
+      size_t max_files;
+      Limits() : max_depth(16), max_files(250000) {}
+    };
+
+    struct IgnoreRules;
+    typedef boost::shared_ptr<const IgnoreRules> IgnoreRulesPtr;
+
+    /* The files below a root directory, found by walking it in
+       parallel on a thread pool and kept up to date with inotify.
+       Patterns in .gitignore and .ignore files exclude paths as git
+       would, except that `**' is only understood at the start of a
+       pattern; version control directories are always skipped.
+
+       Entries are published in immutable chunks as the walk proceeds,
+       so readers on other threads never wait for the walk.  Removed
+       files are marked as such, and once most published entries are
+       removed the chunks are rebuilt from the live ones, which starts
+       a new generation.  Created on, and destroyed on, the event
+       loop's thread. */
+    class ProjectIndex
+    {
+    public:
+      class Entry
+      {
+        friend class ProjectIndex;
+        mutable std::atomic<bool> removed_;
+      public:
+        // Relative to the root
+        utf8_string path;
+        fuzzy::CharMask mask;
+
+        explicit Entry(const utf8_string &path)
+          : removed_(false), path(path), mask(fuzzy::char_mask(path))
+        {}
+        Entry(const Entry &e)
+          : removed_(e.removed()), path(e.path), mask(e.mask)
+        {}
+        Entry(Entry &&e) noexcept
+          : removed_(e.removed()), path(std::move(e.path)), mask(e.mask)
+        {}
+
+        bool removed() const { return removed_.load(std::memory_order_relaxed); }
+      };
+      typedef std::vector<Entry> Chunk;
+      typedef boost::shared_ptr<const Chunk> ChunkPtr;
+
+      struct Snapshot
+      {
+        std::vector<ChunkPtr> chunks;
+        // Chunks are only appended within a generation.
+        unsigned long generation;
+        bool complete;
+      };
+
+    private:
+      const std::string root_;
+      ThreadPool &pool;
+      const Limits limits;
+
+      mutable boost::mutex mutex;
+      mutable boost::condition_variable changed;
+      std::vector<ChunkPtr> chunks;
+      unsigned long generation;
+      Chunk pending;
+      boost::unordered_set<std::string> pending_paths;
+      // Live published entries, keyed by the path stored in the entry
+      std::map<boost::string_ref, const Entry *> paths;
+      // Published entries marked removed
+      size_t removed_count;
+      size_t file_count;
+      bool truncated;
+      // Walk tasks queued or running
+      size_t outstanding;
+      bool stopping;
+
+      struct Directory
+      {
+        int wd;
+        size_t depth;
+        IgnoreRulesPtr rules;
+      };
+      // Keyed by path relative to the root, with a trailing '/' except
+      // for the root itself, ""
+      std::map<std::string, Directory> directories;
+      std::map<int, std::string> watches;
+
+      InotifyEvent inotify;
+      TimerEvent publish_timer;
+      bool publish_scheduled;
+
+      void start_walk(const std::string &dir, size_t depth, const IgnoreRulesPtr &parent_rules);
+      void walk(const std::string &dir, size_t depth, const IgnoreRulesPtr &parent_rules);
+      bool contains(const std::string &path) const;
+      void add_file(const std::string &path);
+      void schedule_publish();
+      void handle_publish_timer();
+      void publish();
+      void remove_file(const std::string &path);
+      void remove_below(const std::string &path);
+      void compact();
+      void rescan();
+      void handle_inotify(int wd, uint32_t mask, uint32_t cookie, const char *name);
+
+      ProjectIndex(const ProjectIndex &);
+      ProjectIndex &operator=(const ProjectIndex &);
+
+    public:
+      ProjectIndex(const std::string &root, ThreadPool &pool,
+                   EventService &event_service, const Limits &limits = Limits());
+      ~ProjectIndex();
+
+      const std::string &root() const { return root_; }
+
+      Snapshot snapshot() const;
+
+      /* Waits until more than known_chunks chunks are published, a
+         generation other than known_generation starts or the walk
+         completes, or at most timeout_ms milliseconds. */
+      void wait_for_change(size_t known_chunks, unsigned long known_generation,
+                           long timeout_ms) const;
+    };
+
+    /* Indexes of the most recently used roots, sharing one thread
+       pool.  For use on the event loop's thread. */
+    class IndexSet
+    {
+      EventService &event_service;
+      ThreadPool pool;
+      const Limits limits;
+      const size_t max_indices;
+      // Most recently used first
+      std::list<boost::shared_ptr<ProjectIndex> > indices;
+      // Evicted, but possibly still used by a completion; destroyed
+      // here once that is over.
+      std::list<boost::shared_ptr<ProjectIndex> > retired;
+
+    public:
+      IndexSet(EventService &event_service, size_t max_indices = 4,
+               const Limits &limits = Limits());
+      ~IndexSet();
+
+      boost::shared_ptr<ProjectIndex> get(const std::string &root);
+    };
+
+    /* The nearest directory containing dir, or dir itself, with a
+       .git, .hg or .svn entry; dir if there is none. */
+    std::string find_project_root(const std::string &dir);
+
+    /* Fuzzy-matches the whole path relative to the root, best first.
+       While the index is still being built, results stream in as it
+       grows.  The bonus from a ranking is added to the match score. */
+    Menu::StreamingCompleter project_file_completer(const boost::shared_ptr<ProjectIndex> &index,
+                                                    const list_completion::EntryStyle &style,
+                                                    const Frecency::RankingPtr &ranking
+                                                    = Frecency::RankingPtr());
+
+  } // namespace menu::project_files
+} // namespace menu
+
+#endif /* _MENU_PROJECT_FILES_HPP */
@@ -4,7 +4,9 @@
 #include <map>
 #include <vector>
 #include <stack>
+#include <deque>
 #include <boost/variant.hpp>
+#include <boost/unordered_map.hpp>
 
 #include <util/string.hpp>
 
@@ -29,24 +31,82 @@ namespace style
   {
   public:
     StyleSpecData()
-      : context(0), parent(0)
+      : context(0), parent(0), index(0)
     {}
     StyleSpecData(const StyleSpecData *context, const StyleSpecData *parent)
-      : context(context), parent(parent)
+      : context(context), parent(parent), index(0)
     {}
     const StyleSpecData *context;
     const StyleSpecData *parent;
+    mutable uint32_t index;   // of its compiled row
     typedef std::map<ascii_string, StyleEntryValue> PropertyMap;
     PropertyMap properties;
   };
 
+  /* Every identifier that has been made a Key. */
+  class KeyTable
+  {
+  public:
+    boost::unordered_map<ascii_string, uint32_t> ids;
+    std::deque<ascii_string> names;
+  };
+
+  static KeyTable &key_table()
+  {
+    static KeyTable table;
+    return table;
+  }
+
+  Key::Key(const ascii_string &identifier)
+  {
+    KeyTable &t = key_table();
+    boost::unordered_map<ascii_string, uint32_t>::const_iterator it = t.ids.find(identifier);
+    if (it != t.ids.end())
+    {
+      id_ = it->second;
+      return;
+    }
+    id_ = t.names.size();
+    t.ids.insert(std::make_pair(identifier, id_));
+    t.names.push_back(identifier);
+  }
+
+  const ascii_string &Key::name() const
+  {
+    return key_table().names[id_];
+  }
+
   class DBState
   {
   public:
 
+    DBState() { compile(); }
+
     StyleSpecData root;
     void load(const boost::filesystem::path &path);
 
+    /* After loading, every spec is compiled to a row of a dense table
+       indexed by Key id, holding the index of its value, or 0 if it is
+       undefined, with the entries of its parents filled in. */
+    class CompiledValue
+    {
+    public:
+      const StyleEntryValue *value;
+      uint32_t spec;          // the compiled spec, if value is one
+    };
+    std::vector<CompiledValue> values;
+    std::vector<uint32_t> table;
+    uint32_t key_count;
+
+    void compile();
+    const CompiledValue *find(uint32_t spec, const Key &key) const
+    {
+      if (key.id() >= key_count)
+        return 0;
+      uint32_t i = table[spec * key_count + key.id()];
+      return i ? &values[i] : 0;
+    }
+
     class Path : public std::vector<ascii_string>
     {
     public:
@@ -335,42 +395,146 @@ namespace style
   {
     Parser p(*this, path.string(), &root, 0);
     p.parse();
+    compile();
+  }
+
+  namespace
+  {
+    class Compiler
+    {
+      DBState &db_state;
+      std::vector<const StyleSpecData *> specs;
+
+      class Definition
+      {
+      public:
+        uint32_t spec, key, value;
+      };
+      std::vector<Definition> definitions;
+
+      std::vector<bool> flattened;
+
+      /* Numbers spec and the specs defined in it, interning their
+         identifiers and listing their own values. */
+      void add(const StyleSpecData &spec)
+      {
+        spec.index = specs.size();
+        specs.push_back(&spec);
+        for (StyleSpecData::PropertyMap::const_iterator it = spec.properties.begin();
+             it != spec.properties.end(); ++it)
+        {
+          DBState::CompiledValue v;
+          v.value = &it->second;
+          v.spec = 0;
+          Definition d;
+          d.spec = spec.index;
+          d.key = Key(it->first).id();
+          d.value = db_state.values.size();
+          definitions.push_back(d);
+          db_state.values.push_back(v);
+          if (const StyleSpecData *child = boost::get<StyleSpecData>(&it->second))
+          {
+            add(*child);
+            db_state.values[d.value].spec = child->index;
+          }
+        }
+      }
+
+      /* Fills in the entries spec inherits.  A spec may be derived from
+         one that contains it, so this waits until every row has its own
+         values. */
+      void flatten(uint32_t index)
+      {
+        if (flattened[index])
+          return;
+        flattened[index] = true;
+        const StyleSpecData *parent = specs[index]->parent;
+        if (!parent)
+          return;
+        flatten(parent->index);
+        uint32_t *row = &db_state.table[index * db_state.key_count];
+        const uint32_t *parent_row = &db_state.table[parent->index * db_state.key_count];
+        for (uint32_t k = 0; k < db_state.key_count; ++k)
+          row[k] = row[k] ? row[k] : parent_row[k];
+      }
+
+    public:
+      Compiler(DBState &db_state)
+        : db_state(db_state)
+      {}
+
+      void compile()
+      {
+        db_state.values.assign(1, DBState::CompiledValue());
+        // Every parent is defined somewhere in the tree, so is numbered
+        // too.
+        add(db_state.root);
+
+        db_state.key_count = key_table().names.size();
+        db_state.table.assign(specs.size() * db_state.key_count, 0);
+        for (std::vector<Definition>::const_iterator it = definitions.begin();
+             it != definitions.end(); ++it)
+          db_state.table[it->spec * db_state.key_count + it->key] = it->value;
+
+        if (!db_state.key_count)
+          return;
+        flattened.assign(specs.size(), false);
+        for (uint32_t i = 0; i < specs.size(); ++i)
+          flatten(i);
+      }
+    };
+  }
+
+  void DBState::compile()
+  {
+    Compiler(*this).compile();
   }
 
   template<>
-  int Spec::get<int>(const ascii_string &identifier) const
+  int Spec::get<int>(const Key &key) const
   {
-    const StyleEntryValue *entry_ptr = db_state.lookup(data, identifier);
+    const DBState::CompiledValue *entry_ptr = db_state.find(index, key);
     if (!entry_ptr)
-      throw PropertyAccessError("undefined property", identifier);
-    const int *value_ptr = boost::get<int>(entry_ptr);
+      throw PropertyAccessError("undefined property", key.name());
+    const int *value_ptr = boost::get<int>(entry_ptr->value);
     if (!value_ptr)
-      throw PropertyAccessError("invalid type", identifier);
+      throw PropertyAccessError("invalid type", key.name());
     return *value_ptr;
   }
 
   template<>
-  ascii_string Spec::get<ascii_string>(const ascii_string &identifier) const
+  ascii_string Spec::get<ascii_string>(const Key &key) const
   {
-    const StyleEntryValue *entry_ptr = db_state.lookup(data, identifier);
+    const DBState::CompiledValue *entry_ptr = db_state.find(index, key);
     if (!entry_ptr)
-      throw PropertyAccessError("undefined property", identifier);
-    const ascii_string *value_ptr = boost::get<const ascii_string>(entry_ptr);
+      throw PropertyAccessError("undefined property", key.name());
+    const ascii_string *value_ptr = boost::get<const ascii_string>(entry_ptr->value);
     if (!value_ptr)
-      throw PropertyAccessError("invalid type", identifier);
+      throw PropertyAccessError("invalid type", key.name());
     return *value_ptr;
   }
 
   template<>
-  Spec Spec::get<Spec>(const ascii_string &identifier) const
+  Spec Spec::get<Spec>(const Key &key) const
   {
-    const StyleEntryValue *entry_ptr = db_state.lookup(data, identifier);
+    const DBState::CompiledValue *entry_ptr = db_state.find(index, key);
     if (!entry_ptr)
-      throw PropertyAccessError("undefined property", identifier);
-    const StyleSpecData *data_ptr = boost::get<StyleSpecData>(entry_ptr);
-    if (!data_ptr)
-      throw PropertyAccessError("invalid type", identifier);
-    return Spec(db_state, data_ptr);
+      throw PropertyAccessError("undefined property", key.name());
+    if (!boost::get<StyleSpecData>(entry_ptr->value))
+      throw PropertyAccessError("invalid type", key.name());
+    return Spec(db_state, entry_ptr->spec);
+  }
+
+  std::vector<ascii_string> Spec::identifiers() const
+  {
+    std::vector<ascii_string> result;
+    if (!db_state.key_count)
+      return result;
+    const uint32_t *row = &db_state.table[index * db_state.key_count];
+    for (uint32_t k = 0; k < db_state.key_count; ++k)
+      if (row[k])
+        result.push_back(key_table().names[k]);
+    return result;
   }
 
   DB::DB()
@@ -402,9 +566,14 @@ namespace style
     }
   }
 
-  Spec DB::get(const ascii_string &identifier) const
+  Spec DB::root() const
+  {
+    return Spec(*state, 0);
+  }
+
+  Spec DB::get(const Key &key) const
   {
-    return Spec(*state, 0).get<Spec>(identifier);
+    return root().get<Spec>(key);
   }
 
 } // namespace style
@@ -4,6 +4,8 @@
 #include <util/string.hpp>
 #include <exception>
 #include <memory>
+#include <vector>
+#include <stdint.h>
 #include <boost/filesystem/path.hpp>
 
 namespace style
@@ -48,19 +50,42 @@ namespace style
     const std::string &identifier() const { return identifier_; }
   };
 
+  /* An identifier interned to a small integer, the same in every DB.
+     Looking a Key up in a Spec is an array index; constructing one is
+     a hash lookup, so code that is run often should keep its keys. */
+  class Key
+  {
+    uint32_t id_;
+  public:
+    explicit Key(const ascii_string &identifier);
+    uint32_t id() const { return id_; }
+    const ascii_string &name() const;
+  };
+
+  /* A Key for the literal identifier, constructed once per use. */
+#define STYLE_KEY(identifier) \
+  ([] { static const style::Key key_(identifier); return key_; }())
+
   class DB;
 
   class Spec
   {
     friend class DB;
     const DBState &db_state;
-    const StyleSpecData *data;
-    Spec(const DBState &db_state, const StyleSpecData *data)
-      : db_state(db_state), data(data)
+    uint32_t index;
+    Spec(const DBState &db_state, uint32_t index)
+      : db_state(db_state), index(index)
     {}
   public:
     template<class T>
-    T get(const ascii_string &identifier) const;
+    T get(const Key &key) const;
+
+    template<class T>
+    T get(const ascii_string &identifier) const { return get<T>(Key(identifier)); }
+
+    /* The identifiers defined, including by parents, in no particular
+       order. */
+    std::vector<ascii_string> identifiers() const;
   };
 
 
@@ -74,7 +99,11 @@ namespace style
 
     void load(const boost::filesystem::path &path);
 
-    Spec get(const ascii_string &identifier) const;
+    /* The spec holding the top-level definitions. */
+    Spec root() const;
+
+    Spec get(const Key &key) const;
+    Spec get(const ascii_string &identifier) const { return get(Key(identifier)); }
 
     Spec operator[](const ascii_string &identifier) const { return get(identifier); }
   };
@@ -18,10 +18,10 @@
   CHAOS_PP_TUPLE_ELEM_ALT(1, tup) CHAOS_PP_TUPLE_ELEM_ALT(0, tup);
 
 #define STYLE_DEFINITION_HELPER2A(name, type) \
-  name(spec_.get<type>( #name ))
+  name(spec_.get<type>(STYLE_KEY( #name )))
 
 #define STYLE_DEFINITION_HELPER2B(name, type, spec_type)  \
-  name(dc_, spec_.get<spec_type>( #name ))
+  name(dc_, spec_.get<spec_type>(STYLE_KEY( #name )))
 
 #define STYLE_DEFINITION_HELPER2(s, tup) \
   CHAOS_PP_IF(CHAOS_PP_EQUAL(CHAOS_PP_TUPLE_SIZE(tup),2)) \
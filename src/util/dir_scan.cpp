@@ -0,0 +1,119 @@
+
+#include <util/dir_scan.hpp>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+  // The kernel's record; glibc before 2.30 does not declare it.
+  struct linux_dirent64
+  {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+  };
+
+  mode_t type_from_d_type(unsigned char d_type)
+  {
+    switch (d_type)
+    {
+    case DT_REG: return S_IFREG;
+    case DT_DIR: return S_IFDIR;
+    case DT_LNK: return S_IFLNK;
+    case DT_FIFO: return S_IFIFO;
+    case DT_SOCK: return S_IFSOCK;
+    case DT_CHR: return S_IFCHR;
+    case DT_BLK: return S_IFBLK;
+    default: return 0;
+    }
+  }
+
+#ifdef STATX_TYPE
+  // Set once statx turns out to be unsupported by the kernel.
+  std::atomic<bool> statx_unavailable(false);
+#endif
+}
+
+DirScanner::DirScanner(const char *path, size_t buffer_size)
+  : error_(0), buffer_(buffer_size), pos_(0), end_(0),
+    name_(0), name_length_(0), type_(0)
+{
+  fd_ = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd_ < 0)
+    error_ = errno;
+}
+
+DirScanner::~DirScanner()
+{
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+bool DirScanner::next()
+{
+  if (fd_ < 0 || buffer_.empty())
+    return false;
+
+  for (;;)
+  {
+    if (pos_ == end_)
+    {
+      long result;
+      do
+        result = syscall(SYS_getdents64, fd_, &buffer_[0], buffer_.size());
+      while (result < 0 && errno == EINTR);
+      if (result <= 0)
+      {
+        if (result < 0)
+          error_ = errno;
+        return false;
+      }
+      pos_ = 0;
+      end_ = (size_t)result;
+    }
+
+    const linux_dirent64 *d = (const linux_dirent64 *)&buffer_[pos_];
+    pos_ += d->d_reclen;
+
+    const char *name = d->d_name;
+    if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+      continue;
+
+    name_ = name;
+    name_length_ = std::strlen(name);
+    type_ = type_from_d_type(d->d_type);
+    return true;
+  }
+}
+
+mode_t DirScanner::stat_mode(const char *name) const
+{
+  if (fd_ < 0)
+    return 0;
+
+#ifdef STATX_TYPE
+  if (!statx_unavailable.load(std::memory_order_relaxed))
+  {
+    struct statx stx;
+    if (statx(fd_, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+              STATX_TYPE | STATX_MODE, &stx) == 0)
+      return stx.stx_mode;
+    if (errno != ENOSYS)
+      return 0;
+    statx_unavailable.store(true, std::memory_order_relaxed);
+  }
+#endif
+
+  struct stat st;
+  if (fstatat(fd_, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+    return st.st_mode;
+  return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef _UTIL_DIR_SCAN_HPP
+#define _UTIL_DIR_SCAN_HPP
+
+#include <sys/types.h>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Reads a directory with getdents64 into a large buffer, taking file
+ * types from d_type rather than stat'ing each entry.  The entries .
+ * and .. are skipped.
+ *
+ *   DirScanner scan(path);
+ *   while (scan.next())
+ *     use(scan.name(), scan.type());
+ *   if (scan.error())
+ *     ...
+ */
+class DirScanner
+{
+  int fd_;
+  int error_;
+  std::vector<char> buffer_;
+  size_t pos_, end_;
+  const char *name_;
+  size_t name_length_;
+  mode_t type_;
+
+  DirScanner(const DirScanner &);
+  DirScanner &operator=(const DirScanner &);
+
+public:
+  /* A buffer_size of 0 opens the directory for stat_mode only. */
+  explicit DirScanner(const char *path, size_t buffer_size = 128 * 1024);
+  ~DirScanner();
+
+  /* Advances to the next entry.  Returns false at the end of the
+     directory or on error. */
+  bool next();
+
+  /* errno of the failure to open or read the directory, or 0. */
+  int error() const { return error_; }
+
+  const char *name() const { return name_; }
+  size_t name_length() const { return name_length_; }
+
+  /* The S_IFMT bits of the current entry, or 0 if the file system
+     does not report types. */
+  mode_t type() const { return type_; }
+
+  /* Type and permission bits of the entry name in this directory,
+     without following symbolic links, or 0 if it cannot be stat'ed.
+     Uses statx, which may skip synchronizing attributes with a
+     network file system, where available. */
+  mode_t stat_mode(const char *name) const;
+};
+
+#endif /* _UTIL_DIR_SCAN_HPP */
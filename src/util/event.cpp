@@ -116,6 +116,12 @@ void FileEvent::handle_event(int, short events, void *ptr)
   e->handler(events);
 }
 
+void FileEvent::cancel()
+{
+  if (initialized)
+    event_del(&ev);
+}
+
 FileEvent::~FileEvent()
 {
   if (initialized)
@@ -255,10 +261,10 @@ void InotifyEvent::initialize(EventService &s, const Handler &handler)
     ERROR_SYS("event_add");
 }
 
-int InotifyEvent::add_watch(const char *pathname, uint32_t mask)
+int InotifyEvent::add_watch(const char *pathname, uint32_t mask, bool warn)
 {
   int wd = inotify_add_watch(fd, pathname, mask);
-  if (wd < 0)
+  if (wd < 0 && warn)
     WARN_SYS("inotify_add_watch");
   return wd;
 }
@@ -288,19 +294,20 @@ void InotifyEvent::handle_event(int, short, void *ptr)
     {
       e->length += result;
 
-      if (e->length >= (int)sizeof(inotify_event))
+      // A single read may return several events.
+      while (e->length >= (int)sizeof(inotify_event))
       {
         inotify_event *ie = (inotify_event *)e->buffer;
         int event_length = (int)(sizeof(inotify_event) + ie->len);
-        if (e->length >= event_length)
-        {
-          const char *pathname = ie->len ? e->buffer + sizeof(inotify_event) : 0;
-          e->handler(ie->wd, ie->mask, ie->cookie, pathname);
-          int new_length = e->length - event_length;
-          memmove(e->buffer, e->buffer + event_length, new_length);
-          e->length = new_length;
-        }
-      } else if (e->length == BUFFER_SIZE)
+        if (e->length < event_length)
+          break;
+        const char *pathname = ie->len ? e->buffer + sizeof(inotify_event) : 0;
+        e->handler(ie->wd, ie->mask, ie->cookie, pathname);
+        int new_length = e->length - event_length;
+        memmove(e->buffer, e->buffer + event_length, new_length);
+        e->length = new_length;
+      }
+      if (e->length == BUFFER_SIZE)
       {
         ERROR_SYS("invalid inotify data");
       }
@@ -26,6 +26,8 @@ public:
             const Handler &handler);
   void initialize(EventService &s, int fd, short events,
                   const Handler &handler);
+  // Stops watching the file; may be called from the handler.
+  void cancel();
   ~FileEvent();
 };
 
@@ -87,7 +89,9 @@ public:
   ~InotifyEvent();
   void initialize(EventService &s, const Handler &handler);
 
-  int add_watch(const char *pathname, uint32_t mask);
+  /* Returns the watch descriptor, or -1 on failure, which is logged
+     unless warn is false. */
+  int add_watch(const char *pathname, uint32_t mask, bool warn = true);
   void rm_watch(int wd);
 };
 
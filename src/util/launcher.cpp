@@ -0,0 +1,257 @@
+
+#include <util/launcher.hpp>
+#include <util/spawn.hpp>
+#include <util/log.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Each request is one SOCK_SEQPACKET message: a RequestHeader, then
+   the '\0'-terminated path, working directory (empty for none),
+   arguments and environment changes.  Each is answered by a Reply. */
+
+namespace
+{
+  struct RequestHeader
+  {
+    uint64_t id;
+    uint32_t argc, envc;
+  };
+
+  struct Reply
+  {
+    uint64_t id;
+    int32_t pid, error;
+  };
+
+  const size_t max_message = 65536;
+
+  // The window manager's end of the socket, or -1
+  std::atomic<int> launcher_fd(-1);
+
+  boost::mutex pending_mutex;
+  uint64_t next_id = 0;
+  std::map<uint64_t, boost::function<void (int)> > pending;
+
+  void append(std::string &out, const char *s)
+  {
+    out.append(s, strlen(s) + 1);
+  }
+
+  // Returns null if the strings run past end.
+  const char *take(const char *&p, const char *end)
+  {
+    const char *s = p;
+    const char *nul = (const char *)memchr(p, '\0', end - p);
+    if (!nul)
+      return 0;
+    p = nul + 1;
+    return s;
+  }
+
+  void handle_request(int fd, const char *message, size_t size)
+  {
+    Reply reply;
+    reply.id = 0;
+    reply.pid = -1;
+    reply.error = EINVAL;
+
+    RequestHeader h;
+    if (size >= sizeof(h))
+    {
+      memcpy(&h, message, sizeof(h));
+      reply.id = h.id;
+
+      const char *p = message + sizeof(h), *end = message + size;
+      const char *path = take(p, end);
+      const char *working_dir = path ? take(p, end) : 0;
+      std::vector<char *> argv;
+      std::vector<std::string> env;
+      for (uint32_t i = 0; working_dir && i < h.argc && p != end; ++i)
+        argv.push_back(const_cast<char *>(take(p, end)));
+      for (uint32_t i = 0; working_dir && i < h.envc && p != end; ++i)
+        if (const char *e = take(p, end))
+          env.push_back(e);
+      argv.push_back(0);
+
+      if (working_dir && argv.size() == h.argc + 1 && env.size() == h.envc
+          && std::find(argv.begin(), argv.end() - 1, (char *)0) == argv.end() - 1)
+      {
+        reply.pid = spawnve(*working_dir ? working_dir : 0, path, &argv[0], env);
+        reply.error = reply.pid < 0 ? errno : 0;
+      }
+    }
+
+    while (send(fd, &reply, sizeof(reply), MSG_NOSIGNAL) < 0 && errno == EINTR)
+      ;
+  }
+
+  void run_launcher(int fd, pid_t parent)
+  {
+    // Exits with the window manager, even if it is killed.
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != parent)
+      _exit(0);
+
+    // Reaps the programs it starts.
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_flags = SA_NOCLDSTOP | SA_NOCLDWAIT;
+    act.sa_handler = SIG_IGN;
+    while (sigaction(SIGCHLD, &act, 0) != 0 && errno == EINTR);
+
+    std::vector<char> buffer(max_message);
+    for (;;)
+    {
+      ssize_t n = recv(fd, &buffer[0], buffer.size(), 0);
+      if (n < 0 && errno == EINTR)
+        continue;
+      // The window manager has exited or exec'd itself.
+      if (n <= 0)
+        _exit(0);
+      handle_request(fd, &buffer[0], n);
+    }
+  }
+
+  void fail_pending()
+  {
+    std::map<uint64_t, boost::function<void (int)> > failed;
+    {
+      boost::mutex::scoped_lock l(pending_mutex);
+      failed.swap(pending);
+    }
+    for (std::map<uint64_t, boost::function<void (int)> >::iterator it = failed.begin();
+         it != failed.end(); ++it)
+      it->second(-1);
+  }
+}
+
+bool start_launcher()
+{
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0)
+  {
+    WARN_SYS("failed to create launcher socket");
+    return false;
+  }
+  pid_t parent = getpid();
+  pid_t pid = fork();
+  if (pid < 0)
+  {
+    WARN_SYS("failed to fork launcher");
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  if (pid == 0)
+  {
+    close(fds[0]);
+    run_launcher(fds[1], parent);
+  }
+  close(fds[1]);
+  launcher_fd = fds[0];
+  return true;
+}
+
+bool launcher_request(const char *working_dir, const char *path, char *const argv[],
+                      const std::vector<std::string> &env,
+                      const boost::function<void (int)> &started)
+{
+  int fd = launcher_fd;
+  if (fd < 0)
+    return false;
+
+  RequestHeader h;
+  h.argc = 0;
+  while (argv[h.argc])
+    ++h.argc;
+  h.envc = env.size();
+
+  std::string message(sizeof(h), '\0');
+  append(message, path);
+  append(message, working_dir ? working_dir : "");
+  for (uint32_t i = 0; i < h.argc; ++i)
+    append(message, argv[i]);
+  for (size_t i = 0; i < env.size(); ++i)
+    append(message, env[i].c_str());
+  if (message.size() > max_message)
+    return false;
+
+  boost::mutex::scoped_lock l(pending_mutex);
+  h.id = next_id++;
+  memcpy(&message[0], &h, sizeof(h));
+  // Registered first, so that the reply cannot arrive before it.
+  if (started)
+    pending[h.id] = started;
+  ssize_t n;
+  while ((n = send(fd, message.data(), message.size(), MSG_DONTWAIT | MSG_NOSIGNAL)) < 0
+         && errno == EINTR)
+    ;
+  if (n < 0)
+  {
+    pending.erase(h.id);
+    // A full socket means the launcher is busy; anything else that it
+    // is gone.
+    if (errno != EAGAIN)
+    {
+      WARN_SYS("launcher failed; starting programs directly");
+      launcher_fd = -1;
+    }
+    return false;
+  }
+  return true;
+}
+
+LauncherReplies::LauncherReplies(EventService &event_service)
+  : fd(launcher_fd)
+{
+  if (fd >= 0)
+    event.initialize(event_service, fd, EV_READ,
+                     boost::bind(&LauncherReplies::handle_readable, this, _1));
+}
+
+LauncherReplies::~LauncherReplies()
+{
+}
+
+void LauncherReplies::handle_readable(short events)
+{
+  for (;;)
+  {
+    Reply reply;
+    ssize_t n = recv(fd, &reply, sizeof(reply), MSG_DONTWAIT);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EAGAIN)
+      return;
+    if (n != sizeof(reply))
+    {
+      WARN("launcher exited; starting programs directly");
+      // The descriptor is left open, so that a request racing with
+      // this fails rather than going to a reused descriptor.
+      launcher_fd = -1;
+      event.cancel();
+      fail_pending();
+      return;
+    }
+
+    boost::function<void (int)> started;
+    {
+      boost::mutex::scoped_lock l(pending_mutex);
+      std::map<uint64_t, boost::function<void (int)> >::iterator it = pending.find(reply.id);
+      if (it == pending.end())
+        continue;
+      started.swap(it->second);
+      pending.erase(it);
+    }
+    started(reply.pid);
+  }
+}
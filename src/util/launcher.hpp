@@ -0,0 +1,45 @@
+#ifndef _UTIL_LAUNCHER_HPP
+#define _UTIL_LAUNCHER_HPP
+
+#include <util/event.hpp>
+#include <boost/function.hpp>
+#include <string>
+#include <vector>
+
+/**
+ * The launcher is a small process forked from the window manager at
+ * startup, before anything large is loaded.  Once it is running, the
+ * programs spawned by util/spawn.hpp are started by the launcher from
+ * its own address space: the window manager sends the request over a
+ * unix socket and goes on, and the process ID comes back later.
+ *
+ * If the launcher dies or cannot keep up, spawning falls back to
+ * starting programs directly.
+ */
+
+/* Forks the launcher.  Call first thing in main, before any threads
+   are started or anything large is allocated.  Returns false, after
+   logging why, if it could not be started. */
+bool start_launcher();
+
+/* Delivers the launcher's replies, with the process IDs, from the
+   event loop for as long as it exists. */
+class LauncherReplies
+{
+  int fd;
+  FileEvent event;
+  void handle_readable(short events);
+public:
+  explicit LauncherReplies(EventService &event_service);
+  ~LauncherReplies();
+};
+
+/* Asks the launcher to start a program, as spawnve, which normally
+   calls this.  started is called from the event loop once the reply
+   arrives.  Returns false if there is no launcher or it did not take
+   the request, and the caller should start the program itself. */
+bool launcher_request(const char *working_dir, const char *path, char *const argv[],
+                      const std::vector<std::string> &env,
+                      const boost::function<void (int)> &started);
+
+#endif /* _UTIL_LAUNCHER_HPP */
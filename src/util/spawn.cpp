@@ -1,47 +1,228 @@
 
 #include "util/spawn.hpp"
+#include "util/log.hpp"
+#include "util/launcher.hpp"
 
 #include <unistd.h>
 #include <stdarg.h>
 #include <signal.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
 
-static void reset_signal_handling()
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
+extern char **environ;
+
+namespace
+{
+  struct ChildArgs
+  {
+    const char *path;
+    char *const *argv;
+    char *const *envp;
+    const char *working_dir;
+    int error_fd;
+    sigset_t mask;
+  };
+
+  /* Marks every descriptor from 3 up close-on-exec, so that the
+     error pipe stays open until exec succeeds. */
+  void close_other_fds_on_exec()
+  {
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, 3U, ~0U, CLOSE_RANGE_CLOEXEC) == 0)
+      return;
+#endif
+    // Kernels before 5.11
+    struct rlimit rl;
+    int max_fd = 1024;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+      max_fd = (int)rl.rlim_cur;
+    for (int i = 3; i < max_fd; ++i)
+      fcntl(i, F_SETFD, FD_CLOEXEC);
+  }
+
+  /* Runs in the child, which shares the parent's memory and runs on
+     its stack until it execs or exits, so it must only make system
+     calls. */
+  int child_main(void *p)
+  {
+    const ChildArgs &a = *(const ChildArgs *)p;
+
+    // A handler of the parent's would run on shared memory, and a
+    // signal ignored by the parent would stay ignored by the program.
+    // (SA_NOCLDWAIT breaks Flash plugin for firefox)
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = SIG_DFL;
+    for (int sig = 1; sig < NSIG; ++sig)
+    {
+      struct sigaction old;
+      if (sig == SIGCHLD || sig == SIGINT
+          || (sigaction(sig, 0, &old) == 0 && old.sa_handler != SIG_DFL
+              && old.sa_handler != SIG_IGN))
+        sigaction(sig, &act, 0);
+    }
+    sigprocmask(SIG_SETMASK, &a.mask, 0);
+
+    setsid();
+    close(STDIN_FILENO);
+    close_other_fds_on_exec();
+    if (a.working_dir)
+      (void)chdir(a.working_dir);
+    execve(a.path, a.argv, a.envp);
+
+    int error = errno;
+    (void)write(a.error_fd, &error, sizeof(error));
+    _exit(127);
+  }
+}
+
+/* Whether the "NAME=value" entry e sets a variable that is in env,
+   as "NAME=..." or "NAME". */
+static bool overridden(const char *e, const std::vector<std::string> &env)
 {
-  struct sigaction act;
-  act.sa_flags = 0;
-  act.sa_handler = SIG_DFL;
-  while (sigaction(SIGCHLD, &act, 0) != 0 && errno == EINTR);
-  while (sigaction(SIGINT, &act, 0) != 0 && errno == EINTR);
+  const char *eq = strchr(e, '=');
+  size_t length = eq ? eq - e : strlen(e);
+  for (size_t i = 0; i < env.size(); ++i)
+  {
+    const std::string &d = env[i];
+    if (d.compare(0, length, e, length) == 0
+        && (d.size() == length || d[length] == '='))
+      return true;
+  }
+  return false;
+}
+
+static int spawn_direct(const char *working_dir, const char *path, char *const argv[],
+                        const std::vector<std::string> &env)
+{
+  // The environment with env applied and PWD set, built here because
+  // the child may not allocate.
+  std::vector<std::string> changes(env);
+  if (working_dir)
+    changes.push_back(std::string("PWD=") + working_dir);
+  std::vector<char *> envp;
+  for (char **e = environ; *e; ++e)
+    if (!overridden(*e, changes))
+      envp.push_back(*e);
+  for (size_t i = 0; i < changes.size(); ++i)
+    if (changes[i].find('=') != std::string::npos)
+      envp.push_back(&changes[i][0]);
+  envp.push_back(0);
+
+  int error_pipe[2];
+  if (pipe2(error_pipe, O_CLOEXEC) != 0)
+  {
+    WARN_SYS("failed to create pipe to spawn %s", path);
+    return -1;
+  }
+
+  ChildArgs args;
+  args.path = path;
+  args.argv = argv;
+  args.envp = &envp[0];
+  args.working_dir = working_dir;
+  args.error_fd = error_pipe[1];
+
+  // No handler may run in the child before it has reset them.
+  sigset_t all;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &args.mask);
+
+  // The parent is suspended until the child execs or exits, so the
+  // child can run on a stack in this frame.  Unlike fork, nothing of
+  // the parent's address space is copied.
+  alignas(16) char stack[16384];
+  int pid = clone(child_main, stack + sizeof(stack),
+                  CLONE_VM | CLONE_VFORK | SIGCHLD, &args);
+  int clone_errno = errno;
+
+  pthread_sigmask(SIG_SETMASK, &args.mask, 0);
+  close(error_pipe[1]);
+
+  if (pid < 0)
+  {
+    close(error_pipe[0]);
+    errno = clone_errno;
+    WARN_SYS("failed to spawn %s", path);
+    return -1;
+  }
+
+  // The child has already exec'd, closing its end, or written the
+  // error.
+  int error;
+  ssize_t n;
+  while ((n = read(error_pipe[0], &error, sizeof(error))) < 0 && errno == EINTR)
+    ;
+  close(error_pipe[0]);
+  if (n == sizeof(error))
+  {
+    waitpid(pid, 0, 0);
+    errno = error;
+    WARN_SYS("failed to execute %s", path);
+    return -1;
+  }
+  return pid;
+}
+
+static SpawnObserver spawn_observer;
+
+void set_spawn_observer(const SpawnObserver &observer)
+{
+  spawn_observer = observer;
+}
+
+static int spawn(const char *working_dir, const char *path, char *const argv[],
+                 const std::vector<std::string> &env,
+                 const SpawnCallback &started)
+{
+  if (launcher_request(working_dir, path, argv, env, started))
+    return 0;
+  int pid = spawn_direct(working_dir, path, argv, env);
+  if (started)
+    started(pid);
+  return pid;
+}
+
+int spawnve(const char *working_dir, const char *path, char *const argv[],
+            const std::vector<std::string> &env,
+            const SpawnCallback &started)
+{
+  if (!spawn_observer)
+    return spawn(working_dir, path, argv, env, started);
+  std::vector<std::string> observed_env(env);
+  SpawnCallback observed_started(started);
+  spawn_observer(path, observed_env, observed_started);
+  return spawn(working_dir, path, argv, observed_env, observed_started);
+}
+
+int spawnv(const char *working_dir, const char *path, char *const argv[])
+{
+  return spawnve(working_dir, path, argv, std::vector<std::string>());
 }
 
 int spawnl(const char *working_dir, const char *path, ...)
 {
   const int max_args = 31;
   va_list argp;
-  char *argv[max_args];
+  char *argv[max_args + 1];
   int argc = 0;
   va_start (argp, path);
   while (argc < max_args
          && (argv[argc++] = va_arg(argp, char *)) != (char*)0)
     ;
   va_end(argp);
-  int val = fork();
-  if (val == 0)
-  {
-    reset_signal_handling();
-    setsid();
-    close(STDIN_FILENO);
-    // Close all open file descriptors
-    for (int i = 3; i < 1024; ++i)
-      close(i);
-    if (working_dir) {
-      (void)chdir(working_dir);
-      setenv("PWD", working_dir, 1);
-    }
-    execv(path, argv);
-    exit(-1);
-  }
-  return val;
+  argv[argc] = 0;
+  return spawnv(working_dir, path, argv);
 }
@@ -1,6 +1,10 @@
 #ifndef _UTIL_SPAWN_HPP
 #define _UTIL_SPAWN_HPP
 
+#include <boost/function.hpp>
+#include <string>
+#include <vector>
+
 /**
  * Spawns a process asynchronously.
  *
@@ -10,8 +14,42 @@
  *
  * The new process is created in a new process group.
  *
- * The standard input file descriptor is closed in the new process.
+ * The standard input file descriptor is closed in the new process, and
+ * every descriptor above standard error is closed on exec.
+ *
+ * The process is created with clone(CLONE_VM | CLONE_VFORK), sharing
+ * the caller's memory until it execs, so that spawning does not copy
+ * the page tables of the window manager.
+ *
+ * If the launcher is running (see util/launcher.hpp), the process is
+ * started by it instead, and 0 is returned.
+ *
+ * Otherwise returns the process ID, or -1 with errno set, after
+ * logging, if the program could not be executed.
  */
 int spawnl(const char *working_dir, const char *path, ...);
 
+/* As spawnl, with the arguments in the null-terminated array argv. */
+int spawnv(const char *working_dir, const char *path, char *const argv[]);
+
+/* Called with the ID of a spawned process once it has started, or
+   with -1 if it could not be. */
+typedef boost::function<void (int pid)> SpawnCallback;
+
+/* As spawnv, also setting each "NAME=value" of env in the environment
+   of the new process, and removing each "NAME" given without a value.
+   started is called immediately when the process is started directly,
+   and from the event loop when it is started by the launcher. */
+int spawnve(const char *working_dir, const char *path, char *const argv[],
+            const std::vector<std::string> &env,
+            const SpawnCallback &started = SpawnCallback());
+
+/* Called by spawnve before each program is started, with the
+   environment changes and the callback, which it may add to or wrap.
+   Used by the window manager to follow programs until their windows
+   appear; not called in the launcher. */
+typedef boost::function<void (const char *path, std::vector<std::string> &env,
+                              SpawnCallback &started)> SpawnObserver;
+void set_spawn_observer(const SpawnObserver &observer);
+
 #endif /* _UTIL_SPAWN_HPP */
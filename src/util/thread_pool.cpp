@@ -0,0 +1,54 @@
+
+#include <util/thread_pool.hpp>
+#include <boost/bind.hpp>
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threads)
+  : stopping(false)
+{
+  if (threads == 0)
+    threads = std::max(1u, boost::thread::hardware_concurrency());
+  size_ = threads;
+  for (size_t i = 0; i < threads; ++i)
+    this->threads.create_thread(boost::bind(&ThreadPool::run, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    boost::mutex::scoped_lock l(mutex);
+    stopping = true;
+    queue.clear();
+  }
+  cond.notify_all();
+  threads.join_all();
+}
+
+void ThreadPool::post(const Task &task)
+{
+  {
+    boost::mutex::scoped_lock l(mutex);
+    if (stopping)
+      return;
+    queue.push_back(task);
+  }
+  cond.notify_one();
+}
+
+void ThreadPool::run()
+{
+  for (;;)
+  {
+    Task task;
+    {
+      boost::mutex::scoped_lock l(mutex);
+      while (queue.empty() && !stopping)
+        cond.wait(l);
+      if (stopping)
+        return;
+      task.swap(queue.front());
+      queue.pop_front();
+    }
+    task();
+  }
+}
@@ -0,0 +1,44 @@
+#ifndef _UTIL_THREAD_POOL_HPP
+#define _UTIL_THREAD_POOL_HPP
+
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <deque>
+
+/**
+ * A fixed set of worker threads running posted tasks in FIFO order.
+ * Tasks still queued when the pool is destroyed are discarded; the
+ * destructor waits for running tasks to return.
+ */
+class ThreadPool
+{
+public:
+  typedef boost::function<void ()> Task;
+
+private:
+  boost::mutex mutex;
+  boost::condition_variable cond;
+  std::deque<Task> queue;
+  bool stopping;
+  boost::thread_group threads;
+  size_t size_;
+
+  void run();
+
+  ThreadPool(const ThreadPool &);
+  ThreadPool &operator=(const ThreadPool &);
+
+public:
+  /* 0 threads means one per hardware thread. */
+  explicit ThreadPool(size_t threads = 0);
+  ~ThreadPool();
+
+  size_t size() const { return size_; }
+
+  /* May be called from any thread, including a worker. */
+  void post(const Task &task);
+};
+
+#endif /* _UTIL_THREAD_POOL_HPP */
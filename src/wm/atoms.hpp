@@ -20,6 +20,8 @@ DECLARE_ATOM(atom_net_wm_active_window, "_NET_WM_ACTIVE_WINDOW")
 DECLARE_ATOM(atom_net_supporting_wm_check, "_NET_SUPPORTING_WM_CHECK")
 DECLARE_ATOM(atom_net_supported, "_NET_SUPPORTED")
 DECLARE_ATOM(atom_net_active_window, "_NET_ACTIVE_WINDOW")
+DECLARE_ATOM(atom_net_wm_pid, "_NET_WM_PID")
+DECLARE_ATOM(atom_net_startup_id, "_NET_STARTUP_ID")
 
 DECLARE_ATOM(atom_net_wm_window_type, "_NET_WM_WINDOW_TYPE")
 DECLARE_ATOM(atom_net_wm_window_type_desktop, "_NET_WM_WINDOW_TYPE_DESKTOP")
@@ -2,6 +2,7 @@
 
 #include <boost/intrusive/list.hpp>
 #include <unordered_map>
+#include <map>
 
 #define SYSTEM_TRAY_REQUEST_DOCK    0
 #define SYSTEM_TRAY_BEGIN_MESSAGE   1
@@ -29,6 +30,15 @@
 
 enum map_state_t { STATE_MAPPED, STATE_UNMAPPED } map_state;
 
+namespace {
+struct UpdateStats {
+  time_point first_update;
+  unsigned long updates = 0;   // calls to set_text/set_foreground/set_background
+  unsigned long changes = 0;   // calls that changed the cell
+  unsigned long urgent = 0;
+};
+}
+
 
 class WBar::Cell : public boost::intrusive::list_base_hook<> {
 public:
@@ -43,6 +53,19 @@ public:
   WRect current_tray_window_bounds;
   map_state_t map_state = STATE_UNMAPPED;
   bool tray_should_be_mapped = false;
+  bool tray_configured = false;
+
+  // Layout from the last full draw, used to redraw a changed cell in
+  // place.  available_rect is the space the label was drawn into and
+  // rect the area it covered; drawn is false if the cell was skipped.
+  bool drawn = false;
+  bool dirty = false;
+  WRect available_rect, rect;
+
+  ascii_string source;
+  UpdateStats *stats = 0;
+
+  bool is_text_visible() const { return foreground_color && background_color && !text.empty(); }
 
   Cell(WBar &bar,
        cell_position_t position,
@@ -61,6 +84,7 @@ struct WBar::Impl {
 
   WM &wm() { return wm_; }
   WBarStyle style;
+  WBackBuffer buffer;
   Window xwin_;
   WRect bounds, current_window_bounds;
 
@@ -72,12 +96,38 @@ struct WBar::Impl {
 
   CellList cells[2];
 
-  bool scheduled_update_server, scheduled_draw;
+  // Tray icons are docked at the beginning of cells[RIGHT], so they sit
+  // between the left and right text cells and never shift any text.
+  // tray_area is the space left for them by the last full draw; a dock
+  // or undock only relays out the icons within it.  The area under the
+  // icons is plain background in the back buffer, so nothing is redrawn.
+  WRect tray_area;
+  bool scheduled_tray_layout = false;
+
+  // XEMBED_EMBEDDED_NOTIFY messages waiting to be sent by flush, with
+  // the timestamp of the dock request.
+  std::vector<std::pair<Window, Time>> pending_embed_notify;
+
+  // scheduled_draw relayouts and redraws the whole bar;
+  // scheduled_draw_cells only redraws cells marked dirty.
+  bool scheduled_update_server, scheduled_draw, scheduled_draw_cells, scheduled_repaint;
+
+  // Dirty cells are drawn at most once per min_redraw_interval; an
+  // urgent change draws them on the next flush regardless.
+  bool scheduled_urgent_draw = false;
+  time_duration min_redraw_interval = time_duration::milliseconds(33);
+  time_point last_cell_draw;
+  TimerEvent redraw_timer;
+  bool redraw_timer_pending = false;
+
+  std::map<ascii_string, UpdateStats> update_stats;
+  unsigned long full_draws = 0, cell_draws = 0, deferred_draws = 0;
 
   bool initialized;
 
   Impl(WM &wm_, const style::Spec &style_spec)
-      : wm_(wm_), style(wm_.dc, style_spec), scheduled_update_server(true), scheduled_draw(true), initialized(false) {}
+      : wm_(wm_), style(wm_.dc, style_spec), buffer(wm_.dc), scheduled_update_server(true), scheduled_draw(true), scheduled_draw_cells(false), scheduled_repaint(false),
+        redraw_timer(wm_.event_service(), [this] { redraw_timer_pending = false; }), initialized(false) {}
 
   void initialize() {
 
@@ -170,12 +220,216 @@ struct WBar::Impl {
       }
     }
 
+    bool deferred = false;
+
     if (scheduled_update_server || scheduled_draw) {
       draw();
+    } else {
+      if (scheduled_tray_layout && visible)
+        layout_tray();
+      if (scheduled_draw_cells && visible) {
+        time_point now = time_point::current();
+        time_duration elapsed = now - last_cell_draw;
+        if (scheduled_urgent_draw || !(elapsed < min_redraw_interval)) {
+          draw_dirty_cells();
+          last_cell_draw = now;
+        } else {
+          // The main loop flushes again once the timer fires.
+          deferred = true;
+          if (!redraw_timer_pending) {
+            redraw_timer.wait(min_redraw_interval - elapsed);
+            redraw_timer_pending = true;
+            ++deferred_draws;
+          }
+        }
+      }
+    }
+
+    if (scheduled_repaint && visible) {
+      if (!buffer.valid(bounds.width, bounds.height))
+        draw();
+      buffer.repair(xwin_);
     }
 
+    // Sent after the icons have been reparented and placed.  Icons
+    // that cannot be notified are dropped, as if they had been unmapped.
+    std::vector<Window> failed;
+    for (auto const &x : pending_embed_notify) {
+      if (!xwindow_send_client_msg32(wm().display(), x.first, x.first, xa_xembed,
+                                     x.second, XEMBED_EMBEDDED_NOTIFY, 0, xwin_))
+        failed.push_back(x.first);
+    }
+    pending_embed_notify.clear();
+
     scheduled_update_server = false;
     scheduled_draw = false;
+    scheduled_tray_layout = false;
+    scheduled_draw_cells = deferred;
+    scheduled_urgent_draw = false;
+    scheduled_repaint = false;
+
+    if (!failed.empty()) {
+      for (Window w : failed) {
+        XRemoveFromSaveSet(wm().display(), w);
+        tray_windows.erase(w);
+      }
+      // Lays out the remaining icons.
+      flush();
+    }
+  }
+
+  void record_update(Cell &c, bool changed, bool urgent) {
+    if (!c.stats)
+      return;
+    UpdateStats &s = *c.stats;
+    if (s.updates++ == 0)
+      s.first_update = time_point::current();
+    if (changed)
+      ++s.changes;
+    if (urgent)
+      ++s.urgent;
+  }
+
+  void mark_dirty(Cell &c, bool urgent) {
+    c.dirty = true;
+    if (wm().bar_visible()) {
+      scheduled_draw_cells = true;
+      if (urgent)
+        scheduled_urgent_draw = true;
+    }
+  }
+
+  void set_source(Cell &c, const ascii_string &name) {
+    c.source = name;
+    c.stats = &update_stats[name];
+  }
+
+  void log_update_stats() {
+    time_point now = time_point::current();
+    WARN("bar: %lu full draws, %lu cell draws, %lu deferred",
+         full_draws, cell_draws, deferred_draws);
+    for (auto const &x : update_stats) {
+      UpdateStats const &s = x.second;
+      double seconds = (now - s.first_update).total_milliseconds() / 1000.0;
+      WARN("bar: %s: %lu updates, %lu changes (%.3f/s), %lu urgent",
+           x.first.c_str(), s.updates, s.changes,
+           seconds > 0 ? s.changes / seconds : 0.0, s.urgent);
+    }
+  }
+
+  // Unmaps the icon if it should be hidden; returns true if so.
+  bool skip_tray(Cell &c) {
+    if (!c.tray_should_be_mapped) {
+      if (c.map_state != STATE_UNMAPPED) {
+        XUnmapWindow(wm().display(), c.tray_window);
+        c.map_state = STATE_UNMAPPED;
+      }
+      return true;
+    }
+    return false;
+  }
+
+  // Configures only the parts of the icon geometry that changed.
+  void place_tray(Cell &c, WRect const &icon_rect) {
+    XWindowChanges wc;
+    unsigned int mask = 0;
+    if (!c.tray_configured) {
+      wc.border_width = 0;
+      mask |= CWBorderWidth;
+      c.tray_configured = true;
+    }
+    if (c.current_tray_window_bounds.x != icon_rect.x) {
+      wc.x = icon_rect.x;
+      mask |= CWX;
+    }
+    if (c.current_tray_window_bounds.y != icon_rect.y) {
+      wc.y = icon_rect.y;
+      mask |= CWY;
+    }
+    if (c.current_tray_window_bounds.width != icon_rect.width) {
+      wc.width = icon_rect.width;
+      mask |= CWWidth;
+    }
+    if (c.current_tray_window_bounds.height != icon_rect.height) {
+      wc.height = icon_rect.height;
+      mask |= CWHeight;
+    }
+    if (mask) {
+      XConfigureWindow(wm().display(), c.tray_window, mask, &wc);
+      c.current_tray_window_bounds = icon_rect;
+    }
+    if (c.map_state != STATE_MAPPED) {
+      XMapRaised(wm().display(), c.tray_window);
+      c.map_state = STATE_MAPPED;
+    }
+  }
+
+  // Returns the end of the run of tray cells at the start of cells[RIGHT].
+  CellList::iterator tray_run_end() {
+    CellList::iterator it = cells[RIGHT].begin();
+    while (it != cells[RIGHT].end() && it->tray_window != None)
+      ++it;
+    return it;
+  }
+
+  // Lays out the leading tray run right to left within tray_area.
+  void layout_tray() {
+    WRect rect = tray_area;
+    CellList::reverse_iterator it(tray_run_end()), end = cells[RIGHT].rend();
+    for (; it != end; ++it) {
+      Cell &c = *it;
+      if (skip_tray(c))
+        continue;
+      int width = rect.height; // icons will be square
+      place_tray(c, WRect(rect.x + rect.width - width, rect.y, width, rect.height));
+      rect.width -= (width + style.cell_spacing);
+    }
+  }
+
+  int draw_cell(WDrawable &d, Cell &c, const WRect &available, bool right_aligned) {
+    return draw_label_with_background(d,
+                                      c.text,
+                                      style.label_font,
+                                      *c.foreground_color,
+                                      *c.background_color,
+                                      available,
+                                      style.label_horizontal_padding,
+                                      style.label_vertical_padding,
+                                      right_aligned);
+  }
+
+  // Redraws dirty cells in place, copying just their rectangles.  Falls
+  // back to a full draw if any cell changes width or visibility.
+  void draw_dirty_cells() {
+    ++cell_draws;
+    if (!buffer.valid(bounds.width, bounds.height)) {
+      draw();
+      return;
+    }
+
+    WDrawable &d = buffer.drawable();
+    std::vector<Cell *> redrawn;
+
+    for (int side = LEFT; side <= RIGHT; ++side) {
+      for (Cell &c : cells[side]) {
+        if (!c.dirty || c.tray_window != None)
+          continue;
+        c.dirty = false;
+        if (!c.drawn && !c.is_text_visible())
+          continue;
+        if (!c.drawn || !c.is_text_visible()
+            || draw_cell(d, c, c.available_rect, side == RIGHT) != c.rect.width) {
+          // The buffer may now be partially overdrawn; it is entirely
+          // redrawn before anything more is copied to the window.
+          draw();
+          return;
+        }
+        redrawn.push_back(&c);
+      }
+    }
+
+    for (Cell *c : redrawn)
+      buffer.copy_to(xwin_, c->rect);
   }
 
   void compute_bounds() {
@@ -189,8 +443,9 @@ struct WBar::Impl {
   int label_height() { return style.label_font.height() + 2 * style.label_vertical_padding; }
 
   void draw() {
-    WDrawable &d = wm().buffer_pixmap.drawable();
+    ++full_draws;
     WRect rect(0, 0, bounds.width, bounds.height);
+    WDrawable &d = buffer.prepare(rect.width, rect.height);
 
     fill_rect(d, style.background_color, rect);
 
@@ -203,54 +458,30 @@ struct WBar::Impl {
     WRect rect3 = rect2.inside_border(style.padding_pixels + style.spacing);
     rect3.height = label_height();
 
-    auto should_skip_tray = [&](Cell &c) {
-      if (!c.tray_should_be_mapped) {
-        if (c.map_state != STATE_UNMAPPED) {
-          XUnmapWindow(wm().display(), c.tray_window);
-          c.map_state = STATE_UNMAPPED;
-        }
-        return true;
-      }
-      return false;
-    };
-
-    auto handle_tray = [&](Cell &c, WRect const &icon_rect) {
-      if (c.map_state != STATE_MAPPED) {
-        XMapRaised(wm().display(), c.tray_window);
-        c.map_state = STATE_MAPPED;
-      }
-      if (c.current_tray_window_bounds != icon_rect) {
-        XMoveResizeWindow(wm().display(), c.tray_window, icon_rect.x, icon_rect.y, icon_rect.width, icon_rect.height);
-        c.current_tray_window_bounds = icon_rect;
-      }
-    };
-
     for (Cell & c : cells[LEFT]) {
       int width;
 
+      c.dirty = false;
+      c.drawn = false;
+
       if (c.tray_window != None) {
-        if (should_skip_tray(c))
+        if (skip_tray(c))
           continue;
 
         width = rect3.height; // icons will be square
         WRect icon_rect = rect3;
         icon_rect.width = width;
-        handle_tray(c, icon_rect);
+        place_tray(c, icon_rect);
       }
       // Check for placeholders
-      else if (!c.foreground_color || !c.background_color || c.text.empty())
+      else if (!c.is_text_visible())
         continue;
 
       else {
-        width = draw_label_with_background(d,
-                                           c.text,
-                                           style.label_font,
-                                           *c.foreground_color,
-                                           *c.background_color,
-                                           rect3,
-                                           style.label_horizontal_padding,
-                                           style.label_vertical_padding,
-                                           false);
+        width = draw_cell(d, c, rect3, false);
+        c.drawn = true;
+        c.available_rect = rect3;
+        c.rect = WRect(rect3.x, rect3.y, width, rect3.height);
       }
 
       rect3.width -= (width + style.cell_spacing);
@@ -258,39 +489,42 @@ struct WBar::Impl {
       rect3.x += width + style.cell_spacing;
     }
 
-    BOOST_REVERSE_FOREACH(Cell & c, cells[RIGHT]) {
+    CellList::reverse_iterator right_it = cells[RIGHT].rbegin(), right_end(tray_run_end());
+    for (; right_it != right_end; ++right_it) {
+      Cell &c = *right_it;
       int width;
 
+      c.dirty = false;
+      c.drawn = false;
+
       if (c.tray_window != None) {
-        if (!c.tray_should_be_mapped)
+        if (skip_tray(c))
           continue;
 
         width = rect3.height; // icons will be square
         WRect icon_rect = rect3;
         icon_rect.x = icon_rect.x + icon_rect.width - width;
         icon_rect.width = width;
-        handle_tray(c, icon_rect);
+        place_tray(c, icon_rect);
       }
 
       // Check for placeholders
-      else if (!c.foreground_color || !c.background_color || c.text.empty())
+      else if (!c.is_text_visible())
         continue;
       else  {
-        width = draw_label_with_background(d,
-                                           c.text,
-                                           style.label_font,
-                                           *c.foreground_color,
-                                           *c.background_color,
-                                           rect3,
-                                           style.label_horizontal_padding,
-                                           style.label_vertical_padding,
-                                           true);
+        width = draw_cell(d, c, rect3, true);
+        c.drawn = true;
+        c.available_rect = rect3;
+        c.rect = WRect(rect3.x + rect3.width - width, rect3.y, width, rect3.height);
       }
 
       rect3.width -= (width + style.cell_spacing);
     }
 
-    XCopyArea(wm().display(), d.drawable(), xwin(), wm().dc.gc(), 0, 0, bounds.width, bounds.height, 0, 0);
+    tray_area = rect3;
+    layout_tray();
+
+    buffer.copy_to(xwin(), rect);
   }
 
   Window xwin() { return xwin_; }
@@ -318,6 +552,10 @@ bool WM::bar_visible() {
 
 void WBar::flush() { impl_->flush(); }
 
+void WBar::set_min_redraw_interval(const time_duration &interval) { impl_->min_redraw_interval = interval; }
+
+void WBar::log_update_stats() { impl_->log_update_stats(); }
+
 void WBar::handle_screen_size_changed()
 {
   impl_->compute_bounds();
@@ -333,7 +571,8 @@ void WBar::handle_expose(const XExposeEvent &ev)
   if (!wm().bar_visible())
     return;
 
-  impl_->scheduled_draw = true;
+  impl_->buffer.add_damage(WRect(ev.x, ev.y, ev.width, ev.height));
+  impl_->scheduled_repaint = true;
 }
 
 
@@ -356,6 +595,9 @@ static WBar::CellRef do_insert(WBar::Impl *impl_, boost::shared_ptr<WBar::Cell>
     break;
   }
 
+  if (pos.ref.cell && !pos.ref.cell->source.empty() && cell->source.empty())
+    impl_->set_source(*cell, pos.ref.cell->source);
+
   if (impl_->wm().bar_visible())
     impl_->scheduled_draw = true;
 
@@ -379,27 +621,25 @@ void WBar::handle_tray_opcode(const XClientMessageEvent &ev) {
       return;
     }
 
-    /* Set the window border to 0 */
-    {
-      XWindowChanges wc;
-      wc.border_width = 0;
-      XConfigureWindow(wm().display(), w, CWBorderWidth, &wc);
-    }
-
     XSelectInput(wm().display(), w, StructureNotifyMask | PropertyChangeMask);
     XReparentWindow(wm().display(), w, xwin(), 0, 0);
-    Time timestamp = wm().get_timestamp();
+
+    // The border is reset and the icon placed by the next flush, which
+    // also sends XEMBED_EMBEDDED_NOTIFY.  The dock request carries its
+    // own timestamp, so no round trip is needed to obtain one.
     // FIXME: handle xembed map info
-    if (xwindow_send_client_msg32(wm().display(), w, w, impl_->xa_xembed, timestamp, XEMBED_EMBEDDED_NOTIFY, 0, xwin())) {
-      boost::shared_ptr<Cell> cell(new Cell(*this, RIGHT));
-      cell->tray_window = w;
-      cell->tray_should_be_mapped = true;
-      do_insert(impl_.get(), cell, this->begin(RIGHT));
-      impl_->tray_windows.emplace(w, cell);
-      printf("Adding tray window\n");
-    } else {
-      XRemoveFromSaveSet(wm().display(), w);
-    }
+    Time timestamp = ev.data.l[0];
+    if (timestamp == CurrentTime)
+      timestamp = wm().get_timestamp();
+    impl_->pending_embed_notify.emplace_back(w, timestamp);
+
+    boost::shared_ptr<Cell> cell(new Cell(*this, RIGHT));
+    cell->tray_window = w;
+    cell->tray_should_be_mapped = true;
+    impl_->cells[RIGHT].push_front(*cell);
+    impl_->scheduled_tray_layout = true;
+    impl_->tray_windows.emplace(w, cell);
+    printf("Adding tray window\n");
     return;
   }
   default:
@@ -409,36 +649,50 @@ void WBar::handle_tray_opcode(const XClientMessageEvent &ev) {
 
 void WBar::handle_unmap_notify(XUnmapEvent const &ev) {
   if (impl_->tray_windows.erase(ev.window)) {
+    auto &pending = impl_->pending_embed_notify;
+    pending.erase(std::remove_if(pending.begin(), pending.end(),
+                                 [&](std::pair<Window, Time> const &x) { return x.first == ev.window; }),
+                  pending.end());
     printf("Tray window was unmapped\n");
   }
 }
 
-void WBar::CellRef::set_text(const utf8_string &str)
+void WBar::CellRef::set_text(const utf8_string &str, bool urgent)
 {
-  cell->text = str;
-
-  if (!cell->bar.wm().bar_visible())
+  bool changed = cell->text != str;
+  cell->bar.impl_->record_update(*cell, changed, urgent);
+  if (!changed)
     return;
 
-  cell->bar.impl_->scheduled_draw = true;
+  cell->text = str;
+  cell->bar.impl_->mark_dirty(*cell, urgent);
 }
 
-void WBar::CellRef::set_foreground(const WColor &c)
+void WBar::CellRef::set_foreground(const WColor &c, bool urgent)
 {
-  cell->foreground_color = &c;
-
-  if (!cell->bar.wm().bar_visible())
+  bool changed = cell->foreground_color != &c;
+  cell->bar.impl_->record_update(*cell, changed, urgent);
+  if (!changed)
     return;
 
-  cell->bar.impl_->scheduled_draw = true;
+  cell->foreground_color = &c;
+  cell->bar.impl_->mark_dirty(*cell, urgent);
 }
 
-void WBar::CellRef::set_background(const WColor &c)
+void WBar::CellRef::set_background(const WColor &c, bool urgent)
 {
+  bool changed = cell->background_color != &c;
+  cell->bar.impl_->record_update(*cell, changed, urgent);
+  if (!changed)
+    return;
+
   cell->background_color = &c;
+  cell->bar.impl_->mark_dirty(*cell, urgent);
+}
 
-  if (cell->bar.wm().bar_visible())
-    cell->bar.impl_->scheduled_draw = true;
+void WBar::CellRef::set_source(const ascii_string &name)
+{
+  cell->bar.impl_->set_source(*cell, name);
 }
 
 bool WBar::CellRef::is_placeholder() const { return cell->foreground_color == 0; }
@@ -481,10 +735,26 @@ WBar::InsertPosition WBar::end(cell_position_t position) {
 
 WBar::Cell::~Cell()
 {
-  bar.impl_->cells[position].erase(bar.impl_->cells[position].iterator_to(*this));
+  Impl &impl = *bar.impl_;
+  Impl::CellList::iterator it = impl.cells[position].iterator_to(*this);
+
+  // Removing an icon from the leading tray run only moves other icons.
+  bool in_tray_run = false;
+  if (tray_window != None && position == RIGHT) {
+    Impl::CellList::iterator end = impl.tray_run_end();
+    for (Impl::CellList::iterator i = impl.cells[RIGHT].begin(); i != end; ++i)
+      if (i == it) {
+        in_tray_run = true;
+        break;
+      }
+  }
+
+  impl.cells[position].erase(it);
 
-  if (bar.wm().bar_visible())
-    bar.impl_->scheduled_draw = true;
+  if (in_tray_run)
+    impl.scheduled_tray_layout = true;
+  else if (bar.wm().bar_visible())
+    impl.scheduled_draw = true;
 }
 
 WBar::WBar(WM &wm_, const style::Spec &style_spec)
@@ -3,6 +3,7 @@
 
 #include <draw/draw.hpp>
 #include <style/style.hpp>
+#include <util/time.hpp>
 #include <memory>
 
 #include <X11/Xlib.h>
@@ -66,6 +67,14 @@ public:
   int height();
   void schedule_update_server();
 
+  /* Changes to cell text and colors are batched and drawn at most once
+     per interval, unless marked urgent.  A zero interval disables the
+     cap. */
+  void set_min_redraw_interval(const time_duration &interval);
+
+  /* Logs per-source update counts and redraw totals. */
+  void log_update_stats();
+
   class  CellRef
   {
   public:
@@ -88,15 +97,21 @@ public:
 
     const utf8_string &text() const;
 
-    void set_text(const utf8_string &str);
+    /* Urgent changes are drawn on the next flush, bypassing the
+       redraw interval. */
+    void set_text(const utf8_string &str, bool urgent = false);
 
-    void set_foreground(const WColor &c);
-    void set_background(const WColor &c);
-    void set_style(const WBarCellStyle &s)
+    void set_foreground(const WColor &c, bool urgent = false);
+    void set_background(const WColor &c, bool urgent = false);
+    void set_style(const WBarCellStyle &s, bool urgent = false)
     {
-      set_foreground(s.foreground_color);
-      set_background(s.background_color);
+      set_foreground(s.foreground_color, urgent);
+      set_background(s.background_color, urgent);
     }
+
+    /* Names the applet that updates this cell, for update statistics.
+       Cells inserted before or after this one inherit the name. */
+    void set_source(const ascii_string &name);
   };
 
   struct InsertPosition
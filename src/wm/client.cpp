@@ -4,6 +4,7 @@
 WClient::WClient(WM &wm, Window w)
   : wm_(wm),
     scheduled_tasks(0),
+    back_buffer(wm.dc),
     xwin_(w),
     flags_(0),
     fixed_height_(0),
@@ -498,6 +499,7 @@ void WClient::set_frame_map_state(map_state_t state)
     switch (state)
     {
     case STATE_MAPPED:
+      HiddenBackBufferList_base_hook::unlink();
       XMapWindow(wm().display(), frame_xwin_);
 
       /* Lower the frame window; frames should not obscure any other
@@ -506,6 +508,11 @@ void WClient::set_frame_map_state(map_state_t state)
       break;
     case STATE_UNMAPPED:
       XUnmapWindow(wm().display(), frame_xwin_);
+      if (back_buffer.size_in_bytes())
+      {
+        wm().hidden_back_buffers.push_back(*this);
+        wm().trim_hidden_back_buffers();
+      }
       break;
     }
     frame_map_state = state;
@@ -622,6 +629,9 @@ void WClient::perform_scheduled_tasks()
   if (f && (scheduled_tasks & (UPDATE_SERVER_FLAG | DRAW_FLAG)))
     f->draw();
 
+  if (f && (scheduled_tasks & REPAINT_FLAG))
+    f->repaint();
+
   if (f && f == wm().selected_frame())
 
   {
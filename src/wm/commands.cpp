@@ -2,6 +2,8 @@
 #include <wm/commands.hpp>
 #include <menu/menu.hpp>
 #include <menu/list_completion.hpp>
+#include <menu/frecency.hpp>
+#include <menu/path_commands.hpp>
 #include <util/spawn.hpp>
 #include <util/path.hpp>
 #include <wm/extra/cwd.hpp>
@@ -15,9 +17,11 @@ void WCommandList::add(const ascii_string &name,
   commands.insert(std::make_pair(name, action));
 }
 
-menu::Menu::Completer WCommandList::completer(const menu::list_completion::EntryStyle &style) const
+menu::Menu::Completer WCommandList::completer(const menu::list_completion::EntryStyle &style,
+                                              const menu::Frecency::RankingPtr &ranking) const
 {
-  return prefix_completer(boost::adaptors::transform(commands, select1st_compat<const ascii_string&>()), style);
+  return prefix_completer(boost::adaptors::transform(commands, select1st_compat<const ascii_string&>()),
+                          style, ranking);
 }
 
 void WCommandList::execute(const ascii_string &name) const
@@ -32,12 +36,13 @@ void WCommandList::execute(const ascii_string &name) const
   it->second();
 }
 
-void WCommandList::execute_interactive(WM &wm, const menu::list_completion::EntryStyle &style) const
+void WCommandList::execute_interactive(WM &wm, menu::Frecency &frecency,
+                                       const menu::list_completion::EntryStyle &style) const
 {
   wm.menu.read_string("Command:", menu::InitialState(),
-                      boost::bind(&WCommandList::execute, this, _1),
+                      frecency.recorder("command", boost::bind(&WCommandList::execute, this, _1)),
                       menu::Menu::FailureAction(),
-                      completer(style),
+                      completer(style, frecency.ranking("command")),
                       false /* no delay */);
 }
 
@@ -250,6 +255,33 @@ void execute_shell_command_selected_cwd(WM &wm, const ascii_string &command)
   return execute_shell_command_cwd(command, get_selected_cwd(wm));
 }
 
+void execute_command_cwd(const menu::path_commands::CommandIndex &commands,
+                         const ascii_string &command,
+                         const utf8_string &cwd)
+{
+  if (menu::path_commands::is_simple_command(command))
+  {
+    std::vector<std::string> words;
+    boost::algorithm::split(words, command, boost::algorithm::is_any_of(" "),
+                            boost::algorithm::token_compress_on);
+    words.erase(std::remove(words.begin(), words.end(), std::string()), words.end());
+    std::string path = words[0];
+    if (path.find('/') == std::string::npos)
+      path = commands.commands()->resolve(path);
+    if (!path.empty())
+    {
+      std::vector<char *> argv;
+      BOOST_FOREACH (std::string &w, words)
+        argv.push_back(&w[0]);
+      argv.push_back(0);
+      ascii_string resolved_cwd(expand_path_home(cwd));
+      spawnv(cwd.empty() ? 0 : resolved_cwd.c_str(), path.c_str(), &argv[0]);
+      return;
+    }
+  }
+  execute_shell_command_cwd(command, cwd);
+}
+
 void close_current_client(WM &wm)
 {
   if (WFrame *frame = wm.selected_frame())
@@ -262,7 +294,20 @@ void kill_current_client(WM &wm)
     frame->client().kill();
 }
 
-void execute_shell_command_cwd_interactive(WM &wm)
+static void execute_command_recorded(const menu::path_commands::CommandIndex &commands,
+                                     menu::Frecency &frecency,
+                                     const ascii_string &command,
+                                     const utf8_string &cwd)
+{
+  ascii_string::size_type begin = command.find_first_not_of(' ');
+  if (begin != ascii_string::npos)
+    frecency.record("shell-command", command.substr(begin, command.find(' ', begin) - begin));
+  execute_command_cwd(commands, command, cwd);
+}
+
+void execute_shell_command_cwd_interactive(WM &wm,
+                                           const menu::path_commands::CommandIndex &commands,
+                                           menu::Frecency &frecency)
 {
   utf8_string cwd = get_selected_cwd(wm);
   if (cwd.empty())
@@ -274,7 +319,12 @@ void execute_shell_command_cwd_interactive(WM &wm)
   }
 
   wm.menu.read_string(cwd + " $", menu::InitialState(),
-                      boost::bind(&execute_shell_command_cwd, _1, cwd));
+                      boost::bind(&execute_command_recorded, boost::cref(commands),
+                                  boost::ref(frecency), _1, cwd),
+                      menu::Menu::FailureAction(),
+                      menu::path_commands::command_completer(commands,
+                                                             frecency.ranking("shell-command")),
+                      false /* no delay */);
 }
 
 void switch_to_view(WM &wm, const utf8_string &name)
@@ -285,12 +335,14 @@ void switch_to_view(WM &wm, const utf8_string &name)
   wm.select_view(wm.get_or_create_view(name));
 }
 
-void switch_to_view_interactive(WM &wm, const menu::list_completion::EntryStyle &style)
+void switch_to_view_interactive(WM &wm, menu::Frecency &frecency,
+                                const menu::list_completion::EntryStyle &style)
 {
   wm.menu.read_string("Switch to tag:", menu::InitialState(),
-                      boost::bind(&switch_to_view, boost::ref(wm), _1),
+                      frecency.recorder("view", boost::bind(&switch_to_view, boost::ref(wm), _1)),
                       menu::Menu::FailureAction(),
-                      prefix_completer(boost::adaptors::transform(wm.views(), select1st_compat<ascii_string const &>()), style),
+                      prefix_completer(boost::adaptors::transform(wm.views(), select1st_compat<ascii_string const &>()),
+                                       style, frecency.ranking("view")),
                       false /* no delay */);
 }
 
@@ -335,15 +387,18 @@ void move_frame_to_view(const weak_iptr<WFrame> &weak_frame,
 }
 
 
-void move_current_frame_to_other_view_interactive(WM &wm, const menu::list_completion::EntryStyle &style)
+void move_current_frame_to_other_view_interactive(WM &wm, menu::Frecency &frecency,
+                                                  const menu::list_completion::EntryStyle &style)
 {
   if (WFrame *frame = wm.selected_frame())
   {
     wm.menu.read_string("Move to view:", menu::InitialState(),
-                        boost::bind(&move_frame_to_view, weak_iptr<WFrame>(frame), _1),
+                        frecency.recorder("view", boost::bind(&move_frame_to_view,
+                                                              weak_iptr<WFrame>(frame), _1)),
                         menu::Menu::FailureAction(),
                         menu::list_completion::prefix_completer
-                        (boost::adaptors::transform(wm.views(), select1st_compat<ascii_string const &>()), style),
+                        (boost::adaptors::transform(wm.views(), select1st_compat<ascii_string const &>()),
+                         style, frecency.ranking("view")),
                         false /* no delay */);
   }
 }
@@ -368,15 +423,18 @@ void copy_frame_to_view(const weak_iptr<WFrame> &weak_frame,
   }
 }
 
-void copy_current_frame_to_other_view_interactive(WM &wm, const menu::list_completion::EntryStyle &style)
+void copy_current_frame_to_other_view_interactive(WM &wm, menu::Frecency &frecency,
+                                                  const menu::list_completion::EntryStyle &style)
 {
   if (WFrame *frame = wm.selected_frame())
   {
     wm.menu.read_string("Duplicate to view:", menu::InitialState(),
-                        boost::bind(&copy_frame_to_view, weak_iptr<WFrame>(frame), _1),
+                        frecency.recorder("view", boost::bind(&copy_frame_to_view,
+                                                              weak_iptr<WFrame>(frame), _1)),
                         menu::Menu::FailureAction(),
                         menu::list_completion::prefix_completer
-                        (boost::adaptors::transform(wm.views(), select1st_compat<ascii_string const &>()), style),
+                        (boost::adaptors::transform(wm.views(), select1st_compat<ascii_string const &>()),
+                         style, frecency.ranking("view")),
                         false /* no delay */);
   }
 }
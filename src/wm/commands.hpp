@@ -3,6 +3,8 @@
 
 #include <wm/all.hpp>
 #include <menu/list_completion.hpp>
+#include <menu/frecency.hpp>
+#include <menu/path_commands.hpp>
 #include <menu/menu.hpp>
 
 class WM;
@@ -14,7 +16,8 @@ private:
   typedef std::map<ascii_string, Action> CommandMap;
   CommandMap commands;
 
-  menu::Menu::Completer completer(const menu::list_completion::EntryStyle &style) const;
+  menu::Menu::Completer completer(const menu::list_completion::EntryStyle &style,
+                                  const menu::Frecency::RankingPtr &ranking) const;
   
 public:
   void add(const ascii_string &name,
@@ -22,7 +25,8 @@ public:
   
   void execute(const ascii_string &name) const;
 
-  void execute_interactive(WM &wm, const menu::list_completion::EntryStyle &style) const;
+  void execute_interactive(WM &wm, menu::Frecency &frecency,
+                           const menu::list_completion::EntryStyle &style) const;
 };
 
 
@@ -50,15 +54,27 @@ void execute_shell_command_cwd(const ascii_string &command,
                                const utf8_string &cwd);
 void execute_shell_command_selected_cwd(WM &wm, const ascii_string &command);
 
-void execute_shell_command_cwd_interactive(WM &wm);
+/* Runs command directly, without the shell, if it is a plain list of
+   words naming a command on the path or by its path; otherwise as
+   execute_shell_command_cwd. */
+void execute_command_cwd(const menu::path_commands::CommandIndex &commands,
+                         const ascii_string &command,
+                         const utf8_string &cwd);
+
+void execute_shell_command_cwd_interactive(WM &wm,
+                                           const menu::path_commands::CommandIndex &commands,
+                                           menu::Frecency &frecency);
 
 void switch_to_view(WM &wm, const utf8_string &name);
-void switch_to_view_interactive(WM &wm, const menu::list_completion::EntryStyle &style);
+void switch_to_view_interactive(WM &wm, menu::Frecency &frecency,
+                                const menu::list_completion::EntryStyle &style);
 void switch_to_view_by_letter(WM &wm, char c);
 
 
-void copy_current_frame_to_other_view_interactive(WM &wm, const menu::list_completion::EntryStyle &style);
-void move_current_frame_to_other_view_interactive(WM &wm, const menu::list_completion::EntryStyle &style);
+void copy_current_frame_to_other_view_interactive(WM &wm, menu::Frecency &frecency,
+                                                  const menu::list_completion::EntryStyle &style);
+void move_current_frame_to_other_view_interactive(WM &wm, menu::Frecency &frecency,
+                                                  const menu::list_completion::EntryStyle &style);
 void remove_current_frame(WM &wm);
 
 void move_next_by_activity_in_column(WM &wm);
@@ -225,10 +225,9 @@ void WM::handle_expose(const XExposeEvent &ev)
 {
   if (WClient *client = client_of_framewin(ev.window))
   {
-    if (ev.count > 0)
-      return;
-
-    client->schedule_draw();
+    client->back_buffer.add_damage(WRect(ev.x, ev.y, ev.width, ev.height));
+    client->schedule_repaint();
+    expose_client_hook(client);
   }
   // TODO: maybe separate these two cases
   else if (ev.window == menu.xwin() || ev.window == menu.completions_xwin())
@@ -300,8 +299,6 @@ void WM::handle_xrandr_event(const XEvent &ev)
   {
     WARN("Screen configuration changed");
 
-    buffer_pixmap.reset(screen_width(), screen_height());
-
     BOOST_FOREACH (WView *view, boost::adaptors::transform(views_, select2nd_compat<WView*>()))
     {
       view->compute_bounds();
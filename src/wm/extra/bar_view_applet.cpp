@@ -11,6 +11,7 @@ void BarViewApplet::create_view(WView *view)
                                 style.normal.foreground_color,
                                 style.normal.background_color,
                                 view->name());
+    ref.set_source("bar_view");
     views.insert(std::make_pair(view, ref));
   } else
   {
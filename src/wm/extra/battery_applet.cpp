@@ -268,5 +268,6 @@ BatteryApplet::BatteryApplet(WM &wm,
     ev(wm.event_service(), boost::bind(&BatteryApplet::event_handler, this))
 {
   cell = wm.bar.insert(position, style.inactive);
+  cell.set_source("battery");
   event_handler();
 }
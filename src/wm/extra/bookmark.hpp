@@ -0,0 +1,19 @@
+#ifndef _WM_EXTRA_BOOKMARK_HPP
+#define _WM_EXTRA_BOOKMARK_HPP
+
+#include <util/string.hpp>
+#include <vector>
+
+class BookmarkSpec
+{
+public:
+  BookmarkSpec(const ascii_string &url, const utf8_string &title,
+               const std::vector<utf8_string> &categories)
+    : url(url), title(title), categories(categories) {}
+  BookmarkSpec() {}
+  ascii_string url;
+  utf8_string title;
+  std::vector<utf8_string> categories;
+};
+
+#endif /* _WM_EXTRA_BOOKMARK_HPP */
@@ -0,0 +1,295 @@
+
+#include <wm/extra/bookmark_index.hpp>
+#include <wm/extra/bookmark.hpp>
+#include <boost/foreach.hpp>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+  struct OwnedArrays
+  {
+    std::string folded_text;
+    std::vector<uint32_t> folded_offsets;
+    std::vector<uint32_t> trigrams;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> postings;
+  };
+}
+
+BookmarkIndex::Segment::Segment() {}
+
+BookmarkIndex::Segment::Segment(std::vector<BookmarkSpec> bookmarks)
+  : bookmarks_(std::move(bookmarks))
+{
+  boost::shared_ptr<OwnedArrays> owned(new OwnedArrays);
+  OwnedArrays &a = *owned;
+  a.folded_offsets.reserve(bookmarks_.size() + 1);
+
+  // (trigram << 32 | bookmark), each pair once
+  std::vector<uint64_t> pairs;
+  std::vector<uint32_t> keys;
+  for (uint32_t i = 0; i < bookmarks_.size(); ++i)
+  {
+    const BookmarkSpec &b = bookmarks_[i];
+    const size_t begin = a.folded_text.size();
+    a.folded_offsets.push_back(begin);
+    a.folded_text += fold(b.url);
+    a.folded_text += '\0';
+    a.folded_text += fold(b.title);
+    BOOST_FOREACH (const utf8_string &cat, b.categories)
+    {
+      a.folded_text += '\0';
+      a.folded_text += fold(cat);
+    }
+
+    keys.clear();
+    for (size_t p = begin; p + 3 <= a.folded_text.size(); ++p)
+    {
+      const unsigned char c0 = a.folded_text[p], c1 = a.folded_text[p + 1],
+        c2 = a.folded_text[p + 2];
+      // No word contains '\0', so trigrams across fields never match.
+      if (c0 == 0 || c1 == 0 || c2 == 0)
+        continue;
+      keys.push_back((uint32_t)c0 << 16 | (uint32_t)c1 << 8 | c2);
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    BOOST_FOREACH (uint32_t k, keys)
+      pairs.push_back((uint64_t)k << 32 | i);
+  }
+  a.folded_offsets.push_back(a.folded_text.size());
+
+  std::sort(pairs.begin(), pairs.end());
+
+  a.postings.reserve(pairs.size());
+  for (size_t j = 0; j < pairs.size(); ++j)
+  {
+    const uint32_t k = pairs[j] >> 32;
+    if (a.trigrams.empty() || a.trigrams.back() != k)
+    {
+      a.trigrams.push_back(k);
+      a.offsets.push_back(a.postings.size());
+    }
+    a.postings.push_back((uint32_t)pairs[j]);
+  }
+  a.offsets.push_back(a.postings.size());
+
+  arrays_.folded_text = a.folded_text.data();
+  arrays_.folded_offsets = a.folded_offsets.data();
+  arrays_.trigram_count = a.trigrams.size();
+  arrays_.trigrams = a.trigrams.data();
+  arrays_.offsets = a.offsets.data();
+  arrays_.postings = a.postings.data();
+  storage_ = owned;
+}
+
+BookmarkIndex::SegmentPtr
+BookmarkIndex::Segment::from_arrays(std::vector<BookmarkSpec> bookmarks, const Arrays &arrays,
+                                    size_t folded_text_size, size_t posting_count,
+                                    const boost::shared_ptr<const void> &storage)
+{
+  // Everything later indexed is checked, so that a corrupt snapshot
+  // can't make a lookup go out of bounds.
+  const size_t n = bookmarks.size();
+  if (arrays.folded_offsets[0] != 0 || arrays.folded_offsets[n] != folded_text_size)
+    return SegmentPtr();
+  for (size_t i = 0; i < n; ++i)
+    if (arrays.folded_offsets[i] > arrays.folded_offsets[i + 1])
+      return SegmentPtr();
+  if (arrays.offsets[0] != 0 || arrays.offsets[arrays.trigram_count] != posting_count)
+    return SegmentPtr();
+  for (size_t t = 0; t < arrays.trigram_count; ++t)
+  {
+    if (arrays.offsets[t] > arrays.offsets[t + 1]
+        || (t > 0 && arrays.trigrams[t - 1] >= arrays.trigrams[t]))
+      return SegmentPtr();
+    for (size_t j = arrays.offsets[t]; j < arrays.offsets[t + 1]; ++j)
+      if (arrays.postings[j] >= n
+          || (j > arrays.offsets[t] && arrays.postings[j - 1] >= arrays.postings[j]))
+        return SegmentPtr();
+  }
+
+  boost::shared_ptr<Segment> segment(new Segment);
+  segment->bookmarks_ = std::move(bookmarks);
+  segment->arrays_ = arrays;
+  segment->storage_ = storage;
+  return segment;
+}
+
+BookmarkIndex::Segment::~Segment() {}
+
+namespace
+{
+  /* Of the bookmarks with a URL, the one with the longest title, then
+     the most categories, is kept. */
+  class DuplicateOrder
+  {
+    const std::vector<const BookmarkSpec *> &bookmarks;
+  public:
+    DuplicateOrder(const std::vector<const BookmarkSpec *> &bookmarks)
+      : bookmarks(bookmarks) {}
+    bool operator()(uint32_t i, uint32_t j) const
+    {
+      const BookmarkSpec &a = *bookmarks[i], &b = *bookmarks[j];
+      int val = a.url.compare(b.url);
+      if (val != 0)
+        return val < 0;
+      if (a.title.size() != b.title.size())
+        return a.title.size() > b.title.size();
+      if (a.categories.size() != b.categories.size())
+        return a.categories.size() > b.categories.size();
+      return i < j;
+    }
+  };
+}
+
+BookmarkIndex::BookmarkIndex(const std::vector<SegmentPtr> &segments)
+  : segments_(segments)
+{
+  BOOST_FOREACH (const SegmentPtr &s, segments_)
+  {
+    bases_.push_back(bookmarks_.size());
+    for (size_t i = 0; i < s->bookmarks_.size(); ++i)
+    {
+      bookmarks_.push_back(&s->bookmarks_[i]);
+      const uint32_t *offsets = s->arrays_.folded_offsets;
+      folded_.push_back(boost::string_ref(s->arrays_.folded_text + offsets[i],
+                                          offsets[i + 1] - offsets[i]));
+    }
+  }
+
+  std::vector<uint32_t> order(bookmarks_.size());
+  for (uint32_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), DuplicateOrder(bookmarks_));
+  duplicate_.resize(order.size());
+  for (size_t j = 1; j < order.size(); ++j)
+    duplicate_[order[j]] = bookmarks_[order[j]]->url == bookmarks_[order[j - 1]]->url;
+}
+
+BookmarkIndex::~BookmarkIndex() {}
+
+std::string BookmarkIndex::fold(const utf8_string &s)
+{
+  // ifind_first compares in the classic locale, which only folds ASCII.
+  std::string result(s);
+  BOOST_FOREACH (char &c, result)
+    if (c >= 'A' && c <= 'Z')
+      c += 'a' - 'A';
+  return result;
+}
+
+bool BookmarkIndex::candidates(const std::vector<std::string> &folded_words,
+                               std::vector<uint32_t> &result) const
+{
+  result.clear();
+
+  std::vector<uint32_t> keys;
+  BOOST_FOREACH (const std::string &word, folded_words)
+  {
+    for (size_t p = 0; p + 3 <= word.size(); ++p)
+      keys.push_back((uint32_t)(unsigned char)word[p] << 16
+                     | (uint32_t)(unsigned char)word[p + 1] << 8
+                     | (unsigned char)word[p + 2]);
+  }
+  if (keys.empty())
+    return false;
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+  typedef std::pair<const uint32_t *, const uint32_t *> Range;
+  std::vector<Range> lists;
+  std::vector<uint32_t> matches;
+  for (size_t s = 0; s < segments_.size(); ++s)
+  {
+    const Segment::Arrays &a = segments_[s]->arrays_;
+    const uint32_t *trigrams_end = a.trigrams + a.trigram_count;
+    lists.clear();
+    BOOST_FOREACH (uint32_t k, keys)
+    {
+      const uint32_t *it = std::lower_bound(a.trigrams, trigrams_end, k);
+      if (it == trigrams_end || *it != k)
+        break;
+      const size_t t = it - a.trigrams;
+      lists.push_back(Range(a.postings + a.offsets[t], a.postings + a.offsets[t + 1]));
+    }
+    if (lists.size() != keys.size())
+      continue;
+
+    // Intersect starting from the shortest list, so the working set
+    // only shrinks.
+    std::sort(lists.begin(), lists.end(),
+              [](const Range &a, const Range &b)
+              { return a.second - a.first < b.second - b.first; });
+
+    matches.assign(lists[0].first, lists[0].second);
+    for (size_t l = 1; l < lists.size() && !matches.empty(); ++l)
+    {
+      std::vector<uint32_t>::iterator end
+        = std::set_intersection(matches.begin(), matches.end(),
+                                lists[l].first, lists[l].second, matches.begin());
+      matches.erase(end, matches.end());
+    }
+    BOOST_FOREACH (uint32_t i, matches)
+      if (!duplicate_[bases_[s] + i])
+        result.push_back(bases_[s] + i);
+  }
+  return true;
+}
+
+int BookmarkIndex::score(uint32_t i, const std::vector<std::string> &folded_words) const
+{
+  if (duplicate_[i])
+    return 0;
+  const char *const f = folded_[i].data(), *const f_end = f + folded_[i].size();
+  int score = 0;
+  bool none = true;
+  BOOST_FOREACH (const std::string &word, folded_words)
+  {
+    if (word.empty())
+      continue;
+
+    int cur_score = 0;
+    const char *begin = f;
+    for (;;)
+    {
+      const char *end = (const char *)memchr(begin, '\0', f_end - begin);
+      if (!end)
+        end = f_end;
+      // A match can't span a '\0', so the first one at or after begin
+      // is either in this field or past it.
+      const char *pos = (const char *)memmem(begin, f_end - begin, word.data(), word.size());
+      if (!pos)
+        break;
+      if (pos >= end)
+      {
+        begin = (const char *)memrchr(begin, '\0', pos - begin) + 1;
+        continue;
+      }
+      ++cur_score;
+      if (end == f_end)
+        break;
+      begin = end + 1;
+    }
+
+    if (cur_score == 0)
+      return 0;
+    score += cur_score;
+    none = false;
+  }
+  return none ? 0 : score;
+}
+
+bool BookmarkIndex::better(const std::pair<int, uint32_t> &a,
+                           const std::pair<int, uint32_t> &b) const
+{
+  if (a.first != b.first)
+    return a.first > b.first;
+  const BookmarkSpec &x = *bookmarks_[a.second], &y = *bookmarks_[b.second];
+  if (x.url.size() != y.url.size())
+    return x.url.size() < y.url.size();
+  if (x.title.size() != y.title.size())
+    return x.title.size() < y.title.size();
+  return a.second < b.second;
+}
@@ -0,0 +1,113 @@
+#ifndef _WM_EXTRA_BOOKMARK_INDEX_HPP
+#define _WM_EXTRA_BOOKMARK_INDEX_HPP
+
+#include <util/string.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+class BookmarkSpec;
+
+/**
+ * Trigram inverted index over the URL, title and categories of a set
+ * of bookmarks, case-folded as by boost::algorithm::ifind_first.
+ *
+ * A bookmark containing a word contains every trigram of it, so
+ * intersecting the posting lists of a query's trigrams gives a small
+ * superset of the matches, which are then verified and scored.
+ *
+ * The index is made of segments, each indexing the bookmarks of one
+ * source, so that when a source changes only its segment is rebuilt.
+ * Bookmarks are numbered across the segments in order.
+ */
+class BookmarkIndex
+{
+public:
+  class Segment
+  {
+  public:
+    /* The index proper, in arrays that may be owned by the segment or
+       point into a mapped snapshot.  The folded fields of bookmark i,
+       separated by '\0' (the URL, the title, then each category) are
+       folded_text[folded_offsets[i], folded_offsets[i + 1]).  The
+       distinct trigrams are in increasing order; the posting list of
+       trigrams[t], in increasing bookmark order, is
+       postings[offsets[t], offsets[t + 1]). */
+    struct Arrays
+    {
+      const char *folded_text;
+      const uint32_t *folded_offsets;
+      size_t trigram_count;
+      const uint32_t *trigrams;
+      const uint32_t *offsets;
+      const uint32_t *postings;
+    };
+
+  private:
+    friend class BookmarkIndex;
+    std::vector<BookmarkSpec> bookmarks_;
+    boost::shared_ptr<const void> storage_;
+    Arrays arrays_;
+
+    Segment();
+    Segment(const Segment &);
+    Segment &operator=(const Segment &);
+
+  public:
+    /* Folds and indexes bookmarks. */
+    explicit Segment(std::vector<BookmarkSpec> bookmarks);
+
+    /* Uses arrays already built for bookmarks, kept valid by storage.
+       Returns null if they are inconsistent. */
+    static boost::shared_ptr<const Segment>
+    from_arrays(std::vector<BookmarkSpec> bookmarks, const Arrays &arrays,
+                size_t folded_text_size, size_t posting_count,
+                const boost::shared_ptr<const void> &storage);
+
+    ~Segment();
+
+    const std::vector<BookmarkSpec> &bookmarks() const { return bookmarks_; }
+    const Arrays &arrays() const { return arrays_; }
+    size_t folded_text_size() const { return arrays_.folded_offsets[bookmarks_.size()]; }
+    size_t posting_count() const { return arrays_.offsets[arrays_.trigram_count]; }
+  };
+  typedef boost::shared_ptr<const Segment> SegmentPtr;
+
+private:
+  std::vector<SegmentPtr> segments_;
+  // The number of the first bookmark of each segment
+  std::vector<uint32_t> bases_;
+  std::vector<const BookmarkSpec *> bookmarks_;
+  std::vector<boost::string_ref> folded_;
+  // Bookmarks with the URL of a better one, which never match
+  std::vector<bool> duplicate_;
+
+public:
+  explicit BookmarkIndex(const std::vector<SegmentPtr> &segments);
+  ~BookmarkIndex();
+
+  const BookmarkSpec &bookmark(uint32_t i) const { return *bookmarks_[i]; }
+  size_t size() const { return bookmarks_.size(); }
+
+  static std::string fold(const utf8_string &s);
+
+  /* Sets result to the bookmarks, in increasing order, that may
+     contain every one of the folded words.  Returns false, leaving
+     result empty, if no word is long enough to narrow the search, in
+     which case every bookmark may. */
+  bool candidates(const std::vector<std::string> &folded_words,
+                  std::vector<uint32_t> &result) const;
+
+  /* The sum over the words of the number of fields of bookmark i
+     containing the word, or 0 if a word is in none. */
+  int score(uint32_t i, const std::vector<std::string> &folded_words) const;
+
+  /* Orders the (score, bookmark) pairs best first, as URL completion
+     lists them: by score, then shorter URL, then shorter title. */
+  bool better(const std::pair<int, uint32_t> &a,
+              const std::pair<int, uint32_t> &b) const;
+};
+
+#endif /* _WM_EXTRA_BOOKMARK_INDEX_HPP */
@@ -0,0 +1,356 @@
+
+#include <wm/extra/bookmark_snapshot.hpp>
+#include <wm/extra/bookmark.hpp>
+#include <util/log.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/foreach.hpp>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+BookmarkFileState::BookmarkFileState(const std::string &path)
+  : path(path), mtime_sec(0), mtime_nsec(0), size(-1)
+{
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0)
+  {
+    mtime_sec = st.st_mtim.tv_sec;
+    mtime_nsec = st.st_mtim.tv_nsec;
+    size = st.st_size;
+  }
+}
+
+/* Layout, with every part padded to a multiple of 8 bytes:
+
+   "JMSWMBIX", u32 version, u32 byte order mark, u64 file count,
+   u64 segment count
+
+   Per file: u64 path length, path, i64 mtime seconds, i64 mtime
+   nanoseconds, i64 size
+
+   Per segment: u64 bookmark count, u64 folded text size, u64 trigram
+   count, u64 posting count, u64 bookmark data size; the bookmark
+   data, each bookmark a u32-length-prefixed URL and title followed
+   by a u32 category count and the u32-length-prefixed categories;
+   then the folded text and the folded offsets, trigrams, offsets and
+   postings arrays of u32. */
+
+namespace
+{
+  const char snapshot_magic[8] = { 'J', 'M', 'S', 'W', 'M', 'B', 'I', 'X' };
+  // Change whenever the layout or the folding changes.
+  const uint32_t snapshot_version = 1;
+  const uint32_t byte_order_mark = 0x01020304;
+
+  class Writer
+  {
+    std::string out;
+  public:
+    const std::string &data() const { return out; }
+
+    void bytes(const void *p, size_t n)
+    {
+      out.append((const char *)p, n);
+    }
+    template <class T>
+    void value(T v)
+    {
+      bytes(&v, sizeof(v));
+    }
+    void string(const std::string &s)
+    {
+      value<uint32_t>(s.size());
+      bytes(s.data(), s.size());
+    }
+    void pad()
+    {
+      out.append((8 - out.size() % 8) % 8, '\0');
+    }
+  };
+
+  class Reader
+  {
+    const char *p, *const end;
+    bool ok_;
+  public:
+    Reader(const char *begin, const char *end) : p(begin), end(end), ok_(true) {}
+    bool ok() const { return ok_; }
+    size_t offset(const char *begin) const { return p - begin; }
+
+    const char *bytes(size_t n)
+    {
+      if (!ok_ || size_t(end - p) < n)
+      {
+        ok_ = false;
+        return 0;
+      }
+      const char *result = p;
+      p += n;
+      return result;
+    }
+    template <class T>
+    T value()
+    {
+      T v = T();
+      if (const char *b = bytes(sizeof(T)))
+        std::memcpy(&v, b, sizeof(T));
+      return v;
+    }
+    bool string(std::string &s)
+    {
+      uint32_t n = value<uint32_t>();
+      const char *b = bytes(n);
+      if (b)
+        s.assign(b, n);
+      return ok_;
+    }
+    /* Only valid where the data read so far is a multiple of 4 bytes
+       long from the page-aligned start. */
+    const uint32_t *u32_array(size_t count)
+    {
+      if (count > size_t(end - p) / 4)
+      {
+        ok_ = false;
+        return 0;
+      }
+      return (const uint32_t *)bytes(count * 4);
+    }
+    void pad(const char *begin)
+    {
+      bytes((8 - offset(begin) % 8) % 8);
+    }
+  };
+
+  class Mapping
+  {
+    void *addr;
+    size_t size;
+  public:
+    Mapping(void *addr, size_t size) : addr(addr), size(size) {}
+    ~Mapping() { munmap(addr, size); }
+  };
+
+  void write_array(Writer &w, const uint32_t *a, size_t count)
+  {
+    w.bytes(a, count * sizeof(uint32_t));
+    w.pad();
+  }
+}
+
+bool read_bookmark_snapshot(const boost::filesystem::path &path,
+                            std::vector<BookmarkFileState> &files,
+                            std::vector<BookmarkIndex::SegmentPtr> &segments)
+{
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    if (errno != ENOENT)
+      WARN_SYS("failed to open bookmark snapshot: %s", path.c_str());
+    return false;
+  }
+  struct stat st;
+  void *addr = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+    addr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+  {
+    WARN("failed to map bookmark snapshot: %s", path.c_str());
+    return false;
+  }
+  boost::shared_ptr<const void> mapping(new Mapping(addr, st.st_size));
+
+  const char *begin = (const char *)addr;
+  Reader r(begin, begin + st.st_size);
+  const char *magic = r.bytes(sizeof(snapshot_magic));
+  if (!magic || std::memcmp(magic, snapshot_magic, sizeof(snapshot_magic))
+      || r.value<uint32_t>() != snapshot_version
+      || r.value<uint32_t>() != byte_order_mark)
+  {
+    WARN("ignoring bookmark snapshot of another version: %s", path.c_str());
+    return false;
+  }
+  const uint64_t file_count = r.value<uint64_t>();
+  const uint64_t segment_count = r.value<uint64_t>();
+
+  std::vector<BookmarkFileState> new_files;
+  for (uint64_t i = 0; i < file_count && r.ok(); ++i)
+  {
+    BookmarkFileState f;
+    const uint64_t length = r.value<uint64_t>();
+    if (const char *b = r.bytes(length))
+      f.path.assign(b, length);
+    r.pad(begin);
+    f.mtime_sec = r.value<int64_t>();
+    f.mtime_nsec = r.value<int64_t>();
+    f.size = r.value<int64_t>();
+    new_files.push_back(f);
+  }
+
+  std::vector<BookmarkIndex::SegmentPtr> new_segments;
+  for (uint64_t i = 0; i < segment_count && r.ok(); ++i)
+  {
+    const uint64_t bookmark_count = r.value<uint64_t>();
+    const uint64_t folded_text_size = r.value<uint64_t>();
+    const uint64_t trigram_count = r.value<uint64_t>();
+    const uint64_t posting_count = r.value<uint64_t>();
+    const uint64_t data_size = r.value<uint64_t>();
+    if (bookmark_count >= UINT32_MAX)
+      break;
+
+    const char *data = r.bytes(data_size);
+    r.pad(begin);
+    std::vector<BookmarkSpec> bookmarks;
+    if (data)
+    {
+      Reader d(data, data + data_size);
+      bookmarks.reserve(std::min<uint64_t>(bookmark_count, data_size / 12));
+      for (uint64_t j = 0; j < bookmark_count && d.ok(); ++j)
+      {
+        bookmarks.push_back(BookmarkSpec());
+        BookmarkSpec &b = bookmarks.back();
+        d.string(b.url);
+        d.string(b.title);
+        uint32_t categories = d.value<uint32_t>();
+        for (uint32_t k = 0; k < categories && d.ok(); ++k)
+        {
+          b.categories.push_back(utf8_string());
+          d.string(b.categories.back());
+        }
+      }
+      if (!d.ok())
+        break;
+    }
+
+    BookmarkIndex::Segment::Arrays arrays;
+    arrays.folded_text = r.bytes(folded_text_size);
+    r.pad(begin);
+    arrays.folded_offsets = r.u32_array(bookmark_count + 1);
+    r.pad(begin);
+    arrays.trigram_count = trigram_count;
+    arrays.trigrams = r.u32_array(trigram_count);
+    r.pad(begin);
+    arrays.offsets = r.u32_array(trigram_count + 1);
+    r.pad(begin);
+    arrays.postings = r.u32_array(posting_count);
+    r.pad(begin);
+    if (!r.ok())
+      break;
+
+    BookmarkIndex::SegmentPtr segment
+      = BookmarkIndex::Segment::from_arrays(std::move(bookmarks), arrays, folded_text_size,
+                                            posting_count, mapping);
+    if (!segment)
+      break;
+    new_segments.push_back(segment);
+  }
+
+  if (!r.ok() || new_files.size() != file_count || new_segments.size() != segment_count)
+  {
+    WARN("ignoring corrupt bookmark snapshot: %s", path.c_str());
+    return false;
+  }
+
+  files.swap(new_files);
+  segments.swap(new_segments);
+  return true;
+}
+
+bool write_bookmark_snapshot(const boost::filesystem::path &path,
+                             const std::vector<BookmarkFileState> &files,
+                             const std::vector<BookmarkIndex::SegmentPtr> &segments)
+{
+  Writer w;
+  w.bytes(snapshot_magic, sizeof(snapshot_magic));
+  w.value(snapshot_version);
+  w.value(byte_order_mark);
+  w.value<uint64_t>(files.size());
+  w.value<uint64_t>(segments.size());
+
+  BOOST_FOREACH (const BookmarkFileState &f, files)
+  {
+    w.value<uint64_t>(f.path.size());
+    w.bytes(f.path.data(), f.path.size());
+    w.pad();
+    w.value(f.mtime_sec);
+    w.value(f.mtime_nsec);
+    w.value(f.size);
+  }
+
+  BOOST_FOREACH (const BookmarkIndex::SegmentPtr &s, segments)
+  {
+    Writer data;
+    BOOST_FOREACH (const BookmarkSpec &b, s->bookmarks())
+    {
+      data.string(b.url);
+      data.string(b.title);
+      data.value<uint32_t>(b.categories.size());
+      BOOST_FOREACH (const utf8_string &c, b.categories)
+        data.string(c);
+    }
+
+    const BookmarkIndex::Segment::Arrays &a = s->arrays();
+    w.value<uint64_t>(s->bookmarks().size());
+    w.value<uint64_t>(s->folded_text_size());
+    w.value<uint64_t>(a.trigram_count);
+    w.value<uint64_t>(s->posting_count());
+    w.value<uint64_t>(data.data().size());
+    w.bytes(data.data().data(), data.data().size());
+    w.pad();
+    w.bytes(a.folded_text, s->folded_text_size());
+    w.pad();
+    write_array(w, a.folded_offsets, s->bookmarks().size() + 1);
+    write_array(w, a.trigrams, a.trigram_count);
+    write_array(w, a.offsets, a.trigram_count + 1);
+    write_array(w, a.postings, s->posting_count());
+  }
+
+  try
+  {
+    boost::filesystem::create_directories(path.parent_path());
+  } catch (boost::filesystem::filesystem_error &e)
+  {
+    WARN("failed to create directory for bookmark snapshot: %s", e.what());
+    return false;
+  }
+
+  // Written beside the snapshot and renamed over it, so that a reader
+  // never maps a partly written or truncated file.
+  const std::string temp = path.string() + ".tmp." + std::to_string(getpid());
+  int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    WARN_SYS("failed to create bookmark snapshot: %s", temp.c_str());
+    return false;
+  }
+  const char *p = w.data().data();
+  size_t remaining = w.data().size();
+  while (remaining)
+  {
+    ssize_t n = write(fd, p, remaining);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      break;
+    p += n;
+    remaining -= n;
+  }
+  if (remaining || fsync(fd) != 0)
+  {
+    WARN_SYS("failed to write bookmark snapshot: %s", temp.c_str());
+    close(fd);
+    unlink(temp.c_str());
+    return false;
+  }
+  close(fd);
+  if (rename(temp.c_str(), path.c_str()) != 0)
+  {
+    WARN_SYS("failed to replace bookmark snapshot: %s", path.c_str());
+    unlink(temp.c_str());
+    return false;
+  }
+  return true;
+}
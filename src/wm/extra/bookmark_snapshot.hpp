@@ -0,0 +1,50 @@
+#ifndef _WM_EXTRA_BOOKMARK_SNAPSHOT_HPP
+#define _WM_EXTRA_BOOKMARK_SNAPSHOT_HPP
+
+#include <wm/extra/bookmark_index.hpp>
+#include <boost/filesystem/path.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* The state of a file bookmarks were read from, to tell whether they
+   are still current. */
+struct BookmarkFileState
+{
+  std::string path;
+  int64_t mtime_sec, mtime_nsec;
+  // -1 if the file did not exist
+  int64_t size;
+
+  BookmarkFileState() : mtime_sec(0), mtime_nsec(0), size(-1) {}
+
+  /* The state of path now. */
+  explicit BookmarkFileState(const std::string &path);
+
+  bool operator==(const BookmarkFileState &s) const
+  {
+    return path == s.path && mtime_sec == s.mtime_sec && mtime_nsec == s.mtime_nsec
+      && size == s.size;
+  }
+  bool operator!=(const BookmarkFileState &s) const { return !(*this == s); }
+};
+
+/**
+ * A snapshot file holds index segments together with the states of the
+ * files they were built from.  The trigram arrays and folded text are
+ * used from the mapped file as they are; only the bookmarks themselves
+ * are copied out.  The file is replaced atomically when written, and
+ * is in the machine's byte order.
+ */
+
+/* Returns false, logging why unless the file does not exist, if it
+   can't be read or is not a valid snapshot of this version. */
+bool read_bookmark_snapshot(const boost::filesystem::path &path,
+                            std::vector<BookmarkFileState> &files,
+                            std::vector<BookmarkIndex::SegmentPtr> &segments);
+
+bool write_bookmark_snapshot(const boost::filesystem::path &path,
+                             const std::vector<BookmarkFileState> &files,
+                             const std::vector<BookmarkIndex::SegmentPtr> &segments);
+
+#endif /* _WM_EXTRA_BOOKMARK_SNAPSHOT_HPP */
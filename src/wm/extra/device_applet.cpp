@@ -40,6 +40,7 @@ DeviceAppletState::DeviceAppletState(WM &wm,
     style(wm.dc, style_spec)
 {
   placeholder = wm.bar.placeholder(position);
+  placeholder.set_source("device");
 
   ignore_present.insert("cdrom");
   ignore_present.insert("winxp");
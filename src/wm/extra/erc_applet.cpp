@@ -108,6 +108,7 @@ ErcApplet::ErcApplet(WM &wm, const style::Spec &style_spec,
   
   wd = inotify.add_watch(erc_status_filename, IN_CLOSE_WRITE);
   placeholder = wm.bar.placeholder(pos);
+  placeholder.set_source("erc");
   update();
 }
 
@@ -90,6 +90,7 @@ GnusApplet::GnusApplet(WM &wm, const style::Spec &style_spec,
   
   wd = inotify.add_watch(mail_status_filename, IN_CLOSE_WRITE);
   placeholder = wm.bar.placeholder(pos);
+  placeholder.set_source("gnus");
   update();
 }
 
@@ -0,0 +1,287 @@
+
+#include <wm/extra/launch.hpp>
+#include <wm/extra/place.hpp>
+#include <util/log.hpp>
+#include <boost/bind.hpp>
+#include <X11/Xatom.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+/* Windows of programs started longer ago than this are placed
+   normally. */
+static const std::chrono::seconds launch_timeout(30);
+
+/* How far _NET_WM_PID may be below the process started. */
+static const int max_pid_depth = 4;
+
+/* The histograms are logged each time this many more launches have
+   shown a window. */
+static const unsigned long log_interval = 16;
+
+static double to_ms(LaunchTracker::Clock::duration d)
+{
+  return std::chrono::duration<double, std::milli>(d).count();
+}
+
+LaunchTracker::Histogram::Histogram()
+  : count_(0), total_ms(0)
+{
+  std::fill(buckets, buckets + bucket_count, 0);
+}
+
+void LaunchTracker::Histogram::add(Clock::duration d)
+{
+  double ms = to_ms(d);
+  int i = 0;
+  while (i + 1 < bucket_count && ms >= (1 << i))
+    ++i;
+  ++buckets[i];
+  ++count_;
+  total_ms += ms;
+}
+
+void LaunchTracker::Histogram::log(const char *name) const
+{
+  if (!count_)
+    return;
+  WARN("%s: %lu launches, mean %.1f ms", name, count_, total_ms / count_);
+  unsigned long most = *std::max_element(buckets, buckets + bucket_count);
+  for (int i = 0; i < bucket_count; ++i)
+  {
+    if (!buckets[i])
+      continue;
+    char range[32];
+    if (i + 1 == bucket_count)
+      snprintf(range, sizeof(range), ">= %d ms", 1 << (i - 1));
+    else
+      snprintf(range, sizeof(range), "< %d ms", 1 << i);
+    int width = (int)std::ceil(40.0 * buckets[i] / most);
+    WARN("  %10s %6lu %.*s", range, buckets[i], width,
+         "########################################");
+  }
+}
+
+LaunchTracker::LaunchTracker(WM &wm)
+  : wm(wm), next_sequence(0),
+    manage_conn(wm.manage_client_hook.connect
+                (boost::bind(&LaunchTracker::handle_manage_client, this, _1))),
+    place_conn(wm.place_client_hook.connect
+               (boost::bind(&LaunchTracker::handle_place_client, this, _1))),
+    post_place_conn(wm.post_place_client_hook.connect
+                    (boost::bind(&LaunchTracker::handle_post_place_client, this, _1))),
+    expose_conn(wm.expose_client_hook.connect
+                (boost::bind(&LaunchTracker::handle_expose_client, this, _1))),
+    unmanage_conn(wm.unmanage_client_hook.connect
+                  (boost::bind(&LaunchTracker::handle_unmanage_client, this, _1)))
+{
+  set_spawn_observer(boost::bind(&LaunchTracker::observe_spawn, this, _1, _2, _3));
+}
+
+LaunchTracker::~LaunchTracker()
+{
+  set_spawn_observer(SpawnObserver());
+  manage_conn.disconnect();
+  place_conn.disconnect();
+  post_place_conn.disconnect();
+  expose_conn.disconnect();
+  unmanage_conn.disconnect();
+}
+
+void LaunchTracker::observe_spawn(const char *path, std::vector<std::string> &env,
+                                  SpawnCallback &started)
+{
+  expire();
+
+  unsigned long sequence = next_sequence++;
+  char startup_id[64];
+  snprintf(startup_id, sizeof(startup_id), "jmswm-%d-%lu", (int)getpid(), sequence);
+
+  WView *view = wm.selected_view();
+  launches.push_back(Launch());
+  Launch &l = launches.back();
+  l.sequence = sequence;
+  l.path = path;
+  l.startup_id = startup_id;
+  l.pid = 0;
+  l.view.reset(view);
+  l.column.reset(view ? view->selected_column() : 0);
+  l.time = Clock::now();
+  l.mapped = false;
+
+  env.push_back(std::string("DESKTOP_STARTUP_ID=") + startup_id);
+  started = boost::bind(&LaunchTracker::handle_started, this, sequence, started, _1);
+}
+
+void LaunchTracker::handle_started(unsigned long sequence, const SpawnCallback &next, int pid)
+{
+  for (LaunchList::iterator it = launches.begin(); it != launches.end(); ++it)
+  {
+    if (it->sequence == sequence)
+    {
+      if (pid < 0)
+        launches.erase(it);
+      else
+        it->pid = pid;
+      break;
+    }
+  }
+  if (next)
+    next(pid);
+}
+
+void LaunchTracker::expire()
+{
+  Clock::time_point oldest = Clock::now() - launch_timeout;
+  while (!launches.empty() && launches.front().time < oldest)
+    launches.pop_front();
+}
+
+/* Returns 0 if the parent of pid cannot be read. */
+static int parent_pid(int pid)
+{
+  char path[32], buffer[512];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  FILE *f = fopen(path, "re");
+  if (!f)
+    return 0;
+  size_t n = fread(buffer, 1, sizeof(buffer) - 1, f);
+  fclose(f);
+  buffer[n] = 0;
+
+  // "pid (comm) state ppid ...", where comm may contain anything
+  const char *end = strrchr(buffer, ')');
+  int ppid;
+  if (!end || sscanf(end + 1, " %*c %d", &ppid) != 1)
+    return 0;
+  return ppid;
+}
+
+LaunchTracker::LaunchList::iterator LaunchTracker::find_launch(WClient *client)
+{
+  Display *dpy = wm.display();
+
+  utf8_string startup_id;
+  if (xwindow_get_utf8_property(dpy, client->xwin(), wm.atom_net_startup_id, startup_id))
+  {
+    // Programs may append "_TIME<timestamp>".
+    for (LaunchList::iterator it = launches.begin(); it != launches.end(); ++it)
+      if (startup_id.compare(0, it->startup_id.size(), it->startup_id) == 0
+          && (startup_id.size() == it->startup_id.size()
+              || startup_id[it->startup_id.size()] == '_'))
+        return it;
+  }
+
+  long *p = 0;
+  if (!xwindow_get_property(dpy, client->xwin(), wm.atom_net_wm_pid, XA_CARDINAL,
+                            1, false, (unsigned char **)&p))
+    return launches.end();
+  int pid = (int)*p;
+  XFree(p);
+
+  for (int depth = 0; depth < max_pid_depth && pid > 1; ++depth)
+  {
+    for (LaunchList::iterator it = launches.begin(); it != launches.end(); ++it)
+      if (it->pid == pid)
+        return it;
+    pid = parent_pid(pid);
+  }
+  return launches.end();
+}
+
+void LaunchTracker::handle_manage_client(WClient *client)
+{
+  if (launches.empty())
+    return;
+  expire();
+
+  LaunchList::iterator it = find_launch(client);
+  if (it == launches.end())
+    return;
+
+  Target t;
+  t.view.reset(it->view.get());
+  t.column.reset(it->column.get());
+  t.time = it->time;
+  t.first = !it->mapped;
+  targets.insert(std::make_pair(client, t));
+
+  if (!it->mapped)
+  {
+    it->mapped = true;
+    Clock::duration d = Clock::now() - it->time;
+    map_latency.add(d);
+    DEBUG("%s: mapped after %.1f ms", it->path.c_str(), to_ms(d));
+  }
+}
+
+bool LaunchTracker::handle_place_client(WClient *client)
+{
+  TargetMap::iterator it = targets.find(client);
+  if (it == targets.end())
+    return false;
+
+  WView *view = it->second.view.get();
+  WColumn *column = it->second.column.get();
+  if (!view)
+    return false;
+
+  WFrame *frame;
+  if (column && column->view() == view)
+  {
+    WColumn::iterator pos = column->selected_position();
+    if (pos != column->frames.end())
+      ++pos;
+    frame = &*column->add_frame(new WFrame(*client), pos);
+  }
+  else
+    frame = place_client_in_smallest_column(view, client);
+
+  // Only warps if the view it was started from is still selected;
+  // otherwise it is selected for when the user goes back.
+  view->select_frame(frame, view == wm.selected_view());
+  return true;
+}
+
+void LaunchTracker::handle_post_place_client(WClient *client)
+{
+  TargetMap::iterator it = targets.find(client);
+  if (it == targets.end())
+    return;
+
+  // Exposes of a window placed in another view wait for the user.
+  if (it->second.first && client->visible_frame())
+    awaiting_expose.insert(std::make_pair(client, it->second.time));
+  targets.erase(it);
+}
+
+void LaunchTracker::handle_expose_client(WClient *client)
+{
+  if (awaiting_expose.empty())
+    return;
+  ExposeMap::iterator it = awaiting_expose.find(client);
+  if (it == awaiting_expose.end())
+    return;
+
+  Clock::duration d = Clock::now() - it->second;
+  awaiting_expose.erase(it);
+  expose_latency.add(d);
+  DEBUG("%s: exposed after %.1f ms", client->name().c_str(), to_ms(d));
+
+  if (expose_latency.count() % log_interval == 0)
+    log_histograms();
+}
+
+void LaunchTracker::handle_unmanage_client(WClient *client)
+{
+  targets.erase(client);
+  awaiting_expose.erase(client);
+}
+
+void LaunchTracker::log_histograms() const
+{
+  map_latency.log("launch to MapRequest");
+  expose_latency.log("launch to first expose");
+}
@@ -0,0 +1,104 @@
+#ifndef _WM_EXTRA_LAUNCH_HPP
+#define _WM_EXTRA_LAUNCH_HPP
+
+#include <wm/all.hpp>
+#include <util/spawn.hpp>
+#include <chrono>
+#include <list>
+#include <map>
+
+/**
+ * Follows the programs started with spawnve until their windows
+ * appear, so that each window is placed in the view and column that
+ * were selected when it was started, even if another view has been
+ * selected since.
+ *
+ * A window is matched to its launch by _NET_STARTUP_ID, which programs
+ * supporting startup notification copy from DESKTOP_STARTUP_ID, and
+ * otherwise by _NET_WM_PID, which may also be that of a descendant of
+ * the program started, such as a shell.
+ *
+ * The time from each launch to the MapRequest of its first window, and
+ * to the frame of that window first being exposed, is kept in
+ * histograms, which are logged every so often.
+ */
+class LaunchTracker
+{
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  /* Counts durations in power-of-two millisecond buckets: [0, 1),
+     [1, 2), [2, 4), ..., with the last one unbounded. */
+  class Histogram
+  {
+  public:
+    static const int bucket_count = 15;
+    Histogram();
+    void add(Clock::duration d);
+    unsigned long count() const { return count_; }
+    void log(const char *name) const;
+  private:
+    unsigned long buckets[bucket_count];
+    unsigned long count_;
+    double total_ms;
+  };
+
+private:
+  struct Launch
+  {
+    unsigned long sequence;
+    std::string path;
+    std::string startup_id;
+    int pid;                  // 0 until known
+    weak_iptr<WView> view;
+    weak_iptr<WColumn> column;
+    Clock::time_point time;
+    bool mapped;
+  };
+  typedef std::list<Launch> LaunchList;
+
+  struct Target
+  {
+    weak_iptr<WView> view;
+    weak_iptr<WColumn> column;
+    Clock::time_point time;
+    bool first;
+  };
+  typedef std::map<WClient *, Target> TargetMap;
+  typedef std::map<WClient *, Clock::time_point> ExposeMap;
+
+  WM &wm;
+  LaunchList launches;
+  unsigned long next_sequence;
+
+  // Matched by manage_client_hook, for place_client_hook
+  TargetMap targets;
+
+  // First windows of launches, waiting to be exposed
+  ExposeMap awaiting_expose;
+
+  Histogram map_latency, expose_latency;
+
+  boost::signals2::connection manage_conn, place_conn, post_place_conn,
+    expose_conn, unmanage_conn;
+
+  void observe_spawn(const char *path, std::vector<std::string> &env,
+                     SpawnCallback &started);
+  void handle_started(unsigned long sequence, const SpawnCallback &next, int pid);
+  void expire();
+  LaunchList::iterator find_launch(WClient *client);
+
+  void handle_manage_client(WClient *client);
+  bool handle_place_client(WClient *client);
+  void handle_post_place_client(WClient *client);
+  void handle_expose_client(WClient *client);
+  void handle_unmanage_client(WClient *client);
+
+public:
+  explicit LaunchTracker(WM &wm);
+  ~LaunchTracker();
+
+  void log_histograms() const;
+};
+
+#endif /* _WM_EXTRA_LAUNCH_HPP */
@@ -43,6 +43,7 @@ NetworkAppletState::NetworkAppletState(WM &wm,
     inotify(wm.event_service(), boost::bind(&NetworkAppletState::inotify_handler, this, _1, _2, _3, _4))
 {
   placeholder = wm.bar.placeholder(position);
+  placeholder.set_source("network");
   skfd = iw_sockets_open();
 
   // Initialize req structs
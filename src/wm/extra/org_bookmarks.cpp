@@ -0,0 +1,238 @@
+
+#include <wm/extra/org_bookmarks.hpp>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+
+  inline bool is_blank(char c)
+  {
+    return c == ' ' || c == '\t';
+  }
+
+  // [/0-9A-Za-z_!~*'.;?:@&=+$,%#-], the characters of a bare URL
+  struct URLChars
+  {
+    bool table[256];
+    constexpr URLChars() : table()
+    {
+      for (int c = '0'; c <= '9'; ++c)
+        table[c] = true;
+      for (int c = 'A'; c <= 'Z'; ++c)
+        table[c] = table[c - 'A' + 'a'] = true;
+      const char extra[] = "/_!~*'.;?:@&=+$,%#-";
+      for (int i = 0; extra[i]; ++i)
+        table[(unsigned char)extra[i]] = true;
+    }
+  };
+  constexpr URLChars url_chars;
+
+  /* If [p, end) starts with http://, https:// or ftp://, the end of
+     the "://"; otherwise null. */
+  const char *match_scheme(const char *p, const char *end)
+  {
+    size_t n = end - p;
+    if (n >= 8 && !std::memcmp(p, "https://", 8))
+      return p + 8;
+    if (n >= 7 && !std::memcmp(p, "http://", 7))
+      return p + 7;
+    if (n >= 6 && !std::memcmp(p, "ftp://", 6))
+      return p + 6;
+    return 0;
+  }
+
+  struct Match
+  {
+    const char *begin, *end;
+    const char *url_begin, *url_end;
+    const char *title_begin, *title_end;
+  };
+
+  /* The leftmost [[url][title]] link in [p, end), where the URL has
+     a scheme as above and neither part is empty or contains ']'. */
+  bool find_org_link(const char *p, const char *end, Match &m)
+  {
+    while (p != end && (p = (const char *)std::memchr(p, '[', end - p)))
+    {
+      const char *start = p++;
+      if (p == end || *p != '[')
+        continue;
+      const char *url = p + 1;
+      const char *rest = match_scheme(url, end);
+      if (!rest)
+        continue;
+      const char *url_end = (const char *)std::memchr(rest, ']', end - rest);
+      if (!url_end || url_end == rest || url_end + 1 == end || url_end[1] != '[')
+        continue;
+      const char *title = url_end + 2;
+      const char *title_end = (const char *)std::memchr(title, ']', end - title);
+      if (!title_end || title_end == title || title_end + 1 == end || title_end[1] != ']')
+        continue;
+      m.begin = start;
+      m.end = title_end + 2;
+      m.url_begin = url;
+      m.url_end = url_end;
+      m.title_begin = title;
+      m.title_end = title_end;
+      return true;
+    }
+    return false;
+  }
+
+  /* The leftmost bare URL in [p, end), with as many URL characters
+     after the scheme as follow it, at least one. */
+  bool find_text_url(const char *p, const char *end, Match &m)
+  {
+    const char *q = p;
+    while (end - q >= 3 && (q = (const char *)memmem(q, end - q, "://", 3)))
+    {
+      // The schemes end in different letters, so at most one fits.
+      const char *start = 0;
+      if (q - p >= 5 && !std::memcmp(q - 5, "https", 5))
+        start = q - 5;
+      else if (q - p >= 4 && !std::memcmp(q - 4, "http", 4))
+        start = q - 4;
+      else if (q - p >= 3 && !std::memcmp(q - 3, "ftp", 3))
+        start = q - 3;
+      q += 3;
+      if (!start)
+        continue;
+      const char *e = q;
+      while (e != end && url_chars.table[(unsigned char)*e])
+        ++e;
+      if (e == q)
+        continue;
+      m.begin = m.url_begin = start;
+      m.end = m.url_end = e;
+      m.title_begin = m.title_end = e;
+      return true;
+    }
+    return false;
+  }
+
+  const char category_prefix[] = "#+CATEGORY:";
+  const size_t category_prefix_length = sizeof(category_prefix) - 1;
+
+}
+
+void parse_org_bookmarks(const char *begin, const char *end,
+                         std::vector<BookmarkSpec> &result)
+{
+  std::vector<utf8_string> categories;
+
+  const char *line = begin;
+  while (line != end)
+  {
+    const char *newline = (const char *)std::memchr(line, '\n', end - line);
+    const char *line_end = newline ? newline : end;
+    const char *next_line = newline ? newline + 1 : end;
+
+    // #+CATEGORY: with a non-blank value
+    if (size_t(line_end - line) >= category_prefix_length
+        && !std::memcmp(line, category_prefix, category_prefix_length))
+    {
+      const char *value = line + category_prefix_length;
+      while (value != line_end && is_blank(*value))
+        ++value;
+      if (value != line_end)
+      {
+        categories.resize(1);
+        categories[0].assign(value, line_end);
+        line = next_line;
+        continue;
+      }
+    }
+
+    // A heading with a non-blank title and no further '*'.  Nested
+    // headings replace each other rather than nesting as categories.
+    if (line != line_end && *line == '*')
+    {
+      const char *title = line;
+      while (title != line_end && *title == '*')
+        ++title;
+      while (title != line_end && is_blank(*title))
+        ++title;
+      if (title != line_end && !std::memchr(title, '*', line_end - title))
+      {
+        categories.resize(2);
+        categories[1].assign(title, line_end);
+      }
+    }
+
+    // Once a line has no link left it never has one again, so only
+    // bare URLs are looked for after that.
+    bool links = true;
+    const char *p = line;
+    Match m;
+    while (p != line_end)
+    {
+      if (links && find_org_link(p, line_end, m))
+      {
+        result.push_back(BookmarkSpec(ascii_string(m.url_begin, m.url_end),
+                                      utf8_string(m.title_begin, m.title_end),
+                                      categories));
+      } else
+      {
+        links = false;
+        if (!find_text_url(p, line_end, m))
+          break;
+        result.push_back(BookmarkSpec(ascii_string(m.url_begin, m.url_end),
+                                      utf8_string(), categories));
+      }
+      p = m.end;
+    }
+
+    line = next_line;
+  }
+}
+
+bool read_org_bookmarks(const boost::filesystem::path &path,
+                        std::vector<BookmarkSpec> &result)
+{
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  // Read rather than mapped: a file truncated by an editor while
+  // mapped would raise SIGBUS in the window manager.  One byte more
+  // than the size is asked for, to notice a file that has grown.
+  size_t capacity = st.st_size + 1, length = 0;
+  std::unique_ptr<char[]> buffer(new char[capacity]);
+  for (;;)
+  {
+    if (length == capacity)
+    {
+      std::unique_ptr<char[]> larger(new char[capacity * 2]);
+      std::memcpy(larger.get(), buffer.get(), length);
+      buffer.swap(larger);
+      capacity *= 2;
+    }
+    ssize_t n = read(fd, buffer.get() + length, capacity - length);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+    {
+      close(fd);
+      return false;
+    }
+    if (n == 0)
+      break;
+    length += n;
+  }
+  close(fd);
+
+  parse_org_bookmarks(buffer.get(), buffer.get() + length, result);
+  return true;
+}
@@ -0,0 +1,27 @@
+#ifndef _WM_EXTRA_ORG_BOOKMARKS_HPP
+#define _WM_EXTRA_ORG_BOOKMARKS_HPP
+
+#include <wm/extra/bookmark.hpp>
+#include <boost/filesystem/path.hpp>
+#include <vector>
+
+/**
+ * Appends the bookmarks found in the org text [begin, end).
+ *
+ * Every [[url][title]] link and bare http, https or ftp URL is a
+ * bookmark; its categories are the last #+CATEGORY value followed by
+ * the title of the last heading below it.  A line is searched for a
+ * link first, then for a bare URL, from the end of the previous
+ * match.  Bytes are matched as they are, with no decoding.
+ *
+ * Keeps no state, so it may run on any number of threads at once.
+ */
+void parse_org_bookmarks(const char *begin, const char *end,
+                         std::vector<BookmarkSpec> &result);
+
+/* Reads path into memory and parses it as above.  Returns false,
+   appending nothing, if it cannot be read. */
+bool read_org_bookmarks(const boost::filesystem::path &path,
+                        std::vector<BookmarkSpec> &result);
+
+#endif /* _WM_EXTRA_ORG_BOOKMARKS_HPP */
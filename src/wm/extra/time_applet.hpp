@@ -42,6 +42,7 @@ public:
       ev(wm.event_service(), boost::bind(&TimeApplet::event_handler, this))
   {
     cell = wm.bar.insert(position, style);
+    cell.set_source("time");
     event_handler();
   }
 };
@@ -87,6 +87,7 @@ VolumeAppletState::VolumeAppletState(WM &wm, const style::Spec &style_spec,
   : wm(wm), style(wm.dc, style_spec)
 {
   cell = wm.bar.insert(position, style.unmuted);
+  cell.set_source("volume");
 
 
   try
@@ -268,11 +269,12 @@ void VolumeAppletState::update_info(int volume_percent, bool muted)
 {
   char buffer[50];
   sprintf(buffer, "vol: %d%%", volume_percent);
-  cell.set_text(buffer);
+  // Volume changes are usually interactive, so draw them immediately.
+  cell.set_text(buffer, true);
   if (muted)
-    cell.set_style(style.muted);
+    cell.set_style(style.muted, true);
   else
-    cell.set_style(style.unmuted);
+    cell.set_style(style.unmuted, true);
 }
 
 VolumeApplet::VolumeApplet(WM &wm,
@@ -1,11 +1,13 @@
 #include <wm/extra/web_browser.hpp>
+#include <wm/extra/bookmark_index.hpp>
+#include <wm/extra/org_bookmarks.hpp>
 #include <wm/wm.hpp>
 #include <menu/menu.hpp>
 #include <menu/url_completion.hpp>
 #include <boost/bind.hpp>
 #include <util/range.hpp>
 #include <util/path.hpp>
-#include <boost/optional.hpp>
+#include <atomic>
 #include <map>
 #include <set>
 #include <boost/filesystem/operations.hpp>
@@ -16,6 +18,12 @@
 #include <util/spawn.hpp>
 #include <wm/commands.hpp>
 #include <wm/extra/cwd.hpp>
+#include <util/event.hpp>
+#include <util/thread_pool.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+#include <sys/inotify.h>
+#include <sys/stat.h>
 
 using menu::url_completion::URLSpec;
 
@@ -23,20 +31,36 @@ PROPERTY_ACCESSOR(WClient, utf8_string, web_browser_title)
 PROPERTY_ACCESSOR(WClient, ascii_string, web_browser_url)
 PROPERTY_ACCESSOR(WClient, ascii_string, web_browser_tag)
 
-menu::Menu::Completer url_completer(const boost::shared_ptr<BookmarkSource> &source,
-                                    const menu::url_completion::Style &style);
+menu::Menu::StreamingCompleter url_completer(const boost::shared_ptr<BookmarkSource> &source,
+                                             const menu::url_completion::Style &style,
+                                             const menu::Frecency::RankingPtr &ranking);
 
 
 
+BookmarkSource::BookmarkSource()
+  : index_revision(0), segment_revision(0)
+{}
+
 BookmarkSource::~BookmarkSource() {}
 
+void BookmarkSource::wait_for_load() {}
+
+uint64_t BookmarkSource::next_revision()
+{
+  static std::atomic<uint64_t> last(0);
+  return ++last;
+}
+
 AggregateBookmarkSource::~AggregateBookmarkSource() {}
 
-AggregateBookmarkSource::AggregateBookmarkSource() {}
+AggregateBookmarkSource::AggregateBookmarkSource()
+  : revision_(next_revision())
+{}
 
 void AggregateBookmarkSource::add_source(const boost::shared_ptr<BookmarkSource> &source)
 {
   sources.push_back(source);
+  revision_ = next_revision();
 }
 
 void AggregateBookmarkSource::get_bookmarks(std::vector<BookmarkSpec> &result)
@@ -45,50 +69,78 @@ void AggregateBookmarkSource::get_bookmarks(std::vector<BookmarkSpec> &result)
                   boost::bind(&BookmarkSource::get_bookmarks, _1, boost::ref(result)));
 }
 
+void AggregateBookmarkSource::get_index_segments(std::vector<BookmarkIndex::SegmentPtr> &result)
+{
+  BOOST_FOREACH (const boost::shared_ptr<BookmarkSource> &s, sources)
+    s->get_index_segments(result);
+}
+
+void AggregateBookmarkSource::get_file_states(std::vector<BookmarkFileState> &result)
+{
+  BOOST_FOREACH (const boost::shared_ptr<BookmarkSource> &s, sources)
+    s->get_file_states(result);
+}
+
+void AggregateBookmarkSource::wait_for_load()
+{
+  BOOST_FOREACH (const boost::shared_ptr<BookmarkSource> &s, sources)
+    s->wait_for_load();
+}
+
+uint64_t AggregateBookmarkSource::revision()
+{
+  // Revisions only increase, so a reload anywhere raises the maximum.
+  uint64_t r = revision_;
+  BOOST_FOREACH (const boost::shared_ptr<BookmarkSource> &s, sources)
+    r = std::max(r, s->revision());
+  return r;
+}
+
 namespace
 {
 
   class FileCacheManager
   {
-    boost::optional<std::time_t> last_update_time;
+    BookmarkFileState state_;
+    bool loaded;
     boost::filesystem::path path_;
   public:
     FileCacheManager(const boost::filesystem::path &path);
     const boost::filesystem::path &path() const { return path_; }
+    /* The state when last loaded. */
+    const BookmarkFileState &state() const { return state_; }
     bool update_needed();
   };
 
   FileCacheManager::FileCacheManager(const boost::filesystem::path &path)
-    : path_(path)
-  {}
+    : loaded(false), path_(path)
+  {
+    state_.path = path.string();
+  }
 
   bool FileCacheManager::update_needed()
   {
-    try
-    {
-      std::time_t t = last_write_time(path_);
-      if (!last_update_time || last_update_time.get() != t)
-      {
-        last_update_time = t;
-        return true;
-      }
-      return false;
-    } catch (boost::filesystem::filesystem_error &e)
-    {
-      // FIXME: decide how to handle this exception
+    BookmarkFileState s(path_.string());
+    // A file that can't be found keeps what was last loaded from it.
+    if (s.size < 0 || (loaded && s == state_))
       return false;
-    }
+    state_ = s;
+    loaded = true;
+    return true;
   }
 
   class OrgFileBookmarkSource : public BookmarkSource
   {
     FileCacheManager file_manager;
     std::vector<BookmarkSpec> cache;
+    uint64_t revision_;
     void update_cache();
   public:
     OrgFileBookmarkSource(const boost::filesystem::path &path);
     const boost::filesystem::path &path() const { return file_manager.path(); }
     virtual void get_bookmarks(std::vector<BookmarkSpec> &result);
+    virtual uint64_t revision();
+    virtual void get_file_states(std::vector<BookmarkFileState> &result);
     virtual ~OrgFileBookmarkSource();
   };
 
@@ -100,8 +152,20 @@ namespace
     result.insert(result.end(), cache.begin(), cache.end());
   }
 
+  uint64_t OrgFileBookmarkSource::revision()
+  {
+    update_cache();
+    return revision_;
+  }
+
+  void OrgFileBookmarkSource::get_file_states(std::vector<BookmarkFileState> &result)
+  {
+    update_cache();
+    result.push_back(file_manager.state());
+  }
+
   OrgFileBookmarkSource::OrgFileBookmarkSource(const boost::filesystem::path &path)
-    : file_manager(path)
+    : file_manager(path), revision_(0)
   {}
 
   void OrgFileBookmarkSource::update_cache()
@@ -109,88 +173,146 @@ namespace
     if (!file_manager.update_needed())
       return;
 
-    boost::filesystem::ifstream ifs(path());
-
-    // FIXME: this use of static may not be thread safe
-    static const boost::regex category_regex("^#\\+CATEGORY:[ \t]*([^ \t].*)$");
-    static const boost::regex outline_regex("^(\\*)+[ \t]*([^* \t][^*]*)$");
-    static const boost::regex org_url("\\[\\[((?:http|ftp|https)://[^\\]]+)\\]\\[([^\\]]+)\\]\\]");
-    static const boost::regex text_url("(?:http|ftp|https)://[/0-9A-Za-z_!~*'.;?:@&=+$,%#-]+");
-
     cache.clear();
-
-    std::string line;
-    std::vector<utf8_string> categories;
-    boost::smatch results;
-    while (getline(ifs, line))
-    {
-      // Check for a #+CATEGORY   line
-      if (regex_match(line, results, category_regex))
-      {
-        categories.resize(1);
-        categories[0] = results[1];
-        continue;
-      }
-
-      // Check for an outline specification
-      if (regex_match(line, results, outline_regex))
-      {
-        int level = results[1].length();
-        categories.resize(level + 1);
-        categories[level] = results[2];
-      }
-
-      // Search for URLs
-      std::string::const_iterator begin = line.begin(), end = line.end();
-      while (begin != end)
-      {
-        if (regex_search(begin, end, results, org_url))
-        {
-          begin = results[0].second;
-          ascii_string url = results[1];
-          utf8_string title = results[2];
-          cache.push_back(BookmarkSpec(url, title, categories));
-        } else if (regex_search(begin, end, results, text_url))
-        {
-          begin = results[0].second;
-          cache.push_back(BookmarkSpec(results[0], utf8_string(), categories));
-        } else break;
-      }
-
-    }
-
-    ifs.close();
+    revision_ = next_revision();
+    read_org_bookmarks(path(), cache);
   }
 
+  /* Parses each listed file into its own index segment on a thread
+     pool.  Files are watched through their directories, as editors
+     often save by renaming over the file; a change is acted on once
+     no further one comes for a moment. */
   class OrgFileListBookmarkSource : public BookmarkSource
   {
-    typedef std::map<boost::filesystem::path, boost::shared_ptr<OrgFileBookmarkSource> > Sources;
-    Sources sources;
-    FileCacheManager file_manager;
+    struct File
+    {
+      BookmarkIndex::SegmentPtr segment;
+      // When last parsed
+      BookmarkFileState state;
+      // Changed since its parse, if any, started
+      bool dirty;
+      bool parsing;
+      File() : dirty(true), parsing(false) {}
+    };
+    typedef std::map<boost::filesystem::path, File> Files;
+
+    const boost::filesystem::path path_;
+
+    boost::mutex mutex;
+    boost::condition_variable idle;
+    Files files;
+    BookmarkFileState list_state;
+    uint64_t revision_;
+    // Parses queued or running
+    size_t outstanding;
+    bool stopping;
+
+    // Only used on the event loop's thread
+    bool list_changed;
+    std::map<int, boost::filesystem::path> watches;
+    std::map<boost::filesystem::path, int> watched_directories;
+    InotifyEvent inotify;
+    TimerEvent timer;
+    ThreadPool pool;
+
+    void watch_directory(const boost::filesystem::path &dir);
+    void unwatch_unused_directories();
+    void load_list();
+    void start_parses();
+    void parse(const boost::filesystem::path &path);
+    void handle_inotify(int wd, uint32_t mask, uint32_t cookie, const char *name);
+    void handle_timer();
   public:
-    OrgFileListBookmarkSource(const boost::filesystem::path &path);
-    const boost::filesystem::path &path() const { return file_manager.path(); }
-    void update_cache();
+    OrgFileListBookmarkSource(const boost::filesystem::path &path, EventService &event_service);
+    const boost::filesystem::path &path() const { return path_; }
     virtual void get_bookmarks(std::vector<BookmarkSpec> &result);
+    virtual uint64_t revision();
+    virtual void get_index_segments(std::vector<BookmarkIndex::SegmentPtr> &result);
+    virtual void get_file_states(std::vector<BookmarkFileState> &result);
+    virtual void wait_for_load();
     virtual ~OrgFileListBookmarkSource();
   };
 
-  OrgFileListBookmarkSource::OrgFileListBookmarkSource(const boost::filesystem::path &path)
-    : file_manager(path)
-  {}
+  static const uint32_t org_directory_watch_mask =
+    IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+    | IN_ONLYDIR | IN_EXCL_UNLINK;
+
+  // How long a file must be left alone before it is reparsed
+  static const long org_settle_microseconds = 100000;
 
-  void OrgFileListBookmarkSource::update_cache()
+  // Parsing is mostly reading; a couple of threads per source suffice.
+  static const size_t org_parse_threads = 2;
+
+  OrgFileListBookmarkSource::OrgFileListBookmarkSource(const boost::filesystem::path &path,
+                                                       EventService &event_service)
+    : path_(path), revision_(next_revision()), outstanding(0), stopping(false),
+      list_changed(false),
+      inotify(event_service, boost::bind(&OrgFileListBookmarkSource::handle_inotify,
+                                         this, _1, _2, _3, _4)),
+      timer(event_service, boost::bind(&OrgFileListBookmarkSource::handle_timer, this)),
+      pool(org_parse_threads)
   {
-    if (!file_manager.update_needed())
+    watch_directory(path_.parent_path());
+    load_list();
+    start_parses();
+  }
+
+  OrgFileListBookmarkSource::~OrgFileListBookmarkSource()
+  {
+    boost::mutex::scoped_lock l(mutex);
+    stopping = true;
+    while (outstanding)
+      idle.wait(l);
+  }
+
+  void OrgFileListBookmarkSource::watch_directory(const boost::filesystem::path &dir)
+  {
+    const boost::filesystem::path d = dir.empty() ? "." : dir;
+    if (watched_directories.count(d))
       return;
+    int wd = inotify.add_watch(d.c_str(), org_directory_watch_mask, false);
+    if (wd < 0)
+    {
+      WARN("failed to watch directory of org file: %s", d.c_str());
+      return;
+    }
+    watches[wd] = d;
+    watched_directories[d] = wd;
+  }
 
-    boost::filesystem::ifstream ifs(path());
+  /* Stops watching directories containing neither the list nor any
+     listed file. */
+  void OrgFileListBookmarkSource::unwatch_unused_directories()
+  {
+    std::set<boost::filesystem::path> used;
+    used.insert(path_.parent_path().empty() ? "." : path_.parent_path());
+    BOOST_FOREACH (const Files::value_type &f, files)
+      used.insert(f.first.parent_path().empty() ? "." : f.first.parent_path());
+
+    for (std::map<boost::filesystem::path, int>::iterator it = watched_directories.begin(), next;
+         it != watched_directories.end(); it = next)
+    {
+      next = boost::next(it);
+      if (used.count(it->first))
+        continue;
+      inotify.rm_watch(it->second);
+      watches.erase(it->second);
+      watched_directories.erase(it);
+    }
+  }
+
+  void OrgFileListBookmarkSource::load_list()
+  {
+    BookmarkFileState state(path_.string());
+    boost::filesystem::ifstream ifs(path_);
     std::string line;
     if (!ifs)
-      WARN("failed to open org list file: %s", path().c_str());
+      WARN("failed to open org list file: %s", path_.c_str());
     std::set<boost::filesystem::path> new_paths;
     while (getline(ifs, line))
     {
+      if (line.empty())
+        continue;
       try
       {
         boost::filesystem::path p(expand_path_home(line));
@@ -203,41 +325,201 @@ namespace
 
     ifs.close();
 
-    for (Sources::iterator it = sources.begin(), next; it != sources.end(); it = next)
+    boost::mutex::scoped_lock l(mutex);
+    list_state = state;
+    bool removed = false;
+    for (Files::iterator it = files.begin(), next; it != files.end(); it = next)
     {
       next = boost::next(it);
       if (!new_paths.count(it->first))
-        sources.erase(it);
+      {
+        files.erase(it);
+        removed = true;
+      }
+    }
+    if (removed)
+    {
+      revision_ = next_revision();
+      unwatch_unused_directories();
     }
 
     BOOST_FOREACH (const boost::filesystem::path &path, new_paths)
     {
-      if (!sources.count(path))
+      if (!files.count(path))
+      {
+        files.insert(std::make_pair(path, File()));
+        watch_directory(path.parent_path());
+      }
+    }
+  }
+
+  void OrgFileListBookmarkSource::start_parses()
+  {
+    boost::mutex::scoped_lock l(mutex);
+    BOOST_FOREACH (Files::value_type &f, files)
+    {
+      if (!f.second.dirty || f.second.parsing)
+        continue;
+      f.second.dirty = false;
+      f.second.parsing = true;
+      ++outstanding;
+      pool.post(boost::bind(&OrgFileListBookmarkSource::parse, this, f.first));
+    }
+  }
+
+  // Runs on the thread pool.
+  void OrgFileListBookmarkSource::parse(const boost::filesystem::path &path)
+  {
+    BookmarkIndex::SegmentPtr segment;
+    {
+      boost::mutex::scoped_lock l(mutex);
+      if (stopping)
+      {
+        if (--outstanding == 0)
+          idle.notify_all();
+        return;
+      }
+    }
+
+    // A file that can't be read keeps its previous bookmarks, as it
+    // is most likely in the middle of being replaced.
+    BookmarkFileState state(path.string());
+    std::vector<BookmarkSpec> bookmarks;
+    bool ok = state.size >= 0 && read_org_bookmarks(path, bookmarks);
+    if (ok)
+      segment.reset(new BookmarkIndex::Segment(std::move(bookmarks)));
+
+    boost::mutex::scoped_lock l(mutex);
+    --outstanding;
+    Files::iterator it = files.find(path);
+    if (!stopping && it != files.end())
+    {
+      File &f = it->second;
+      f.parsing = false;
+      if (ok)
+      {
+        f.segment = segment;
+        f.state = state;
+        revision_ = next_revision();
+      }
+      if (f.dirty)
+      {
+        f.dirty = false;
+        f.parsing = true;
+        ++outstanding;
+        pool.post(boost::bind(&OrgFileListBookmarkSource::parse, this, path));
+      }
+    }
+    if (outstanding == 0)
+      idle.notify_all();
+  }
+
+  void OrgFileListBookmarkSource::handle_inotify(int wd, uint32_t mask, uint32_t cookie,
+                                                 const char *name)
+  {
+    if (mask & IN_Q_OVERFLOW)
+    {
+      // Events were lost: reparse what no longer looks as it did.
+      WARN("%s: inotify queue overflow", path_.c_str());
+      list_changed = true;
+      boost::mutex::scoped_lock l(mutex);
+      BOOST_FOREACH (Files::value_type &f, files)
+        if (BookmarkFileState(f.first.string()) != f.second.state)
+          f.second.dirty = true;
+    } else
+    {
+      std::map<int, boost::filesystem::path>::iterator w = watches.find(wd);
+      if (w == watches.end())
+        return;
+      if (mask & IN_IGNORED)
+      {
+        watched_directories.erase(w->second);
+        watches.erase(w);
+        return;
+      }
+      if (!name || !*name)
+        return;
+      const boost::filesystem::path p = w->second == "." ? boost::filesystem::path(name)
+        : w->second / name;
+      if (p == path_)
+        list_changed = true;
+      else
       {
-        sources.insert(std::make_pair(path, boost::shared_ptr<OrgFileBookmarkSource>(new OrgFileBookmarkSource(path))));
+        boost::mutex::scoped_lock l(mutex);
+        Files::iterator it = files.find(p);
+        if (it == files.end())
+          return;
+        it->second.dirty = true;
       }
     }
+    timer.wait_for(0, org_settle_microseconds);
+  }
+
+  void OrgFileListBookmarkSource::handle_timer()
+  {
+    if (list_changed)
+    {
+      list_changed = false;
+      load_list();
+    }
+    start_parses();
   }
 
   void OrgFileListBookmarkSource::get_bookmarks(std::vector<BookmarkSpec> &result)
   {
-    update_cache();
-    BOOST_FOREACH (const Sources::value_type &s, sources)
-      s.second->get_bookmarks(result);
+    boost::mutex::scoped_lock l(mutex);
+    BOOST_FOREACH (const Files::value_type &f, files)
+      if (f.second.segment)
+        result.insert(result.end(), f.second.segment->bookmarks().begin(),
+                      f.second.segment->bookmarks().end());
+  }
+
+  uint64_t OrgFileListBookmarkSource::revision()
+  {
+    boost::mutex::scoped_lock l(mutex);
+    return revision_;
   }
 
-  OrgFileListBookmarkSource::~OrgFileListBookmarkSource() {}
+  void OrgFileListBookmarkSource::get_index_segments(std::vector<BookmarkIndex::SegmentPtr> &result)
+  {
+    boost::mutex::scoped_lock l(mutex);
+    BOOST_FOREACH (const Files::value_type &f, files)
+      if (f.second.segment)
+        result.push_back(f.second.segment);
+  }
+
+  void OrgFileListBookmarkSource::wait_for_load()
+  {
+    boost::mutex::scoped_lock l(mutex);
+    while (outstanding)
+      idle.wait(l);
+  }
+
+  // As of the bookmarks held, which may lag behind the files.
+  void OrgFileListBookmarkSource::get_file_states(std::vector<BookmarkFileState> &result)
+  {
+    boost::mutex::scoped_lock l(mutex);
+    result.push_back(list_state);
+    BOOST_FOREACH (const Files::value_type &f, files)
+    {
+      result.push_back(f.second.state);
+      result.back().path = f.first.string();
+    }
+  }
 
 
   class HTMLBookmarkSource : public BookmarkSource
   {
     FileCacheManager file_manager;
     std::vector<BookmarkSpec> cache;
+    uint64_t revision_;
     void update_cache();
   public:
     HTMLBookmarkSource(const boost::filesystem::path &path);
     const boost::filesystem::path &path() const { return file_manager.path(); }
     virtual void get_bookmarks(std::vector<BookmarkSpec> &result);
+    virtual uint64_t revision();
+    virtual void get_file_states(std::vector<BookmarkFileState> &result);
     virtual ~HTMLBookmarkSource();
   };
 
@@ -249,8 +531,20 @@ namespace
     result.insert(result.end(), cache.begin(), cache.end());
   }
 
+  uint64_t HTMLBookmarkSource::revision()
+  {
+    update_cache();
+    return revision_;
+  }
+
+  void HTMLBookmarkSource::get_file_states(std::vector<BookmarkFileState> &result)
+  {
+    update_cache();
+    result.push_back(file_manager.state());
+  }
+
   HTMLBookmarkSource::HTMLBookmarkSource(const boost::filesystem::path &path)
-    : file_manager(path)
+    : file_manager(path), revision_(0)
   {}
 
   std::string decode_html(const std::string &str)
@@ -290,6 +584,7 @@ namespace
       return;
 
     cache.clear();
+    revision_ = next_revision();
 
     boost::filesystem::ifstream ifs(path());
 
@@ -310,14 +605,194 @@ namespace
 }
 
 
+namespace
+{
+  class SnapshotBookmarkSource : public BookmarkSource
+  {
+    const boost::shared_ptr<BookmarkSource> source;
+    const boost::filesystem::path path_;
+
+    boost::mutex mutex;
+    boost::condition_variable loaded_changed;
+    // Until source has loaded, the snapshot is served in its place.
+    bool loaded;
+    std::vector<BookmarkIndex::SegmentPtr> snapshot_segments;
+    const uint64_t snapshot_revision;
+    // As last read or written
+    std::vector<BookmarkFileState> saved_files;
+
+    bool saving;
+    bool save_pending;
+    std::vector<BookmarkFileState> pending_files;
+    std::vector<BookmarkIndex::SegmentPtr> pending_segments;
+
+    boost::thread loader;
+    boost::thread saver;
+
+    void load_source();
+    void save();
+  public:
+    SnapshotBookmarkSource(const boost::shared_ptr<BookmarkSource> &source,
+                           const boost::filesystem::path &path);
+    virtual void get_bookmarks(std::vector<BookmarkSpec> &result);
+    virtual uint64_t revision();
+    virtual void get_index_segments(std::vector<BookmarkIndex::SegmentPtr> &result);
+    virtual void get_file_states(std::vector<BookmarkFileState> &result);
+    virtual void wait_for_load();
+    virtual ~SnapshotBookmarkSource();
+  };
+
+  SnapshotBookmarkSource::SnapshotBookmarkSource(const boost::shared_ptr<BookmarkSource> &source,
+                                                 const boost::filesystem::path &path)
+    : source(source), path_(path), loaded(true), snapshot_revision(next_revision()),
+      saving(false), save_pending(false)
+  {
+    std::vector<BookmarkIndex::SegmentPtr> segments;
+    if (!read_bookmark_snapshot(path_, saved_files, segments))
+      return;
+
+    BOOST_FOREACH (const BookmarkFileState &f, saved_files)
+      if (BookmarkFileState(f.path) != f)
+        return;
+
+    snapshot_segments.swap(segments);
+    loaded = false;
+    loader = boost::thread(boost::bind(&SnapshotBookmarkSource::load_source, this));
+  }
+
+  SnapshotBookmarkSource::~SnapshotBookmarkSource()
+  {
+    // Nothing else can start a save now.
+    if (loader.joinable())
+      loader.join();
+    if (saver.joinable())
+      saver.join();
+  }
+
+  // Runs on the loader thread; the source is not otherwise used until
+  // it is done.
+  void SnapshotBookmarkSource::load_source()
+  {
+    source->wait_for_load();
+    std::vector<BookmarkIndex::SegmentPtr> segments;
+    source->get_index_segments(segments);
+    boost::mutex::scoped_lock l(mutex);
+    loaded = true;
+    snapshot_segments.clear();
+    loaded_changed.notify_all();
+  }
+
+  void SnapshotBookmarkSource::save()
+  {
+    boost::mutex::scoped_lock l(mutex);
+    while (save_pending)
+    {
+      save_pending = false;
+      std::vector<BookmarkFileState> files;
+      std::vector<BookmarkIndex::SegmentPtr> segments;
+      files.swap(pending_files);
+      segments.swap(pending_segments);
+      l.unlock();
+      write_bookmark_snapshot(path_, files, segments);
+      l.lock();
+    }
+    saving = false;
+  }
+
+  void SnapshotBookmarkSource::get_bookmarks(std::vector<BookmarkSpec> &result)
+  {
+    {
+      boost::mutex::scoped_lock l(mutex);
+      if (!loaded)
+      {
+        BOOST_FOREACH (const BookmarkIndex::SegmentPtr &s, snapshot_segments)
+          result.insert(result.end(), s->bookmarks().begin(), s->bookmarks().end());
+        return;
+      }
+    }
+    source->get_bookmarks(result);
+  }
+
+  uint64_t SnapshotBookmarkSource::revision()
+  {
+    {
+      boost::mutex::scoped_lock l(mutex);
+      if (!loaded)
+        return snapshot_revision;
+    }
+    return source->revision();
+  }
+
+  void SnapshotBookmarkSource::get_index_segments(std::vector<BookmarkIndex::SegmentPtr> &result)
+  {
+    {
+      boost::mutex::scoped_lock l(mutex);
+      if (!loaded)
+      {
+        result.insert(result.end(), snapshot_segments.begin(), snapshot_segments.end());
+        return;
+      }
+    }
+
+    // The states are taken first, so that at worst they are older than
+    // the segments and the snapshot is wrongly found stale.
+    std::vector<BookmarkFileState> files;
+    source->get_file_states(files);
+    const size_t first = result.size();
+    source->get_index_segments(result);
+
+    boost::mutex::scoped_lock l(mutex);
+    if (files == saved_files)
+      return;
+    saved_files = files;
+    pending_files.swap(files);
+    pending_segments.assign(result.begin() + first, result.end());
+    save_pending = true;
+    if (!saving)
+    {
+      saving = true;
+      if (saver.joinable())
+        saver.join();
+      saver = boost::thread(boost::bind(&SnapshotBookmarkSource::save, this));
+    }
+  }
+
+  void SnapshotBookmarkSource::get_file_states(std::vector<BookmarkFileState> &result)
+  {
+    {
+      boost::mutex::scoped_lock l(mutex);
+      if (!loaded)
+      {
+        result.insert(result.end(), saved_files.begin(), saved_files.end());
+        return;
+      }
+    }
+    source->get_file_states(result);
+  }
+
+  void SnapshotBookmarkSource::wait_for_load()
+  {
+    boost::mutex::scoped_lock l(mutex);
+    while (!loaded)
+      loaded_changed.wait(l);
+  }
+}
+
+boost::shared_ptr<BookmarkSource> snapshot_bookmark_source(const boost::shared_ptr<BookmarkSource> &source,
+                                                           const boost::filesystem::path &snapshot_path)
+{
+  return boost::shared_ptr<BookmarkSource>(new SnapshotBookmarkSource(source, snapshot_path));
+}
+
 boost::shared_ptr<BookmarkSource> org_file_bookmark_source(const boost::filesystem::path &path)
 {
   return boost::shared_ptr<BookmarkSource>(new OrgFileBookmarkSource(path));
 }
 
-boost::shared_ptr<BookmarkSource> org_file_list_bookmark_source(const boost::filesystem::path &path)
+boost::shared_ptr<BookmarkSource> org_file_list_bookmark_source(const boost::filesystem::path &path,
+                                                                EventService &event_service)
 {
-  return boost::shared_ptr<BookmarkSource>(new OrgFileListBookmarkSource(path));
+  return boost::shared_ptr<BookmarkSource>(new OrgFileListBookmarkSource(path, event_service));
 }
 
 boost::shared_ptr<BookmarkSource> html_bookmark_source(const boost::filesystem::path &path)
@@ -325,133 +800,148 @@ boost::shared_ptr<BookmarkSource> html_bookmark_source(const boost::filesystem::
   return boost::shared_ptr<BookmarkSource>(new HTMLBookmarkSource(path));
 }
 
-static bool compare_url_results(const std::pair<int, URLSpec> &a, const std::pair<int, URLSpec> &b)
+void BookmarkSource::get_index_segments(std::vector<BookmarkIndex::SegmentPtr> &result)
 {
-  int val = a.first - b.first;
-  if (val > 0)
-    return true;
-  if (val < 0)
-    return false;
-  val = a.second.url.size() - b.second.url.size();
-  if (val < 0)
-    return true;
-  if (val > 0)
-    return false;
-  val = a.second.title.size() - b.second.title.size();
-  if (val < 0)
-    return true;
-  return false;
+  boost::mutex::scoped_lock l(segment_mutex);
+  uint64_t r = revision();
+  if (!segment_ || r != segment_revision)
+  {
+    std::vector<BookmarkSpec> bookmarks;
+    get_bookmarks(bookmarks);
+    segment_.reset(new BookmarkIndex::Segment(std::move(bookmarks)));
+    segment_revision = r;
+  }
+  result.push_back(segment_);
 }
 
-static bool order_url_to_remove_duplicates(const BookmarkSpec &a,
-                                           const BookmarkSpec &b)
+boost::shared_ptr<const BookmarkIndex> BookmarkSource::index()
 {
-  int val = a.url.compare(b.url);
-  if (val < 0)
-    return true;
-  if (val > 0)
-    return false;
-
-  val = a.title.size() - b.title.size();
-  if (val < 0)
-    return false;
-  if (val > 0)
-    return true;
-
-  val = a.categories.size() - b.categories.size();
-  if (val > 0)
-    return true;
-  return false;
+  boost::mutex::scoped_lock l(index_mutex);
+  uint64_t r = revision();
+  if (!index_ || r != index_revision)
+  {
+    std::vector<BookmarkIndex::SegmentPtr> segments;
+    get_index_segments(segments);
+    index_.reset(new BookmarkIndex(segments));
+    index_revision = r;
+  }
+  return index_;
 }
 
-static bool compare_url_to_remove_duplicates(const BookmarkSpec &a,
-                                            const BookmarkSpec &b)
-{
-  return a.url == b.url;
-}
+// Only the best are listed; more are never looked at.
+static const size_t max_url_results = 1000;
 
-static void remove_duplicate_bookmarks(std::vector<BookmarkSpec> &spec)
+static menu::Menu::CompletionsPtr
+best_url_completions(const BookmarkIndex &index,
+                     std::vector<std::pair<int, uint32_t> > &results,
+                     const menu::url_completion::Style &style)
 {
-  std::sort(spec.begin(), spec.end(), order_url_to_remove_duplicates);
-  spec.erase(std::unique(spec.begin(), spec.end(), compare_url_to_remove_duplicates), spec.end());
+  const size_t n = std::min(results.size(), max_url_results);
+  std::partial_sort(results.begin(), results.begin() + n, results.end(),
+                    boost::bind(&BookmarkIndex::better, &index, _1, _2));
+  std::vector<URLSpec> specs;
+  specs.reserve(n);
+  for (size_t i = 0; i < n; ++i)
+  {
+    const BookmarkSpec &b = index.bookmark(results[i].second);
+    specs.push_back(URLSpec(b.url, b.title));
+  }
+  return make_url_completions(specs, style);
 }
 
 static menu::Menu::CompletionsPtr
-url_completions(const boost::shared_ptr<boost::optional<std::vector<BookmarkSpec> > > &bookmarks,
+url_completions(const boost::shared_ptr<boost::shared_ptr<const BookmarkIndex> > &index_ptr,
+                const boost::shared_ptr<menu::CandidateCache> &cache,
                 const boost::shared_ptr<BookmarkSource> &source,
                 const menu::url_completion::Style &style,
-                const menu::InputState &input)
+                const menu::Frecency::RankingPtr &ranking,
+                const menu::InputState &input,
+                menu::Menu::PartialResultSink &sink)
 {
-  if (!*bookmarks)
+  // The index is fixed for the life of the menu, so that candidate
+  // lists cached for one input still refer to the same bookmarks.
+  if (!*index_ptr)
   {
-    *bookmarks = std::vector<BookmarkSpec>();
-    source->get_bookmarks(bookmarks->get());
-    remove_duplicate_bookmarks(bookmarks->get());
+    *index_ptr = source->index();
+    cache->clear();
   }
+  const BookmarkIndex &index = **index_ptr;
 
   menu::Menu::CompletionsPtr completions;
 
-  std::vector<std::pair<int, URLSpec> > results;
+  std::vector<std::pair<int, uint32_t> > results;
   std::vector<utf8_string> words;
   boost::algorithm::split(words, input.text, boost::algorithm::is_any_of(" "),
                           boost::algorithm::token_compress_on);
+  std::vector<std::string> folded_words;
+  BOOST_FOREACH (const utf8_string &word, words)
+    if (!word.empty())
+      folded_words.push_back(BookmarkIndex::fold(word));
+
+  // Appending to the input only extends the last word or adds words,
+  // so a bookmark matching the new input matched the previous one.
+  // Otherwise the index narrows the search to the bookmarks with
+  // every trigram of the words.
+  // A bookmark's bonus for being chosen often and recently counts
+  // for as much as appearing in up to four more fields.
+  const menu::Frecency::Ranking *rank = ranking && !ranking->empty() ? ranking.get() : 0;
+
+  menu::CandidateCache::Candidates previous = cache->take(input.text);
+  std::vector<uint32_t> found, matched;
+  if (!previous && !index.candidates(folded_words, found))
+  {
+    found.resize(index.size());
+    for (uint32_t i = 0; i < found.size(); ++i)
+      found[i] = i;
+  }
+  const std::vector<uint32_t> &candidates = previous ? *previous : found;
 
-  BOOST_FOREACH (const BookmarkSpec &b, bookmarks->get())
+  for (size_t j = 0; j < candidates.size(); ++j)
   {
-    bool good = true;
-    bool none = true;
-    int score = 0;
-    BOOST_FOREACH (const utf8_string &word, words)
+    if ((j & 1023) == 0)
     {
-      if (word.empty())
-        continue;
-
-      int cur_score = 0;
-
-      if (boost::algorithm::ifind_first(b.url, word))
-        ++cur_score;
-      if (boost::algorithm::ifind_first(b.title, word))
-        ++cur_score;
-      BOOST_FOREACH (const utf8_string &cat, b.categories)
-        if (boost::algorithm::ifind_first(cat, word))
-          ++cur_score;
-
-      if (cur_score == 0)
+      if (menu::completion_cancelled())
+        return menu::Menu::CompletionsPtr();
+      if (sink.ready() && !results.empty())
       {
-        good = false;
-        break;
+        std::vector<std::pair<int, uint32_t> > partial(results);
+        sink.post(best_url_completions(index, partial, style));
       }
-      score += cur_score;
-      none = false;
     }
 
-    if (good && !none)
-      results.push_back(std::make_pair(score, URLSpec(b.url, b.title)));
+    const uint32_t i = candidates[j];
+    if (int score = index.score(i, folded_words))
+    {
+      score *= 16;
+      if (rank)
+        score += rank->bonus(index.bookmark(i).url);
+      results.push_back(std::make_pair(score, i));
+      matched.push_back(i);
+    }
   }
 
-  std::sort(results.begin(), results.end(), compare_url_results);
+  // With no words nothing matches, which says nothing about
+  // extensions of the input.
+  if (!folded_words.empty())
+    cache->store(input.text, std::move(matched));
+
   if (!results.empty())
-  {
-    std::vector<URLSpec> specs;
-    typedef std::pair<int,URLSpec> ResultValue;
-    BOOST_FOREACH(ResultValue const &v, results)
-      specs.push_back(v.second);
-    completions = make_url_completions(specs, style);
-  }
+    completions = best_url_completions(index, results, style);
 
   return completions;
 }
 
-menu::Menu::Completer url_completer(const boost::shared_ptr<BookmarkSource> &source,
-                                    const menu::url_completion::Style &style)
+menu::Menu::StreamingCompleter url_completer(const boost::shared_ptr<BookmarkSource> &source,
+                                             const menu::url_completion::Style &style,
+                                             const menu::Frecency::RankingPtr &ranking)
 {
   return boost::bind(&url_completions,
-                     boost::shared_ptr<boost::optional<std::vector<BookmarkSpec> > >
-                     (new boost::optional<std::vector<BookmarkSpec> >),
-                     source, boost::cref(style), _1);
+                     boost::shared_ptr<boost::shared_ptr<const BookmarkIndex> >
+                     (new boost::shared_ptr<const BookmarkIndex>),
+                     boost::shared_ptr<menu::CandidateCache>(new menu::CandidateCache),
+                     source, boost::cref(style), ranking, _1, _2);
 }
 
-
 static bool is_search_query(const utf8_string &text)
 {
   if (boost::algorithm::contains(text, "://"))
@@ -539,6 +1029,7 @@ void load_url_in_existing_frame(WM &wm,
 }
 
 void launch_browser_interactive(WM &wm, const boost::shared_ptr<BookmarkSource> &source,
+                                menu::Frecency &frecency,
                                 const menu::url_completion::Style &style)
 {
   menu::InitialState state;
@@ -549,14 +1040,15 @@ void launch_browser_interactive(WM &wm, const boost::shared_ptr<BookmarkSource>
   }
 
   wm.menu.read_string("URL:", state,
-                      boost::bind(&launch_browser, boost::ref(wm), _1, false),
+                      frecency.recorder("url", boost::bind(&launch_browser, boost::ref(wm), _1, false)),
                       menu::Menu::FailureAction(),
-                      url_completer(source, style),
+                      url_completer(source, style, frecency.ranking("url")),
                       true /* use delay */,
                       true /* use separate thread */);
 }
 
 void load_url_existing_interactive(WM &wm, const boost::shared_ptr<BookmarkSource> &source,
+                                   menu::Frecency &frecency,
                                    const menu::url_completion::Style &style)
 {
   menu::InitialState state;
@@ -566,16 +1058,17 @@ void load_url_existing_interactive(WM &wm, const boost::shared_ptr<BookmarkSourc
     if (Property<ascii_string> id = web_browser_tag(frame->client()))
       frame_id = id.get();
     else
-      return launch_browser_interactive(wm, source, style);
+      return launch_browser_interactive(wm, source, frecency, style);
 
     if (Property<ascii_string> url = web_browser_url(frame->client()))
       state = menu::InitialState::selected_suffix(url.get());
   }
 
   wm.menu.read_string("URL:", state,
-                      boost::bind(&load_url_in_existing_frame, boost::ref(wm), frame_id, _1, false),
+                      frecency.recorder("url", boost::bind(&load_url_in_existing_frame,
+                                                           boost::ref(wm), frame_id, _1, false)),
                       menu::Menu::FailureAction(),
-                      url_completer(source, style),
+                      url_completer(source, style, frecency.ranking("url")),
                       true /* use delay */,
                       true /* use separate thread */);
 }
@@ -2,46 +2,90 @@
 #define _WM_EXTRA_WEB_BROWSER_HPP
 
 #include <util/string.hpp>
+#include <cstdint>
 #include <vector>
 #include <boost/filesystem/path.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <util/range.hpp>
 #include <boost/signals2/connection.hpp>
 #include <menu/url_completion.hpp>
+#include <menu/frecency.hpp>
+#include <wm/extra/bookmark.hpp>
+#include <wm/extra/bookmark_index.hpp>
+#include <wm/extra/bookmark_snapshot.hpp>
 
-class BookmarkSpec
-{
-public:
-  BookmarkSpec(const ascii_string &url, const utf8_string &title,
-               const std::vector<utf8_string> &categories)
-    : url(url), title(title), categories(categories) {}
-  BookmarkSpec() {}
-  ascii_string url;
-  utf8_string title;
-  std::vector<utf8_string> categories;
-};
+class EventService;
 
 class BookmarkSource
 {
+  boost::mutex index_mutex;
+  boost::shared_ptr<const BookmarkIndex> index_;
+  uint64_t index_revision;
+  boost::mutex segment_mutex;
+  BookmarkIndex::SegmentPtr segment_;
+  uint64_t segment_revision;
+protected:
+  /* A revision number newer than any returned before. */
+  static uint64_t next_revision();
 public:
+  BookmarkSource();
   virtual void get_bookmarks(std::vector<BookmarkSpec> &result) = 0;
+
+  /* Changes whenever the bookmarks may have changed; reloads them if
+     needed to tell. */
+  virtual uint64_t revision() = 0;
+
+  /* Appends the bookmarks as index segments, which are reused for as
+     long as the bookmarks in them are unchanged.  By default all of
+     them in one segment, rebuilt when the revision changes. */
+  virtual void get_index_segments(std::vector<BookmarkIndex::SegmentPtr> &result);
+
+  /* Appends the states of the files the bookmarks were loaded from,
+     as of when they were. */
+  virtual void get_file_states(std::vector<BookmarkFileState> &result) = 0;
+
+  /* Waits for loading started in the background, if any, to finish.
+     By default sources load when first asked for their bookmarks. */
+  virtual void wait_for_load();
+
+  /* The index over the segments, rebuilt only when the revision
+     changes. */
+  boost::shared_ptr<const BookmarkIndex> index();
+
   virtual ~BookmarkSource();
 };
 
 class AggregateBookmarkSource : public BookmarkSource
 {
   std::vector<boost::shared_ptr<BookmarkSource> > sources;
+  uint64_t revision_;
 public:
   AggregateBookmarkSource();
   void add_source(const boost::shared_ptr<BookmarkSource> &source);
   virtual void get_bookmarks(std::vector<BookmarkSpec> &result);
+  virtual uint64_t revision();
+  virtual void get_index_segments(std::vector<BookmarkIndex::SegmentPtr> &result);
+  virtual void get_file_states(std::vector<BookmarkFileState> &result);
+  virtual void wait_for_load();
   virtual ~AggregateBookmarkSource();
 };
 
 boost::shared_ptr<BookmarkSource> org_file_bookmark_source(const boost::filesystem::path &path);
-boost::shared_ptr<BookmarkSource> org_file_list_bookmark_source(const boost::filesystem::path &path);
+/* Watches the list and the files in it with inotify, and reparses
+   changed files in the background. */
+boost::shared_ptr<BookmarkSource> org_file_list_bookmark_source(const boost::filesystem::path &path,
+                                                                EventService &event_service);
 boost::shared_ptr<BookmarkSource> html_bookmark_source(const boost::filesystem::path &path);
 
+/* Serves the index saved in snapshot_path, if the files it was built
+   from are unchanged, until source has loaded in the background, so
+   that the first menu after a restart need not wait for every file to
+   be parsed.  The snapshot is rewritten in the background whenever
+   the index changes. */
+boost::shared_ptr<BookmarkSource> snapshot_bookmark_source(const boost::shared_ptr<BookmarkSource> &source,
+                                                           const boost::filesystem::path &snapshot_path);
+
 class WM;
 
 void launch_browser(WM &wm, const utf8_string &text, bool direct);
@@ -50,8 +94,10 @@ void load_url_in_existing_frame(WM &wm,
                                 const utf8_string &text,
                                 bool direct);
 void load_url_existing_interactive(WM &wm, const boost::shared_ptr<BookmarkSource> &source,
+                                   menu::Frecency &frecency,
                                    const menu::url_completion::Style &style);
 void launch_browser_interactive(WM &wm, const boost::shared_ptr<BookmarkSource> &source,
+                                menu::Frecency &frecency,
                                 const menu::url_completion::Style &style);
 
 void write_bookmark(const ascii_string &url, const utf8_string &title,
@@ -60,7 +60,8 @@ int WM::frame_decoration_height() const
 /* TODO: maybe optimize this */
 void WFrame::draw()
 {
-  WDrawable &d = wm().buffer_pixmap.drawable();
+  WBackBuffer &buffer = client().back_buffer;
+  WDrawable &d = buffer.prepare(bounds.width, bounds.height);
   WFrameStyle &style = wm().frame_style;
 
   WFrameStyleScheme &scheme = (marked() ? style.marked : style.normal);
@@ -155,9 +156,15 @@ void WFrame::draw()
   }
 
 
-  XCopyArea(wm().display(), d.drawable(),
-            client().frame_xwin(),
-            wm().dc.gc(),
-            0, 0, bounds.width, bounds.height,
-            0, 0);
+  buffer.copy_to(client().frame_xwin(), WRect(0, 0, bounds.width, bounds.height));
+}
+
+void WFrame::repaint()
+{
+  WBackBuffer &buffer = client().back_buffer;
+
+  if (!buffer.valid(bounds.width, bounds.height))
+    draw();
+
+  buffer.repair(client().frame_xwin());
 }
@@ -14,14 +14,17 @@
 #include <wm/extra/network_applet.hpp>
 #include <wm/extra/device_applet.hpp>
 #include <wm/extra/cwd.hpp>
+#include <wm/extra/launch.hpp>
 
 #include <wm/extra/web_browser.hpp>
 
 #include <boost/filesystem/path.hpp>
 
 #include <menu/file_completion.hpp>
+#include <menu/project_files.hpp>
 
 #include <util/spawn.hpp>
+#include <util/launcher.hpp>
 
 #include <style/db.hpp>
 
@@ -98,7 +101,9 @@ void edit_file(const std::string &cwd,
 }
 
 
-void edit_file_interactive(WM &wm, const menu::file_completion::EntryStyler &entry_styler)
+void edit_file_interactive(WM &wm, const menu::file_completion::EntryStyler &entry_styler,
+                           menu::file_completion::DirectoryCache &directory_cache,
+                           menu::Frecency &frecency)
 {
   utf8_string cwd = get_selected_cwd(wm);
   if (cwd.empty())
@@ -109,14 +114,42 @@ void edit_file_interactive(WM &wm, const menu::file_completion::EntryStyler &ent
     cwd = compact_path_home(buf);
   }
   wm.menu.read_string("Emacs", menu::InitialState::selected_prefix(cwd + "/"),
-                      boost::bind(&edit_file, expand_path_home(cwd), _1),
+                      menu::file_completion::file_recorder(frecency, "path", expand_path_home(cwd),
+                                                           boost::bind(&edit_file,
+                                                                       expand_path_home(cwd), _1)),
                       menu::Menu::FailureAction(),
-                      menu::file_completion::file_completer(expand_path_home(cwd), entry_styler),
+                      menu::file_completion::file_completer(expand_path_home(cwd), entry_styler,
+                                                            directory_cache,
+                                                            frecency.ranking("path")),
                       true, /* use delay */
                       true); /* use separate thread */
 }
 
 
+/* Opens a file anywhere below the project containing the selected
+   client's directory, found by fuzzy matching its relative path. */
+void edit_project_file_interactive(WM &wm, menu::project_files::IndexSet &project_indices,
+                                   menu::Frecency &frecency,
+                                   const menu::list_completion::EntryStyle &style)
+{
+  utf8_string cwd = get_selected_cwd(wm);
+  if (cwd.empty())
+  {
+    char buf[256];
+    buf[255] = 0;
+    getcwd(buf, 256);
+    cwd = compact_path_home(buf);
+  }
+  std::string root = menu::project_files::find_project_root(expand_path_home(cwd));
+  wm.menu.read_string("Emacs " + compact_path_home(root) + "/", menu::InitialState(),
+                      frecency.recorder("file:" + root, boost::bind(&edit_file, root, _1)),
+                      menu::Menu::FailureAction(),
+                      menu::project_files::project_file_completer(project_indices.get(root), style,
+                                                                  frecency.ranking("file:" + root)),
+                      true, /* use delay */
+                      true); /* use separate thread */
+}
+
 void see_file(const std::string &cwd,
                const utf8_string &filename)
 {
@@ -124,7 +157,9 @@ void see_file(const std::string &cwd,
   spawnl(cwd.c_str(), program, program, expand_path_home(filename).c_str(), (const char *)0);
 }
 
-void see_file_interactive(WM &wm, const menu::file_completion::EntryStyler &entry_styler)
+void see_file_interactive(WM &wm, const menu::file_completion::EntryStyler &entry_styler,
+                          menu::file_completion::DirectoryCache &directory_cache,
+                          menu::Frecency &frecency)
 {
   utf8_string cwd = get_selected_cwd(wm);
   if (cwd.empty())
@@ -135,9 +170,13 @@ void see_file_interactive(WM &wm, const menu::file_completion::EntryStyler &entr
     cwd = compact_path_home(buf);
   }
   wm.menu.read_string("View:", menu::InitialState::selected_prefix(cwd + "/"),
-                      boost::bind(&see_file, expand_path_home(cwd), _1),
+                      menu::file_completion::file_recorder(frecency, "path", expand_path_home(cwd),
+                                                           boost::bind(&see_file,
+                                                                       expand_path_home(cwd), _1)),
                       menu::Menu::FailureAction(),
-                      menu::file_completion::file_completer(expand_path_home(cwd), entry_styler),
+                      menu::file_completion::file_completer(expand_path_home(cwd), entry_styler,
+                                                            directory_cache,
+                                                            frecency.ranking("path")),
                       true, /* use delay */
                       true); /* use separate thread */
 }
@@ -159,6 +198,11 @@ void dictionary_lookup_interactive(WM &wm)
 int main(int argc, char **argv)
 {
 
+  /* Start programs from a small process forked before anything large
+     is loaded, unless disabled. */
+  if (!getenv("JMSWM_NO_LAUNCHER"))
+    start_launcher();
+
   /* Set up child handling */
   {
     struct sigaction act;
@@ -171,6 +215,7 @@ int main(int argc, char **argv)
   set_close_on_exec_flag(ConnectionNumber(xdisplay.display()), true);
 
   EventService event_service;
+  LauncherReplies launcher_replies(event_service);
 
   // Style database
   style::DB style_db;
@@ -202,6 +247,15 @@ int main(int argc, char **argv)
    * File completion style
    */
   menu::file_completion::EntryStyler file_completion_styler(wm.dc, style_db["file_completion"]);
+  menu::file_completion::DirectoryCache file_completion_cache(event_service);
+  menu::project_files::IndexSet project_indices(event_service);
+
+  menu::Frecency frecency("/home/jbms/.jmswm/frecency");
+
+  const char *search_path = getenv("PATH");
+  menu::path_commands::CommandIndex path_commands(event_service,
+                                                  search_path ? search_path : "/usr/bin:/bin",
+                                                  default_list_entry_style);
 
   /**
    * URL completion style
@@ -229,6 +283,7 @@ int main(int argc, char **argv)
 
   command_list.add("toggle_fullscreen", boost::bind(&toggle_fullscreen, boost::ref(wm)));
   command_list.add("save_state", boost::bind(&WM::save_state_to_server, boost::ref(wm)));
+  command_list.add("bar_update_stats", boost::bind(&WBar::log_update_stats, boost::ref(wm.bar)));
 
   command_list.add("xprop", boost::bind(&get_xprop_info_for_current_client, boost::ref(wm)));
   command_list.add("xwininfo", boost::bind(&get_xwininfo_info_for_current_client, boost::ref(wm)));
@@ -265,14 +320,17 @@ int main(int argc, char **argv)
                       boost::ref(wm),
                       terminal_emulator));
 
-  wm.bind("mod4-x mod4-x", execute_shell_command_cwd_interactive);
+  wm.bind("mod4-x mod4-x", boost::bind(&execute_shell_command_cwd_interactive,
+                                       boost::ref(wm), boost::cref(path_commands),
+                                       boost::ref(frecency)));
 
   wm.bind("mod4-a", boost::bind(&WCommandList::execute_interactive,
-                                boost::ref(command_list), boost::ref(wm),
+                                boost::ref(command_list), boost::ref(wm), boost::ref(frecency),
                                 boost::cref(default_list_entry_style)));
 
   wm.bind("mod4-t", boost::bind(&switch_to_view_interactive,
-                                boost::ref(wm), boost::cref(default_list_entry_style)));
+                                boost::ref(wm), boost::ref(frecency),
+                                boost::cref(default_list_entry_style)));
 
   /*
   wm.bind("mod4-x e",
@@ -282,11 +340,21 @@ int main(int argc, char **argv)
   */
   wm.bind("mod4-x e", boost::bind(&edit_file_interactive,
                                   boost::ref(wm),
-                                  boost::cref(file_completion_styler)));
+                                  boost::cref(file_completion_styler),
+                                  boost::ref(file_completion_cache),
+                                  boost::ref(frecency)));
+
+  wm.bind("mod4-x f", boost::bind(&edit_project_file_interactive,
+                                  boost::ref(wm),
+                                  boost::ref(project_indices),
+                                  boost::ref(frecency),
+                                  boost::cref(default_list_entry_style)));
 
   wm.bind("mod4-x v", boost::bind(&see_file_interactive,
                                   boost::ref(wm),
-                                  boost::cref(file_completion_styler)));
+                                  boost::cref(file_completion_styler),
+                                  boost::ref(file_completion_cache),
+                                  boost::ref(frecency)));
 
   wm.bind("mod4-x n", boost::bind(&execute_shell_command_selected_cwd,
                                   boost::ref(wm),
@@ -297,13 +365,15 @@ int main(int argc, char **argv)
 
   boost::shared_ptr<AggregateBookmarkSource> bookmark_source(new AggregateBookmarkSource());
   bookmark_source->add_source(html_bookmark_source("/home/jbms/.firefox-profile/bookmarks.html"));
-  bookmark_source->add_source(org_file_list_bookmark_source("/home/jbms/misc/plan/org-agenda-files"));
+  bookmark_source->add_source(org_file_list_bookmark_source("/home/jbms/misc/plan/org-agenda-files", event_service));
   bookmark_source->add_source(org_file_bookmark_source("/home/jbms/.jmswm/bookmarks.org"));
+  boost::shared_ptr<BookmarkSource> bookmarks
+    = snapshot_bookmark_source(bookmark_source, "/home/jbms/.jmswm/bookmark-index");
 
-  wm.bind("mod4-x b", boost::bind(&launch_browser_interactive, boost::ref(wm), bookmark_source,
-                                  boost::cref(url_completion_style)));
-  wm.bind("mod4-x mod4-b", boost::bind(&load_url_existing_interactive, boost::ref(wm), bookmark_source,
-                                       boost::cref(url_completion_style)));
+  wm.bind("mod4-x b", boost::bind(&launch_browser_interactive, boost::ref(wm), bookmarks,
+                                  boost::ref(frecency), boost::cref(url_completion_style)));
+  wm.bind("mod4-x mod4-b", boost::bind(&load_url_existing_interactive, boost::ref(wm), bookmarks,
+                                       boost::ref(frecency), boost::cref(url_completion_style)));
   wm.bind("mod4-x k", boost::bind(&bookmark_current_url, boost::ref(wm), "/home/jbms/.jmswm/bookmarks.org"));
 
   wm.bind("mod4-x c",
@@ -396,6 +466,11 @@ int main(int argc, char **argv)
   ErcApplet erc_applet(wm, style_db["erc_applet"],
                        WBar::begin(WBar::RIGHT));
 
+  // After the applets, so that their placement rules come first
+  LaunchTracker launch_tracker(wm);
+  command_list.add("launch_latency", boost::bind(&LaunchTracker::log_histograms,
+                                                 boost::cref(launch_tracker)));
+
   for (char c = 'a'; c <= 'z'; ++c)
   {
     ascii_string str;
@@ -417,10 +492,10 @@ int main(int argc, char **argv)
   wm.bind("mod4-r", boost::bind(&PreviousViewInfo::switch_to, boost::ref(prev_info)));
 
   wm.bind("mod4-k m", boost::bind(&move_current_frame_to_other_view_interactive,
-                                  boost::ref(wm),
+                                  boost::ref(wm), boost::ref(frecency),
                                   boost::cref(default_list_entry_style)));
   wm.bind("mod4-k j", boost::bind(&copy_current_frame_to_other_view_interactive,
-                                  boost::ref(wm),
+                                  boost::ref(wm), boost::ref(frecency),
                                   boost::cref(default_list_entry_style)));
   wm.bind("mod4-k k", remove_current_frame);
   wm.bind("mod4-y", move_marked_frames_to_current_view);
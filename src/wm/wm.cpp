@@ -69,7 +69,7 @@ WM::WM(int argc, char **argv,
     last_timestamp(CurrentTime),
     argv(argv), argc(argc),
     dc(*this),
-    buffer_pixmap(dc),
+    hidden_back_buffer_limit(64 * 1024 * 1024),
     frame_style(dc, style_spec),
     selected_view_(0),
     frame_activity_event(event_service_, boost::bind(&WM::handle_frame_activity, this)),
@@ -111,8 +111,6 @@ WM::WM(int argc, char **argv,
 
   set_root_window_cursor(*this);
 
-  buffer_pixmap.reset(screen_width(), screen_height());
-
   mod_info.update(display());
 
   key_sequence_timeout.tv_sec = 5;
@@ -146,6 +144,21 @@ void WM::schedule_set_input_focus_to_root()
   scheduled_set_input_focus_to_root = true;
 }
 
+void WM::trim_hidden_back_buffers()
+{
+  size_t total = 0;
+  BOOST_FOREACH (WClient &c, hidden_back_buffers)
+    total += c.back_buffer.size_in_bytes();
+
+  while (total > hidden_back_buffer_limit && !hidden_back_buffers.empty())
+  {
+    WClient &c = hidden_back_buffers.front();
+    total -= c.back_buffer.size_in_bytes();
+    c.back_buffer.release();
+    hidden_back_buffers.pop_front();
+  }
+}
+
 void WClient::schedule_task(unsigned int task)
 {
   if (!scheduled_tasks)
@@ -66,6 +66,9 @@ const long WM_EVENT_MASK_FRAMEWIN = (SubstructureRedirectMask |
 typedef boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>,
                                          boost::intrusive::tag<struct ScheduledTaskList_tag> > ScheduledTaskList_base_hook;
 
+typedef boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>,
+                                         boost::intrusive::tag<struct HiddenBackBufferList_tag> > HiddenBackBufferList_base_hook;
+
 typedef boost::intrusive::list_base_hook<boost::intrusive::tag<struct WColumn_FramesByActivity_tag> >
 WColumn_FramesByActivity_base_hook;
 
@@ -177,8 +180,30 @@ public:
 
   WDrawContext dc;
 
-  /* This is used as a buffer for all drawing operations. */
-  WPixmap buffer_pixmap;
+  /**
+   * }}}
+   */
+
+  /**
+   * {{{ Back buffers
+   */
+private:
+
+  typedef boost::intrusive::list<WClient,
+                                 boost::intrusive::base_hook<HiddenBackBufferList_base_hook>,
+                                 boost::intrusive::constant_time_size<false> > HiddenBackBufferList;
+
+  /* Clients whose frame window is unmapped but which still hold a back
+     buffer, least recently hidden first. */
+  HiddenBackBufferList hidden_back_buffers;
+
+  void trim_hidden_back_buffers();
+
+public:
+
+  /* Upper bound, in bytes, on the server memory kept for the back
+     buffers of hidden frames.  Visible windows always keep theirs. */
+  size_t hidden_back_buffer_limit;
 
   /**
    * }}}
@@ -377,6 +402,7 @@ public:
   boost::signals2::signal<bool (WClient *), util::RunUntilSuccess> update_client_name_hook;
   boost::signals2::signal<bool (WClient *), util::RunUntilSuccess> place_client_hook;
   boost::signals2::signal<void (WClient *)> post_place_client_hook;
+  boost::signals2::signal<void (WClient *)> expose_client_hook;
   boost::signals2::signal<void (WFrame *, unsigned int &)> update_desired_net_wm_state_hook;
 
   /**
@@ -501,6 +527,9 @@ class WClient
 /* For the WM scheduled work clients list */
   : public ScheduledTaskList_base_hook,
 
+    /* For WM::hidden_back_buffers */
+    public HiddenBackBufferList_base_hook,
+
     public weak_iptr<WClient>::base,
 
     public PropertyContainer
@@ -590,6 +619,7 @@ private:
   static const unsigned int UPDATE_SERVER_FLAG =   0x2;
   static const unsigned int SET_INPUT_FOCUS_FLAG = 0x4;
   static const unsigned int WARP_POINTER_FLAG =    0x8;
+  static const unsigned int REPAINT_FLAG =         0x10;
 
   unsigned int scheduled_tasks;
 
@@ -598,8 +628,15 @@ private:
 
 public:
 
+  /* Retained contents of the frame window, so that exposures can be
+     repaired without redrawing. */
+  WBackBuffer back_buffer;
+
   void schedule_update_server() { schedule_task(UPDATE_SERVER_FLAG); }
   void schedule_draw() { schedule_task(DRAW_FLAG); }
+
+  /* Restores the damaged area of back_buffer to the frame window. */
+  void schedule_repaint() { schedule_task(REPAINT_FLAG); }
   void schedule_set_input_focus() { schedule_task(SET_INPUT_FOCUS_FLAG); }
   void schedule_warp_pointer() { schedule_task(WARP_POINTER_FLAG); }
 
@@ -818,6 +855,10 @@ public:
 
   void draw();
 
+  /* Restores the exposed parts of the frame window from the client's
+     back buffer, rendering first if the buffer is stale. */
+  void repaint();
+
   void remove();
 
 };